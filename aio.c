@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "aio.h"
+#include "types.h"
+
+#if defined(__linux__) && !defined(STEG_NO_IO_URING)
+#define AIO_HAVE_IO_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/* Backend picked when the service starts */
+typedef enum
+{
+    e_aio_none,
+    e_aio_uring,
+    e_aio_threads
+} AioBackend;
+
+/* One block buffer of the service */
+typedef struct
+{
+    unsigned char *buf;     // AIO_BLOCK_SIZE bytes
+    AioCopy *job;           // Job the block belongs to, NULL when free
+    size_t rel;             // Offset of the block inside the job
+    size_t len;             // Bytes in the block
+    int writing;            // 0 while reading, 1 while writing
+} AioSlot;
+
+static pthread_once_t aio_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aio_job_cond = PTHREAD_COND_INITIALIZER;     // New work queued
+static pthread_cond_t aio_done_cond = PTHREAD_COND_INITIALIZER;    // A job finished
+static AioBackend aio_backend = e_aio_none;
+static AioCopy *aio_pending;        // Jobs with bytes not yet handed out
+
+/* Function Definitions */
+
+/* Hand out the next block of pending work, called with aio_lock held */
+static int take_block(AioCopy **job, size_t *rel, size_t *len)
+{
+    AioCopy *cur = aio_pending;
+
+    if(cur == NULL)
+    {
+        return 0;
+    }
+
+    *job = cur;
+    *rel = cur -> issued;
+    *len = cur -> len - cur -> issued;
+    if(*len > AIO_BLOCK_SIZE)
+    {
+        *len = AIO_BLOCK_SIZE;
+    }
+
+    cur -> issued += *len;
+    cur -> inflight++;
+
+    // Every byte is handed out, later blocks come from the next job
+    if(cur -> issued == cur -> len)
+    {
+        aio_pending = cur -> next;
+        cur -> next = NULL;
+    }
+    return 1;
+}
+
+/* Drop a job from the pending list, called with aio_lock held */
+static void unlink_job(AioCopy *job)
+{
+    AioCopy **link = &aio_pending;
+
+    while(*link != NULL)
+    {
+        if(*link == job)
+        {
+            *link = job -> next;
+            job -> next = NULL;
+            return;
+        }
+        link = &(*link) -> next;
+    }
+}
+
+/* Account for a finished block, called with aio_lock held */
+static void finish_block(AioCopy *job, size_t len, int ok)
+{
+    job -> inflight--;
+
+    if(ok)
+    {
+        job -> completed += len;
+    }
+    else if(job -> error == 0)
+    {
+        // Stop handing out blocks for a failed job
+        job -> error = 1;
+        unlink_job(job);
+    }
+
+    if(job -> inflight == 0 && (job -> error || job -> completed == job -> len))
+    {
+        job -> done = 1;
+        pthread_cond_broadcast(&aio_done_cond);
+    }
+}
+
+/* Copy one block with pread/pwrite, skipping the read when buf already holds it */
+static int copy_block(AioCopy *job, unsigned char *buf, size_t rel, size_t len, int have_data)
+{
+    return (have_data || pread(job -> src_fd, buf, len, job -> src_off + rel) == (ssize_t)len) &&
+           pwrite(job -> dest_fd, buf, len, job -> dest_off + rel) == (ssize_t)len;
+}
+
+/* pread/pwrite worker: copies one block at a time */
+static void *thread_worker(void *arg)
+{
+    unsigned char *buf = arg;
+    AioCopy *job;
+    size_t rel, len;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&aio_lock);
+        while(take_block(&job, &rel, &len) == 0)
+        {
+            pthread_cond_wait(&aio_job_cond, &aio_lock);
+        }
+        pthread_mutex_unlock(&aio_lock);
+
+        int ok = copy_block(job, buf, rel, len, 0);
+
+        pthread_mutex_lock(&aio_lock);
+        finish_block(job, len, ok);
+        pthread_mutex_unlock(&aio_lock);
+    }
+    return NULL;
+}
+
+/* Start the pread/pwrite worker pool */
+static int start_threads(void)
+{
+    int started = 0;
+
+    for(int i = 0; i < AIO_FALLBACK_THREADS; i++)
+    {
+        unsigned char *buf = malloc(AIO_BLOCK_SIZE);
+        pthread_t tid;
+
+        if(buf == NULL)
+        {
+            break;
+        }
+        if(pthread_create(&tid, NULL, thread_worker, buf) != 0)
+        {
+            free(buf);
+            break;
+        }
+        pthread_detach(tid);
+        started++;
+    }
+    return started > 0;
+}
+
+#ifdef AIO_HAVE_IO_URING
+
+/* Shared ring, mapped once for the whole process */
+static struct
+{
+    int fd;
+    unsigned char *sq_ptr, *cq_ptr;     // Mappings, MAP_FAILED when not mapped
+    size_t sq_size, cq_size, sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    AioSlot slots[AIO_QUEUE_DEPTH];
+} ring;
+
+/* Unmap and close a partly or fully set up ring and free its slot buffers */
+static void uring_teardown(void)
+{
+    if(ring.sq_ptr != MAP_FAILED)
+    {
+        munmap(ring.sq_ptr, ring.sq_size);
+    }
+    if(ring.cq_ptr != MAP_FAILED)
+    {
+        munmap(ring.cq_ptr, ring.cq_size);
+    }
+    if(ring.sqes != MAP_FAILED)
+    {
+        munmap(ring.sqes, ring.sqes_size);
+    }
+    if(ring.fd >= 0)
+    {
+        close(ring.fd);
+    }
+    for(int i = 0; i < AIO_QUEUE_DEPTH; i++)
+    {
+        free(ring.slots[i].buf);
+        ring.slots[i].buf = NULL;
+    }
+    ring.fd = -1;
+    ring.sq_ptr = ring.cq_ptr = MAP_FAILED;
+    ring.sqes = MAP_FAILED;
+}
+
+/* 1 when the kernel supports the read and write opcodes the service uses
+ * Description: IORING_OP_READ / IORING_OP_WRITE came with Linux 5.6,
+ * as did IORING_REGISTER_PROBE, so a kernel that cannot be probed
+ * cannot run them either
+ */
+static int uring_probe(void)
+{
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    int ok = 0;
+
+    if(probe == NULL)
+    {
+        return 0;
+    }
+    if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) == 0 && probe -> ops_len > IORING_OP_WRITE)
+    {
+        ok = (probe -> ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+             (probe -> ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+/* Map the submission and completion queues of a new ring */
+static int uring_setup(void)
+{
+    struct io_uring_params p;
+
+    ring.sq_ptr = ring.cq_ptr = MAP_FAILED;
+    ring.sqes = MAP_FAILED;
+
+    memset(&p, 0, sizeof(p));
+    ring.fd = syscall(__NR_io_uring_setup, AIO_QUEUE_DEPTH * 2, &p);
+    if(ring.fd < 0)
+    {
+        return 0;
+    }
+
+    ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+
+    if(ring.sq_ptr == MAP_FAILED || ring.cq_ptr == MAP_FAILED || ring.sqes == MAP_FAILED || uring_probe() == 0)
+    {
+        uring_teardown();
+        return 0;
+    }
+
+    ring.sq_head = (unsigned *)(ring.sq_ptr + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(ring.sq_ptr + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(ring.sq_ptr + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(ring.sq_ptr + p.sq_off.array);
+    ring.cq_head = (unsigned *)(ring.cq_ptr + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(ring.cq_ptr + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(ring.cq_ptr + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(ring.cq_ptr + p.cq_off.cqes);
+    return 1;
+}
+
+/* Queue a read or write of a slot, submitted by the next io_uring_enter */
+static void uring_prep(int idx)
+{
+    AioSlot *slot = &ring.slots[idx];
+    unsigned tail = *ring.sq_tail;
+    unsigned pos = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[pos];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe -> opcode = slot -> writing ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe -> fd = slot -> writing ? slot -> job -> dest_fd : slot -> job -> src_fd;
+    sqe -> off = (slot -> writing ? slot -> job -> dest_off : slot -> job -> src_off) + slot -> rel;
+    sqe -> addr = (unsigned long)slot -> buf;
+    sqe -> len = slot -> len;
+    sqe -> user_data = idx;
+
+    ring.sq_array[pos] = pos;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Leave the queued work to the pread/pwrite threads, called with aio_lock held
+ * Description: when no thread starts either, every queued job
+ * fails instead of waiting for a service that is gone
+ */
+static void uring_hand_over(void)
+{
+    if(start_threads())
+    {
+        aio_backend = e_aio_threads;
+        pthread_cond_broadcast(&aio_job_cond);
+        return;
+    }
+
+    aio_backend = e_aio_none;
+    while(aio_pending != NULL)
+    {
+        AioCopy *job = aio_pending;
+
+        aio_pending = job -> next;
+        job -> next = NULL;
+        job -> error = 1;
+        if(job -> inflight == 0)
+        {
+            job -> done = 1;
+        }
+    }
+    pthread_cond_broadcast(&aio_done_cond);
+}
+
+/* io_uring service loop: reads feed writes, AIO_QUEUE_DEPTH blocks in flight
+ * Description: a block the kernel rejects with -EINVAL or -EOPNOTSUPP
+ * is copied with pread/pwrite instead, the ring stops taking new
+ * blocks and, once nothing is in flight, the rest of the work goes
+ * to the pread/pwrite threads. A failing io_uring_enter fails the
+ * blocks in flight and hands over at once; the ring stays mapped
+ * since the kernel may still own those blocks.
+ */
+static void *uring_worker(void *arg)
+{
+    unsigned to_submit = 0;
+    int inflight = 0;
+    int unsupported = 0;        // An opcode was rejected, stop taking blocks
+
+    (void)arg;
+    for(;;)
+    {
+        pthread_mutex_lock(&aio_lock);
+        if(unsupported && inflight == 0)
+        {
+            uring_hand_over();
+            pthread_mutex_unlock(&aio_lock);
+            return NULL;
+        }
+        while(inflight == 0 && to_submit == 0 && aio_pending == NULL)
+        {
+            pthread_cond_wait(&aio_job_cond, &aio_lock);
+        }
+
+        // Put every free slot to work on a new read
+        for(int i = 0; i < AIO_QUEUE_DEPTH && unsupported == 0; i++)
+        {
+            AioSlot *slot = &ring.slots[i];
+
+            if(slot -> job == NULL && take_block(&slot -> job, &slot -> rel, &slot -> len))
+            {
+                slot -> writing = 0;
+                uring_prep(i);
+                to_submit++;
+                inflight++;
+            }
+        }
+        pthread_mutex_unlock(&aio_lock);
+
+        int ret = syscall(__NR_io_uring_enter, ring.fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if(ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            perror("io_uring_enter");
+
+            // Fail the blocks in flight, their jobs report the error
+            pthread_mutex_lock(&aio_lock);
+            for(int i = 0; i < AIO_QUEUE_DEPTH; i++)
+            {
+                if(ring.slots[i].job != NULL)
+                {
+                    finish_block(ring.slots[i].job, ring.slots[i].len, 0);
+                    ring.slots[i].job = NULL;
+                }
+            }
+            uring_hand_over();
+            pthread_mutex_unlock(&aio_lock);
+            return NULL;
+        }
+        if(ret > 0)
+        {
+            to_submit -= ret;
+        }
+
+        // Reap completions: finished reads turn into writes of the same block
+        unsigned head = *ring.cq_head;
+        pthread_mutex_lock(&aio_lock);
+        while(head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            AioSlot *slot = &ring.slots[cqe -> user_data];
+            int ok = cqe -> res == (int)slot -> len;
+
+            head++;
+            if(cqe -> res == -EINVAL || cqe -> res == -EOPNOTSUPP)
+            {
+                // Opcode not usable on this kernel / file, copy the block by hand
+                pthread_mutex_unlock(&aio_lock);
+                ok = copy_block(slot -> job, slot -> buf, slot -> rel, slot -> len, slot -> writing);
+                pthread_mutex_lock(&aio_lock);
+                unsupported = 1;
+            }
+            if(ok && slot -> writing == 0 && slot -> job -> error == 0)
+            {
+                slot -> writing = 1;
+                uring_prep(cqe -> user_data);
+                to_submit++;
+                continue;
+            }
+
+            finish_block(slot -> job, slot -> len, ok);
+            slot -> job = NULL;
+            inflight--;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&aio_lock);
+    }
+    return NULL;
+}
+
+/* Set up the shared ring and its service thread */
+static int start_uring(void)
+{
+    pthread_t tid;
+
+    if(uring_setup() == 0)
+    {
+        return 0;
+    }
+
+    for(int i = 0; i < AIO_QUEUE_DEPTH; i++)
+    {
+        if((ring.slots[i].buf = malloc(AIO_BLOCK_SIZE)) == NULL)
+        {
+            uring_teardown();
+            return 0;
+        }
+    }
+
+    if(pthread_create(&tid, NULL, uring_worker, NULL) != 0)
+    {
+        uring_teardown();
+        return 0;
+    }
+    pthread_detach(tid);
+    return 1;
+}
+
+#endif
+
+/* Pick and start a backend, runs once per process */
+static void aio_service_init(void)
+{
+#ifdef AIO_HAVE_IO_URING
+    if(start_uring())
+    {
+        aio_backend = e_aio_uring;
+        return;
+    }
+#endif
+    if(start_threads())
+    {
+        aio_backend = e_aio_threads;
+    }
+}
+
+/* Queue a copy of len bytes, returns e_failure if no I/O service is available */
+Status aio_copy_start(AioCopy *job, int src_fd, off_t src_off, int dest_fd, off_t dest_off, size_t len)
+{
+    pthread_once(&aio_once, aio_service_init);
+    if(aio_backend == e_aio_none)
+    {
+        return e_failure;
+    }
+
+    memset(job, 0, sizeof(*job));
+    job -> src_fd = src_fd;
+    job -> dest_fd = dest_fd;
+    job -> src_off = src_off;
+    job -> dest_off = dest_off;
+    job -> len = len;
+
+    if(len == 0)            // Nothing to copy
+    {
+        job -> done = 1;
+        return e_success;
+    }
+
+    // Append to the pending list so jobs are served in order
+    pthread_mutex_lock(&aio_lock);
+    AioCopy **link = &aio_pending;
+    while(*link != NULL)
+    {
+        link = &(*link) -> next;
+    }
+    *link = job;
+    pthread_cond_broadcast(&aio_job_cond);
+    pthread_mutex_unlock(&aio_lock);
+
+    return e_success;
+}
+
+/* Wait until a started copy has finished */
+Status aio_copy_wait(AioCopy *job)
+{
+    pthread_mutex_lock(&aio_lock);
+    while(job -> done == 0)
+    {
+        pthread_cond_wait(&aio_done_cond, &aio_lock);
+    }
+    pthread_mutex_unlock(&aio_lock);
+
+    return job -> error ? e_failure : e_success;
+}
+
+/* Name of the backend in use: "io_uring", "threads" or "none" */
+const char *aio_backend_name(void)
+{
+    pthread_once(&aio_once, aio_service_init);
+
+    switch(aio_backend)
+    {
+        case e_aio_uring:
+            return "io_uring";
+        case e_aio_threads:
+            return "threads";
+        default:
+            return "none";
+    }
+}
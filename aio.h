@@ -0,0 +1,51 @@
+#ifndef AIO_H
+#define AIO_H
+#include <stddef.h>
+#include <sys/types.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Asynchronous block copy used for the chunked part of
+ * encoding (the image bytes after the payload window).
+ * One process wide I/O service keeps AIO_QUEUE_DEPTH blocks
+ * in flight across all jobs, so the copy runs while the
+ * caller embeds the payload.
+ * On Linux the service drives a shared io_uring; when that
+ * is unavailable (or STEG_NO_IO_URING is defined) it falls
+ * back to a pool of pread/pwrite threads.
+ */
+
+#define AIO_BLOCK_SIZE (256 * 1024)     // Bytes per read / write
+#define AIO_QUEUE_DEPTH 8               // Blocks in flight at once
+#define AIO_FALLBACK_THREADS 4          // pread/pwrite workers without io_uring
+
+typedef struct _AioCopy
+{
+    /* Request */
+    int src_fd;             // Carrier to read from
+    int dest_fd;            // Stego image to write to
+    off_t src_off;          // First byte to copy from carrier
+    off_t dest_off;         // Where that byte goes in stego image
+    size_t len;             // Bytes to copy
+
+    /* Progress, owned by the I/O service */
+    size_t issued;          // Bytes handed out as blocks
+    size_t completed;       // Bytes written
+    int inflight;           // Blocks being read or written
+    int error;              // Set on first failed read / write
+    int done;               // Nothing left in flight
+
+    struct _AioCopy *next;  // Link in the pending list
+
+} AioCopy;
+
+/* Queue a copy of len bytes, returns e_failure if no I/O service is available */
+Status aio_copy_start(AioCopy *job, int src_fd, off_t src_off, int dest_fd, off_t dest_off, size_t len);
+
+/* Wait until a started copy has finished */
+Status aio_copy_wait(AioCopy *job);
+
+/* Name of the backend in use: "io_uring", "threads" or "none" */
+const char *aio_backend_name(void);
+
+#endif
@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "analyze.h"
+#include "context.h"
+#include "types.h"
+
+#define RS_LANES 8                  // RS groups classified per vector
+#define RS_BLOCK 2048               // Vectors between reductions, keeps 16 bit counters from overflowing
+
+/* 8 signed 16 bit lanes, GCC vector extension (SSE2 / NEON or plain code elsewhere) */
+typedef short RsVec __attribute__((vector_size(16)));
+
+/* Counts of one band of rows */
+typedef struct
+{
+    uint32_t hist[ANALYZE_MAX_CHANNELS][256];   // Value histogram per channel
+    uint64_t rs[ANALYZE_MAX_CHANNELS][8];       // R_M, S_M, R_-M, S_-M, then the same with every LSB flipped
+} BandCounts;
+
+/* Image shared by the band workers */
+typedef struct
+{
+    const unsigned char *pixels;    // First pixel row in the file
+    size_t stride;                  // Bytes per row, padding included
+    uint width;
+    uint height;
+    uint bpp;                       // Bytes per pixel
+    BandCounts *bands;              // ANALYZE_BANDS of them
+    atomic_uint next;               // Next band to take
+} AnalyzePool;
+
+/* Function Definitions */
+
+/* Regularised lower incomplete gamma P(a, x) */
+static double gamma_p(double a, double x)
+{
+    if(x <= 0)
+    {
+        return 0;
+    }
+
+    double lead = exp(-x + a * log(x) - lgamma(a));
+
+    // Series below a + 1
+    if(x < a + 1)
+    {
+        double ap = a;
+        double del = 1 / a;
+        double sum = del;
+        for(int n = 0; n < 1000 && del > sum * 1e-15; n++)
+        {
+            ap += 1;
+            del *= x / ap;
+            sum += del;
+        }
+        return sum * lead;
+    }
+
+    // Continued fraction for Q(a, x) above it (modified Lentz)
+    double b = x + 1 - a;
+    double c = 1e300;
+    double d = 1 / b;
+    double h = d;
+    for(int i = 1; i < 1000; i++)
+    {
+        double an = -i * (i - a);
+
+        b += 2;
+        d = an * d + b;
+        d = fabs(d) < 1e-300 ? 1e-300 : d;
+        c = b + an / c;
+        c = fabs(c) < 1e-300 ? 1e-300 : c;
+        d = 1 / d;
+        h *= d * c;
+        if(fabs(d * c - 1) < 1e-15)
+        {
+            break;
+        }
+    }
+    return 1 - lead * h;
+}
+
+/* Chi-square p of the pairs of values of one histogram */
+static double chi_square_p(const uint64_t *hist)
+{
+    double chi = 0;
+    int pairs = 0;
+
+    for(int k = 0; k < 256; k += 2)
+    {
+        // Only pairs with an expected count above 4
+        double expected = (hist[k] + hist[k + 1]) / 2.0;
+        if(expected > 4)
+        {
+            double diff = hist[k] - expected;
+            chi += diff * diff / expected;
+            pairs++;
+        }
+    }
+    if(pairs < 2)
+    {
+        return 0;
+    }
+    return 1 - gamma_p((pairs - 1) / 2.0, chi / 2);
+}
+
+/* RS estimate of the embedding rate from the group counts */
+static double rs_rate(const uint64_t *rs)
+{
+    double d0 = (double)rs[0] - rs[1];      // R_M - S_M
+    double dn0 = (double)rs[2] - rs[3];     // R_-M - S_-M
+    double d1 = (double)rs[4] - rs[5];      // Same with every LSB flipped
+    double dn1 = (double)rs[6] - rs[7];
+
+    // 2 (d1 + d0) z^2 + (dn0 - dn1 - d1 - 3 d0) z + d0 - dn0 = 0, root of least magnitude
+    double a = 2 * (d1 + d0);
+    double b = dn0 - dn1 - d1 - 3 * d0;
+    double c = d0 - dn0;
+    double z;
+
+    if(fabs(a) < 1e-9)
+    {
+        z = fabs(b) < 1e-9 ? 0 : -c / b;
+    }
+    else
+    {
+        double disc = b * b - 4 * a * c;
+        double root = disc > 0 ? sqrt(disc) : 0;
+        double z1 = (-b + root) / (2 * a);
+        double z2 = (-b - root) / (2 * a);
+        z = fabs(z1) < fabs(z2) ? z1 : z2;
+    }
+
+    if(fabs(z - 0.5) < 1e-12)
+    {
+        return 1;
+    }
+    double p = z / (z - 0.5);
+    return p < 0 ? 0 : p > 1 ? 1 : p;
+}
+
+/* Smoothness of a group of 4 values */
+static inline __attribute__((always_inline)) int smoothness(int a, int b, int c, int d)
+{
+    return abs(b - a) + abs(c - b) + abs(d - c);
+}
+
+/* Negative shift F_-1: -1 <-> 0, 1 <-> 2, ... */
+static inline __attribute__((always_inline)) int flip_neg(int v)
+{
+    return ((v + 1) ^ 1) - 1;
+}
+
+/* Classify the RS groups of one channel of a row, mask 0 1 1 0 */
+static void rs_groups(const unsigned char *p, uint width, uint bpp, uint64_t *rs)
+{
+    uint64_t n[8] = { 0 };
+
+    for(uint x = 0; x + 4 <= width; x += 4)
+    {
+        int v0 = p[x * bpp], v1 = p[(x + 1) * bpp], v2 = p[(x + 2) * bpp], v3 = p[(x + 3) * bpp];
+        int u0 = v0 ^ 1, u1 = v1 ^ 1, u2 = v2 ^ 1, u3 = v3 ^ 1;
+
+        int f = smoothness(v0, v1, v2, v3);
+        int fm = smoothness(v0, u1, u2, v3);
+        int fn = smoothness(v0, flip_neg(v1), flip_neg(v2), v3);
+        int g = smoothness(u0, u1, u2, u3);
+        int gm = smoothness(u0, v1, v2, u3);
+        int gn = smoothness(u0, flip_neg(u1), flip_neg(u2), u3);
+
+        n[0] += fm > f;
+        n[1] += fm < f;
+        n[2] += fn > f;
+        n[3] += fn < f;
+        n[4] += gm > g;
+        n[5] += gm < g;
+        n[6] += gn > g;
+        n[7] += gn < g;
+    }
+
+    for(int i = 0; i < 8; i++)
+    {
+        rs[i] += n[i];
+    }
+}
+
+/* Lane-wise |x| */
+static inline __attribute__((always_inline)) RsVec vec_abs(RsVec x)
+{
+    RsVec sign = x >> 15;
+    return (x ^ sign) - sign;
+}
+
+/* Lane-wise smoothness of 8 groups */
+static inline __attribute__((always_inline)) RsVec vec_smoothness(RsVec a, RsVec b, RsVec c, RsVec d)
+{
+    return vec_abs(b - a) + vec_abs(c - b) + vec_abs(d - c);
+}
+
+/* Lane-wise negative shift */
+static inline __attribute__((always_inline)) RsVec vec_flip_neg(RsVec v)
+{
+    return ((v + 1) ^ 1) - 1;
+}
+
+/* Classify the RS groups of one channel of a row, 8 at a time
+ * Description: the 4 values of every group are first spread
+ * over 4 lane arrays, so each step below works on 8 whole
+ * groups; groups left over go through rs_groups()
+ */
+static void rs_row(const unsigned char *p, uint width, uint bpp, uint64_t *rs, short *lanes)
+{
+    uint groups = width / 4;
+    uint vecs = groups / RS_LANES;
+    size_t n = (size_t)vecs * RS_LANES;
+    short *q0 = lanes, *q1 = lanes + n, *q2 = lanes + 2 * n, *q3 = lanes + 3 * n;
+
+    for(size_t g = 0; g < n; g++)
+    {
+        const unsigned char *v = p + g * 4 * bpp;
+        q0[g] = v[0];
+        q1[g] = v[bpp];
+        q2[g] = v[2 * bpp];
+        q3[g] = v[3 * bpp];
+    }
+
+    for(uint start = 0; start < vecs; start += RS_BLOCK)
+    {
+        uint end = start + RS_BLOCK < vecs ? start + RS_BLOCK : vecs;
+        RsVec cnt[8] = { { 0 } };
+
+        for(uint i = start; i < end; i++)
+        {
+            RsVec v0, v1, v2, v3;
+
+            memcpy(&v0, q0 + i * RS_LANES, sizeof(v0));
+            memcpy(&v1, q1 + i * RS_LANES, sizeof(v1));
+            memcpy(&v2, q2 + i * RS_LANES, sizeof(v2));
+            memcpy(&v3, q3 + i * RS_LANES, sizeof(v3));
+            RsVec u0 = v0 ^ 1, u1 = v1 ^ 1, u2 = v2 ^ 1, u3 = v3 ^ 1;
+
+            RsVec f = vec_smoothness(v0, v1, v2, v3);
+            RsVec fm = vec_smoothness(v0, u1, u2, v3);
+            RsVec fn = vec_smoothness(v0, vec_flip_neg(v1), vec_flip_neg(v2), v3);
+            RsVec g = vec_smoothness(u0, u1, u2, u3);
+            RsVec gm = vec_smoothness(u0, v1, v2, u3);
+            RsVec gn = vec_smoothness(u0, vec_flip_neg(u1), vec_flip_neg(u2), u3);
+
+            // Comparisons give -1 per true lane
+            cnt[0] -= fm > f;
+            cnt[1] -= fm < f;
+            cnt[2] -= fn > f;
+            cnt[3] -= fn < f;
+            cnt[4] -= gm > g;
+            cnt[5] -= gm < g;
+            cnt[6] -= gn > g;
+            cnt[7] -= gn < g;
+        }
+
+        for(int k = 0; k < 8; k++)
+        {
+            for(int l = 0; l < RS_LANES; l++)
+            {
+                rs[k] += (unsigned short)cnt[k][l];
+            }
+        }
+    }
+
+    rs_groups(p + n * 4 * bpp, width - n * 4, bpp, rs);
+}
+
+/* Histogram one row, bpp is a constant at every call site */
+static inline __attribute__((always_inline)) void hist_row(const unsigned char *row, uint width, const uint bpp, uint32_t (*sub)[ANALYZE_MAX_CHANNELS][256])
+{
+    // Neighbouring pixels go to different tables, so repeated values do not stall
+    for(uint x = 0; x < width; x++)
+    {
+        for(uint c = 0; c < bpp; c++)
+        {
+            sub[x & 3][c][row[x * bpp + c]]++;
+        }
+    }
+}
+
+/* Histogram and classify bands until none are left */
+static void *analyze_worker(void *arg)
+{
+    AnalyzePool *pool = arg;
+    uint32_t (*sub)[ANALYZE_MAX_CHANNELS][256] = malloc(4 * sizeof(*sub));  // 4 interleaved histograms per channel
+    short *lanes = malloc((pool -> width + RS_LANES) * sizeof(short));     // RS lane arrays of one row
+    uint band;
+
+    while(sub != NULL && lanes != NULL && (band = atomic_fetch_add(&pool -> next, 1)) < ANALYZE_BANDS)
+    {
+        BandCounts *counts = &pool -> bands[band];
+        uint first = (uint64_t)pool -> height * band / ANALYZE_BANDS;
+        uint last = (uint64_t)pool -> height * (band + 1) / ANALYZE_BANDS;
+
+        memset(sub, 0, 4 * sizeof(*sub));
+        for(uint y = first; y < last; y++)
+        {
+            const unsigned char *row = pool -> pixels + y * pool -> stride;
+
+            if(pool -> bpp == 3)
+            {
+                hist_row(row, pool -> width, 3, sub);
+            }
+            else
+            {
+                hist_row(row, pool -> width, 4, sub);
+            }
+            for(uint c = 0; c < pool -> bpp; c++)
+            {
+                rs_row(row + c, pool -> width, pool -> bpp, counts -> rs[c], lanes);
+            }
+        }
+
+        for(uint c = 0; c < pool -> bpp; c++)
+        {
+            for(int v = 0; v < 256; v++)
+            {
+                counts -> hist[c][v] = sub[0][c][v] + sub[1][c][v] + sub[2][c][v] + sub[3][c][v];
+            }
+        }
+    }
+
+    free(sub);
+    free(lanes);
+    return NULL;
+}
+
+/* Turn the band counts into channel scores */
+static void score_bands(const BandCounts *bands, ImageScore *score)
+{
+    for(uint c = 0; c < score -> channels; c++)
+    {
+        ChannelScore *ch = &score -> channel[c];
+        uint64_t hist[256] = { 0 };
+        uint64_t rs[8] = { 0 };
+        int high = 1;   // Every prefix so far looks embedded
+
+        ch -> chi_prefix = 0;
+        for(uint b = 0; b < ANALYZE_BANDS; b++)
+        {
+            for(int v = 0; v < 256; v++)
+            {
+                hist[v] += bands[b].hist[c][v];
+            }
+            for(int i = 0; i < 8; i++)
+            {
+                rs[i] += bands[b].rs[c][i];
+            }
+
+            // Prefix of rows while the pairs stay even
+            if(high && (uint64_t)score -> height * (b + 1) / ANALYZE_BANDS > (uint64_t)score -> height * b / ANALYZE_BANDS)
+            {
+                high = chi_square_p(hist) >= 0.5;
+                ch -> chi_prefix = high ? (double)(b + 1) / ANALYZE_BANDS : ch -> chi_prefix;
+            }
+        }
+
+        ch -> chi_p = chi_square_p(hist);
+        ch -> rs_rate = rs_rate(rs);
+    }
+}
+
+/* Score a 24 or 32 bpp BMP */
+Status analyze_image(const char *fname, ImageScore *score, JobReport *report)
+{
+    CodecContext hdr;
+    AnalyzePool pool;
+    pthread_t tids[ANALYZE_MAX_THREADS];
+    size_t started = 0;
+    struct stat st;
+    Status ret = e_failure;
+
+    int fd = open(fname, O_RDONLY);
+    if(fd < 0)
+    {
+        perror("open");
+        fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
+        report_error(report, e_err_open);
+        return e_failure;
+    }
+    if(fstat(fd, &st) != 0 || st.st_size < BMP_HEADER_SIZE)
+    {
+        close(fd);
+        report_error(report, e_err_format);
+        return e_failure;
+    }
+
+    const unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        report_error(report, e_err_io);
+        return e_failure;
+    }
+
+    // Rows are padded to 4 bytes and may be stored top down (negative height)
+    codec_ctx_parse_header(&hdr, map);
+    size_t offset = map[10] | (map[11] << 8) | (map[12] << 16) | ((size_t)map[13] << 24);
+    int height = (int)hdr.height;
+    pool.width = hdr.width;
+    pool.height = height < 0 ? -height : height;
+    pool.bpp = hdr.bits_per_pixel / 8;
+    pool.stride = ((size_t)pool.width * pool.bpp + 3) & ~(size_t)3;
+    pool.pixels = map + offset;
+    atomic_init(&pool.next, 0);
+
+    if((pool.bpp != 3 && pool.bpp != 4) || offset < BMP_HEADER_SIZE || offset + pool.stride * pool.height > (size_t)st.st_size)
+    {
+        printf("Error: %s is not a 24 or 32 bpp BMP\n", fname);
+        report_error(report, e_err_format);
+    }
+    else if((pool.bands = calloc(ANALYZE_BANDS, sizeof(BandCounts))) != NULL)
+    {
+        // Enough rows per worker to be worth a thread
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t nthreads = (size_t)pool.width * pool.height / (1 << 20) + 1;
+        if(nthreads > ANALYZE_MAX_THREADS)
+        {
+            nthreads = ANALYZE_MAX_THREADS;
+        }
+        if(cpus > 0 && nthreads > (size_t)cpus)
+        {
+            nthreads = cpus;
+        }
+
+        // This thread is worker 0; bands of a thread that fails to start go to the others
+        for(size_t t = 1; t < nthreads; t++)
+        {
+            if(pthread_create(&tids[t], NULL, analyze_worker, &pool) == 0)
+            {
+                started |= 1UL << t;
+            }
+        }
+        analyze_worker(&pool);
+        for(size_t t = 1; t < nthreads; t++)
+        {
+            if(started & (1UL << t))
+            {
+                pthread_join(tids[t], NULL);
+            }
+        }
+
+        if(atomic_load(&pool.next) >= ANALYZE_BANDS)
+        {
+            score -> width = pool.width;
+            score -> height = pool.height;
+            score -> channels = pool.bpp;
+            score_bands(pool.bands, score);
+            ret = e_success;
+        }
+        free(pool.bands);
+    }
+
+    munmap((void *)map, st.st_size);
+    return ret;
+}
+
+/* Print the scores of an image */
+void analyze_print(const char *fname, const ImageScore *score)
+{
+    static const char *names[ANALYZE_MAX_CHANNELS] = { "blue", "green", "red", "alpha" };
+
+    printf("Analysis of %s (%ux%u, %u channels)\n", fname, score -> width, score -> height, score -> channels);
+    printf("  channel   chi2 p   prefix   RS rate\n");
+    for(uint c = 0; c < score -> channels; c++)
+    {
+        const ChannelScore *ch = &score -> channel[c];
+        printf("  %-7s %8.3f %7.1f%% %9.3f\n", names[c], ch -> chi_p, ch -> chi_prefix * 100, ch -> rs_rate);
+    }
+}
+
+/* Score and print each image, returns e_failure if any could not be read */
+Status do_analysis(char *fnames[], JobReport *report)
+{
+    ImageScore score;
+    Status ret = e_success;
+
+    for(int i = 0; fnames[i] != NULL; i++)
+    {
+        if(analyze_image(fnames[i], &score, report) == e_success)
+        {
+            analyze_print(fnames[i], &score);
+        }
+        else
+        {
+            ret = e_failure;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,60 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+#include "types.h" // Contains user defined types
+#include "report.h" // Machine readable job report
+
+/*
+ * LSB detectability self-check.
+ * Two standard statistics, per colour channel:
+ *
+ * Chi-square on pairs of values: LSB embedding evens out
+ * the counts of 2k and 2k+1. p is the probability that the
+ * pairs are that even by chance, near 1 for a carrier full
+ * of payload and near 0 for a clean one. Payload fills the
+ * image from its first row in the file (the bottom row of
+ * a bottom-up BMP), so p is also taken on growing prefixes
+ * in file order; "prefix" is the share of rows where it
+ * stays high.
+ *
+ * RS analysis: groups of 4 neighbouring pixels are sorted
+ * into regular and singular ones by how flipping LSBs
+ * changes their smoothness. Their counts give an estimate
+ * of the share of pixels that carry a message bit.
+ *
+ * Rows are split into ANALYZE_BANDS bands that workers
+ * histogram and classify in parallel; the bands are then
+ * summed in order, so results do not depend on the thread
+ * count.
+ */
+
+#define ANALYZE_BANDS 32            // Row bands, also the prefix resolution
+#define ANALYZE_MAX_THREADS 8       // Upper bound on band workers
+#define ANALYZE_MAX_CHANNELS 4      // B, G, R and alpha
+
+/* Scores of one channel */
+typedef struct _ChannelScore
+{
+    double chi_p;       // Chi-square p over the whole channel
+    double chi_prefix;  // Share of rows, from the first in the file, where p stays at 0.5 or more
+    double rs_rate;     // RS estimate of the share of pixels carrying message bits
+} ChannelScore;
+
+/* Scores of one image */
+typedef struct _ImageScore
+{
+    uint width;
+    uint height;
+    uint channels;      // Bytes per pixel
+    ChannelScore channel[ANALYZE_MAX_CHANNELS];
+} ImageScore;
+
+/* Score a 24 or 32 bpp BMP, failures are classified in report (may be NULL) */
+Status analyze_image(const char *fname, ImageScore *score, JobReport *report);
+
+/* Print the scores of an image */
+void analyze_print(const char *fname, const ImageScore *score);
+
+/* Score and print each image, returns e_failure if any could not be read */
+Status do_analysis(char *fnames[], JobReport *report);
+
+#endif
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "carrier_cache.h"
+#include "context.h"
+#include "types.h"
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CarrierEntry *lru_head;      // Most recently used
+static CarrierEntry *lru_tail;      // Least recently used
+static CarrierCacheStats cache_stats = { 0, 0, 0, 0, CARRIER_CACHE_DEFAULT_BUDGET };
+
+/* Function Definitions */
+
+/* Unlink an entry from the LRU list, called with cache_lock held */
+static void lru_remove(CarrierEntry *entry)
+{
+    if(entry -> prev != NULL)
+    {
+        entry -> prev -> next = entry -> next;
+    }
+    else
+    {
+        lru_head = entry -> next;
+    }
+
+    if(entry -> next != NULL)
+    {
+        entry -> next -> prev = entry -> prev;
+    }
+    else
+    {
+        lru_tail = entry -> prev;
+    }
+    entry -> prev = entry -> next = NULL;
+}
+
+/* Put an entry at the most recently used end, called with cache_lock held */
+static void lru_push_front(CarrierEntry *entry)
+{
+    entry -> prev = NULL;
+    entry -> next = lru_head;
+    if(lru_head != NULL)
+    {
+        lru_head -> prev = entry;
+    }
+    lru_head = entry;
+    if(lru_tail == NULL)
+    {
+        lru_tail = entry;
+    }
+}
+
+/* Evict idle entries, oldest first, until extra more bytes fit the budget */
+static void evict(size_t extra)
+{
+    CarrierEntry *entry = lru_tail;
+
+    while(entry != NULL && cache_stats.bytes + extra > cache_stats.budget)
+    {
+        CarrierEntry *prev = entry -> prev;
+
+        if(entry -> refs == 0)      // Entries in use stay until released
+        {
+            lru_remove(entry);
+            cache_stats.bytes -= entry -> map_len;
+            cache_stats.evictions++;
+            munmap((void *)entry -> map, entry -> map_len);
+            free(entry);
+        }
+        entry = prev;
+    }
+}
+
+/* Set the memory budget, evicting idle entries above it */
+void carrier_cache_set_budget(size_t budget)
+{
+    pthread_mutex_lock(&cache_lock);
+    cache_stats.budget = budget;
+    evict(0);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/* Get the cached carrier open on fd, mapping it on a miss; NULL if it cannot be cached */
+CarrierEntry *carrier_cache_get(int fd)
+{
+    struct stat st;
+    CarrierEntry *entry;
+
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < BMP_HEADER_SIZE)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    for(entry = lru_head; entry != NULL; entry = entry -> next)
+    {
+        if(entry -> dev == st.st_dev && entry -> ino == st.st_ino && entry -> size == st.st_size &&
+           entry -> mtime.tv_sec == st.st_mtim.tv_sec && entry -> mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            entry -> refs++;
+            lru_remove(entry);
+            lru_push_front(entry);
+            cache_stats.hits++;
+            pthread_mutex_unlock(&cache_lock);
+            return entry;
+        }
+    }
+    cache_stats.misses++;
+    pthread_mutex_unlock(&cache_lock);
+
+    // Larger than the whole budget, not worth caching
+    if((size_t)st.st_size > cache_stats.budget)
+    {
+        return NULL;
+    }
+
+    // Map outside the lock, a racing miss on the same file only costs a second mapping
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    if((entry = calloc(1, sizeof(CarrierEntry))) == NULL)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    entry -> dev = st.st_dev;
+    entry -> ino = st.st_ino;
+    entry -> mtime = st.st_mtim;
+    entry -> size = st.st_size;
+    entry -> map = map;
+    entry -> map_len = st.st_size;
+    entry -> refs = 1;
+
+    pthread_mutex_lock(&cache_lock);
+    evict(entry -> map_len);
+    cache_stats.bytes += entry -> map_len;
+    lru_push_front(entry);
+    pthread_mutex_unlock(&cache_lock);
+
+    return entry;
+}
+
+/* Drop a reference taken by carrier_cache_get() */
+void carrier_cache_put(CarrierEntry *entry)
+{
+    if(entry == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    entry -> refs--;
+    evict(0);       // Entries pinned while over budget go as soon as they are idle
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/* Copy out the hit / miss counters */
+void carrier_cache_stats(CarrierCacheStats *stats)
+{
+    pthread_mutex_lock(&cache_lock);
+    *stats = cache_stats;
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,57 @@
+#ifndef CARRIER_CACHE_H
+#define CARRIER_CACHE_H
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Cache of cover images that are reused for many encodes.
+ * An entry is a read-only shared mapping of the whole
+ * carrier, keyed by device, inode, mtime and size, so an
+ * edited or replaced file is never served stale. Entries
+ * are reference counted and evicted least recently used
+ * first once the mapped bytes exceed the budget.
+ */
+
+#define CARRIER_CACHE_DEFAULT_BUDGET (256UL * 1024 * 1024)  // Mapped bytes kept by default
+
+typedef struct _CarrierEntry
+{
+    /* Key */
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+
+    /* Cached carrier */
+    const unsigned char *map;   // Whole file, header first
+    size_t map_len;             // Bytes mapped (file size)
+
+    int refs;                   // Users holding the entry
+    struct _CarrierEntry *prev; // LRU list, most recent first
+    struct _CarrierEntry *next;
+} CarrierEntry;
+
+typedef struct _CarrierCacheStats
+{
+    unsigned long hits;         // Lookups served from the cache
+    unsigned long misses;       // Lookups that had to map the file
+    unsigned long evictions;    // Entries dropped to stay in budget
+    size_t bytes;               // Bytes currently mapped
+    size_t budget;              // Mapped bytes allowed
+} CarrierCacheStats;
+
+/* Set the memory budget, evicting idle entries above it */
+void carrier_cache_set_budget(size_t budget);
+
+/* Get the cached carrier open on fd, mapping it on a miss; NULL if it cannot be cached */
+CarrierEntry *carrier_cache_get(int fd);
+
+/* Drop a reference taken by carrier_cache_get() */
+void carrier_cache_put(CarrierEntry *entry);
+
+/* Copy out the hit / miss counters */
+void carrier_cache_stats(CarrierCacheStats *stats);
+
+#endif
@@ -4,4 +4,10 @@
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/* Magic string of images in any other layout, a 32 bit layout word follows it */
+#define MAGIC_STRING_EXT "#+"
+
+/* Magic string of each frame of a frame sequence, the layout word and a frame record follow it */
+#define MAGIC_STRING_SEQ "#="
+
 #endif
\ No newline at end of file
@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "container.h"
+#include "decode.h"
+#include "lsb_codec.h"
+#include "fec.h"
+#include "types.h"
+#include "common.h"
+
+/* Function Definitions */
+
+/* Name an entry is stored under: the file name without its directories */
+static const char *stored_name(const char *fname)
+{
+    const char *slash = strrchr(fname, '/');
+
+    return slash != NULL ? slash + 1 : fname;
+}
+
+/* Fill the index from the files to pack, sizes and flags from stat */
+Status container_index_build(ContainerIndex *index, char *fnames[], uint count)
+{
+    struct stat st;
+    size_t offset = 0;
+
+    if(count == 0 || count > CONTAINER_MAX_ENTRIES)
+    {
+        printf("Error: A container holds 1 to %d files\n", CONTAINER_MAX_ENTRIES);
+        return e_failure;
+    }
+
+    if((index -> entries = calloc(count, sizeof(ContainerEntry))) == NULL)
+    {
+        return e_failure;
+    }
+    index -> count = count;
+    index -> index_size = CONTAINER_HEAD_BYTES;
+
+    for(uint i = 0; i < count; i++)
+    {
+        ContainerEntry *entry = &index -> entries[i];
+        const char *name = stored_name(fnames[i]);
+        size_t len = strlen(name);
+
+        if(stat(fnames[i], &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            printf("ERROR: Unable to pack %s\n", fnames[i]);
+            return e_failure;
+        }
+        if(len == 0 || len > CONTAINER_MAX_NAME)
+        {
+            printf("Error: Bad entry name %s\n", fnames[i]);
+            return e_failure;
+        }
+        if(container_index_find(index, name) != NULL)
+        {
+            printf("Error: Two files are named %s\n", name);
+            return e_failure;
+        }
+        if(offset + st.st_size > UINT32_MAX)
+        {
+            printf("Error: Container larger than 4GB\n");
+            return e_failure;
+        }
+
+        memcpy(entry -> name, name, len + 1);
+        entry -> offset = offset;
+        entry -> length = st.st_size;
+        entry -> flags = st.st_mode & S_IXUSR ? CONTAINER_FLAG_EXEC : 0;
+        offset += st.st_size;
+        index -> index_size += CONTAINER_ENTRY_BYTES + len;
+    }
+
+    index -> data_size = offset;
+    return e_success;
+}
+
+/* Read every file after the index into buf and store the index in front of them */
+Status container_index_pack(ContainerIndex *index, char *fnames[], unsigned char *buf)
+{
+    unsigned char *data = buf + index -> index_size;
+    unsigned char *p = buf;
+
+    for(uint i = 0; i < index -> count; i++)
+    {
+        ContainerEntry *entry = &index -> entries[i];
+        FILE *fptr = fopen(fnames[i], "r");
+
+        if(fptr == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "ERROR: Unable to open file %s\n", fnames[i]);
+            return e_failure;
+        }
+
+        // The file must still be as large as the index says
+        size_t got = fread(data + entry -> offset, 1, entry -> length, fptr);
+        fclose(fptr);
+        if(got != entry -> length)
+        {
+            printf("Error: %s changed while packing\n", fnames[i]);
+            return e_failure;
+        }
+        entry -> crc = fec_crc32(0, data + entry -> offset, entry -> length);
+    }
+
+    lsb_store_be32(p, index -> count);
+    lsb_store_be32(p + 4, index -> data_size);
+    p += CONTAINER_HEAD_BYTES;
+
+    for(uint i = 0; i < index -> count; i++)
+    {
+        ContainerEntry *entry = &index -> entries[i];
+        size_t len = strlen(entry -> name);
+
+        lsb_store_be32(p, entry -> offset);
+        lsb_store_be32(p + 4, entry -> length);
+        lsb_store_be32(p + 8, entry -> flags);
+        lsb_store_be32(p + 12, entry -> crc);
+        p[16] = len;
+        memcpy(p + CONTAINER_ENTRY_BYTES, entry -> name, len);
+        p += CONTAINER_ENTRY_BYTES + len;
+    }
+    return e_success;
+}
+
+/* Parse count and data size of a stored index, allocating the entries */
+Status container_index_parse_head(ContainerIndex *index, const unsigned char *head)
+{
+    index -> count = lsb_load_be32(head);
+    index -> data_size = lsb_load_be32(head + 4);
+    index -> index_size = CONTAINER_HEAD_BYTES;
+
+    if(index -> count == 0 || index -> count > CONTAINER_MAX_ENTRIES)
+    {
+        printf("Error: Container index damaged (%u entries)\n", index -> count);
+        return e_failure;
+    }
+    if((index -> entries = calloc(index -> count, sizeof(ContainerEntry))) == NULL)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Parse the fixed part of entry i, returns the length of its name */
+uint container_index_parse_entry(ContainerIndex *index, uint i, const unsigned char *fixed)
+{
+    ContainerEntry *entry = &index -> entries[i];
+
+    entry -> offset = lsb_load_be32(fixed);
+    entry -> length = lsb_load_be32(fixed + 4);
+    entry -> flags = lsb_load_be32(fixed + 8);
+    entry -> crc = lsb_load_be32(fixed + 12);
+    index -> index_size += CONTAINER_ENTRY_BYTES + fixed[16];
+    return fixed[16];
+}
+
+/* Check the name of entry i and the span it claims
+ * Description: names become output files, so anything that
+ * could leave the current directory is refused
+ */
+Status container_index_check_entry(ContainerIndex *index, uint i)
+{
+    ContainerEntry *entry = &index -> entries[i];
+
+    if(entry -> name[0] == '\0' || strchr(entry -> name, '/') != NULL || strcmp(entry -> name, ".") == 0 || strcmp(entry -> name, "..") == 0 ||
+       (size_t)entry -> offset + entry -> length > index -> data_size)
+    {
+        printf("Error: Container index damaged (entry %u)\n", i);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Entry called name, NULL if the index has none */
+const ContainerEntry *container_index_find(const ContainerIndex *index, const char *name)
+{
+    for(uint i = 0; i < index -> count; i++)
+    {
+        if(strcmp(index -> entries[i].name, name) == 0)
+        {
+            return &index -> entries[i];
+        }
+    }
+    return NULL;
+}
+
+/* Release the entries */
+void container_index_free(ContainerIndex *index)
+{
+    free(index -> entries);
+    index -> entries = NULL;
+    index -> count = 0;
+}
+
+/* Read and validate List args from argv */
+Status read_and_validate_list_args(char *argv[], DecodeInfo *decInfo)
+{
+    // Stego image only
+    if(argv[2][0] != '.' && strstr(argv[2], ".bmp") != NULL)
+    {
+        decInfo -> dest_image_fname = argv[2];
+        return e_success;
+    }
+    return e_failure;
+}
+
+/* Read and validate Extract args from argv */
+Status read_and_validate_extract_args(char *argv[], DecodeInfo *decInfo)
+{
+    if(read_and_validate_list_args(argv, decInfo) == e_failure)
+    {
+        return e_failure;
+    }
+
+    // Entry to extract, written under its own name unless an output is given
+    decInfo -> entry_name = argv[3];
+    decInfo -> output_fname = argv[4];
+    return e_success;
+}
+
+/* Decode exactly len payload bytes of the index */
+static Status decode_index_bytes(DecodeInfo *decInfo, unsigned char *data, size_t len)
+{
+    if(decode_payload_stream(decInfo, data, len) != len)
+    {
+        printf("Error: Container index damaged\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Decode the container index, nothing after it is read */
+Status decode_container_index(DecodeInfo *decInfo)
+{
+    ContainerIndex *index = &decInfo -> index;
+    unsigned char fixed[CONTAINER_ENTRY_BYTES];
+
+    if(decInfo -> layout.container == 0)
+    {
+        printf("Error: Image does not hold a container\n");
+        return e_failure;
+    }
+
+    if(decode_index_bytes(decInfo, fixed, CONTAINER_HEAD_BYTES) == e_failure || container_index_parse_head(index, fixed) == e_failure)
+    {
+        return e_failure;
+    }
+
+    for(uint i = 0; i < index -> count; i++)
+    {
+        uint len;
+
+        if(decode_index_bytes(decInfo, fixed, CONTAINER_ENTRY_BYTES) == e_failure)
+        {
+            return e_failure;
+        }
+        len = container_index_parse_entry(index, i, fixed);
+        if(decode_index_bytes(decInfo, (unsigned char *)index -> entries[i].name, len) == e_failure)
+        {
+            return e_failure;
+        }
+        index -> entries[i].name[len] = '\0';
+        if(container_index_check_entry(index, i) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+
+    // Entries lie inside data_size, which must fit what is left of the carrier
+    size_t capacity = decode_payload_capacity(decInfo);
+    if(index -> data_size > capacity)
+    {
+        printf("Error: Container data size %zu out of range, the image holds at most %zu more bytes\n", index -> data_size, capacity);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Open the stego image and decode everything up to the end of the container index */
+static Status open_container(DecodeInfo *decInfo)
+{
+    if((open_files_for_decoding(decInfo)) == e_success)
+    {
+        /* Skip bmp image header, keeping its pixel size for the layout */
+        if((codec_ctx_load_header(decInfo -> ctx, decInfo -> fptr_dest_image)) == e_success && (skip_bmp_header(decInfo -> fptr_dest_image)) == e_success)
+        {
+            /* Decode Magic String and the layout word */
+            if((decode_magic_string(MAGIC_STRING, decInfo)) == e_success && (decode_layout_word(decInfo)) == e_success)
+            {
+                /* Decode the index */
+                if((decode_container_index(decInfo)) == e_success)
+                {
+                    printf("Container index decoded: %u entries\n", decInfo -> index.count);
+                    return e_success;
+                }
+                report_error(decInfo -> report, e_err_corrupt);
+            }
+        }
+    }
+    return e_failure;
+}
+
+/* Close the image and hand the buffers back */
+static void close_container(DecodeInfo *decInfo)
+{
+    // Close before releasing, the stream buffer belongs to the context
+    if(decInfo -> fptr_dest_image != NULL)
+    {
+        fclose(decInfo -> fptr_dest_image);
+        decInfo -> fptr_dest_image = NULL;
+    }
+    container_index_free(&decInfo -> index);
+    codec_ctx_release(decInfo -> ctx);
+    decInfo -> ctx = NULL;
+}
+
+/* Print the entries of a container, only its index is decoded */
+Status do_listing(DecodeInfo *decInfo)
+{
+    Status ret = e_failure;
+
+    // Take codec buffers from this thread's pool
+    if((decInfo -> ctx = codec_ctx_acquire()) == NULL)
+    {
+        return e_failure;
+    }
+
+    report_stage(decInfo -> report, "index");
+    if((open_container(decInfo)) == e_success)
+    {
+        for(uint i = 0; i < decInfo -> index.count; i++)
+        {
+            const ContainerEntry *entry = &decInfo -> index.entries[i];
+
+            printf("%10u  %08x  %c  %s\n", entry -> length, entry -> crc, entry -> flags & CONTAINER_FLAG_EXEC ? 'x' : '-', entry -> name);
+        }
+        ret = e_success;
+    }
+
+    close_container(decInfo);
+    return ret;
+}
+
+/* Write one extracted entry to fname, restoring its executable bit */
+static Status write_entry(DecodeInfo *decInfo, const ContainerEntry *entry, const char *fname, const unsigned char *data)
+{
+    char temp_name[MAX_TEMP_NAME];
+    struct stat st;
+
+    // Caller may hand in its own stream
+    if(decInfo -> fptr_output != NULL)
+    {
+        return fwrite(data, 1, entry -> length, decInfo -> fptr_output) == entry -> length ? e_success : e_failure;
+    }
+
+    // Written under a temporary name, fname only ever appears whole
+    if(open_output_temp(decInfo, fname, temp_name) == e_failure)
+    {
+        return e_failure;
+    }
+
+    Status ret = fwrite(data, 1, entry -> length, decInfo -> fptr_output) == entry -> length ? e_success : e_failure;
+
+    // Executable for whoever may read it
+    if(ret == e_success && (entry -> flags & CONTAINER_FLAG_EXEC) && fstat(fileno(decInfo -> fptr_output), &st) == 0)
+    {
+        fchmod(fileno(decInfo -> fptr_output), st.st_mode | ((st.st_mode & 0444) >> 2));
+    }
+
+    return finish_output_temp(decInfo, fname, temp_name, ret);
+}
+
+/* Extract one entry of a container, seeking straight to its carrier span */
+Status do_extraction(DecodeInfo *decInfo)
+{
+    Status ret = e_failure;
+    CodecContext *ctx;
+    const ContainerEntry *entry;
+
+    // Take codec buffers from this thread's pool
+    if((decInfo -> ctx = ctx = codec_ctx_acquire()) == NULL)
+    {
+        return e_failure;
+    }
+
+    report_stage(decInfo -> report, "index");
+    if((open_container(decInfo)) == e_success)
+    {
+        report_stage(decInfo -> report, "extract");
+        if((entry = container_index_find(&decInfo -> index, decInfo -> entry_name)) == NULL)
+        {
+            printf("Error: No entry named %s\n", decInfo -> entry_name);
+            report_error(decInfo -> report, e_err_usage);
+        }
+
+        // Written under its own name unless an output was given
+        const char *fname = entry != NULL && decInfo -> output_fname == NULL ? entry -> name : decInfo -> output_fname;
+
+        /* Skip the entries in front of this one, then decode it */
+        if(entry != NULL && (decode_payload_skip(decInfo, entry -> offset)) == e_success && (codec_ctx_reserve_scratch(ctx, entry -> length)) == e_success)
+        {
+            if(decode_payload_stream(decInfo, ctx -> scratch, entry -> length) != entry -> length)
+            {
+                printf("Error: Entry %s damaged beyond repair\n", entry -> name);
+                report_error(decInfo -> report, e_err_corrupt);
+            }
+            else if(fec_crc32(0, ctx -> scratch, entry -> length) != entry -> crc)
+            {
+                printf("Error: Entry %s fails its CRC check\n", entry -> name);
+                report_error(decInfo -> report, e_err_corrupt);
+            }
+            else if((write_entry(decInfo, entry, fname, ctx -> scratch)) == e_success)
+            {
+                printf("--%s\n", fname);
+                if(decInfo -> report != NULL)
+                {
+                    decInfo -> report -> output = fname;
+                    decInfo -> report -> bytes = entry -> length;
+                    decInfo -> report -> crc = entry -> crc;
+                    decInfo -> report -> has_crc = 1;
+                }
+                ret = e_success;
+            }
+        }
+    }
+
+    close_container(decInfo);
+    return ret;
+}
@@ -0,0 +1,66 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Container of several named secrets in one carrier.
+ * The payload stream after the layout word starts with an
+ * index and the entries follow it back to back:
+ *
+ *   count (32), data size (32), then per entry
+ *   offset (32), length (32), flags (32), CRC-32 (32),
+ *   name length (8) and the name
+ *
+ * Offsets count payload bytes from the end of the index, so
+ * an entry's carrier span is known once the index is read
+ * and extraction seeks straight to it.
+ */
+
+#define CONTAINER_MAX_ENTRIES 1024  // Files per container
+#define CONTAINER_MAX_NAME 255      // Bytes of an entry name
+#define CONTAINER_HEAD_BYTES 8      // Count and data size
+#define CONTAINER_ENTRY_BYTES 17    // Fixed part of an entry
+
+/* Entry flags */
+#define CONTAINER_FLAG_EXEC 0x1     // File was executable
+
+typedef struct _ContainerEntry
+{
+    char name[CONTAINER_MAX_NAME + 1];  // File name, no directories
+    uint offset;                        // Payload bytes from the end of the index
+    uint length;                        // Bytes of the file
+    uint flags;                         // CONTAINER_FLAG_*
+    uint crc;                           // CRC-32 of the file
+} ContainerEntry;
+
+typedef struct _ContainerIndex
+{
+    uint count;                 // Entries in use
+    ContainerEntry *entries;    // Allocated for count entries
+    size_t index_size;          // Payload bytes of the stored index
+    size_t data_size;           // Payload bytes of all entries
+} ContainerIndex;
+
+/* Fill the index from the files to pack, sizes and flags from stat */
+Status container_index_build(ContainerIndex *index, char *fnames[], uint count);
+
+/* Read every file after the index into buf and store the index in front of them */
+Status container_index_pack(ContainerIndex *index, char *fnames[], unsigned char *buf);
+
+/* Parse count and data size of a stored index, allocating the entries */
+Status container_index_parse_head(ContainerIndex *index, const unsigned char *head);
+
+/* Parse the fixed part of entry i, returns the length of its name */
+uint container_index_parse_entry(ContainerIndex *index, uint i, const unsigned char *fixed);
+
+/* Check the name of entry i and the span it claims */
+Status container_index_check_entry(ContainerIndex *index, uint i);
+
+/* Entry called name, NULL if the index has none */
+const ContainerEntry *container_index_find(const ContainerIndex *index, const char *name);
+
+/* Release the entries */
+void container_index_free(ContainerIndex *index);
+
+#endif
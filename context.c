@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "context.h"
+#include "types.h"
+
+/* Free contexts owned by the current thread */
+static _Thread_local CodecContext *ctx_pool;
+
+/* Key whose destructor frees a pool when its thread exits */
+static pthread_key_t ctx_pool_key;
+static pthread_once_t ctx_pool_once = PTHREAD_ONCE_INIT;
+
+/* Buffer allocations done by all contexts */
+static atomic_ulong ctx_alloc_count;
+
+/* Function Definitions */
+
+/* Allocate an aligned buffer of size bytes, keeping the first keep bytes of old */
+static unsigned char *ctx_grow(unsigned char *old, size_t keep, size_t size)
+{
+    void *buf;
+
+    // Round size up so every buffer ends on an alignment boundary
+    size = (size + CODEC_IO_ALIGN - 1) & ~(size_t)(CODEC_IO_ALIGN - 1);
+
+    if(posix_memalign(&buf, CODEC_IO_ALIGN, size) != 0)
+    {
+        return NULL;
+    }
+    atomic_fetch_add(&ctx_alloc_count, 1);
+
+    // Carry over bytes that are still in use
+    if(old != NULL)
+    {
+        memcpy(buf, old, keep);
+        free(old);
+    }
+    return buf;
+}
+
+/* Free a thread's pooled contexts and their buffers when it exits */
+static void ctx_pool_free(void *pool)
+{
+    CodecContext *ctx = pool;
+
+    while(ctx != NULL)
+    {
+        CodecContext *next = ctx -> next;
+        free(ctx -> window);
+        free(ctx -> io_block);
+        free(ctx -> scratch);
+        free(ctx -> map);
+        free(ctx);
+        ctx = next;
+    }
+}
+
+/* Create the pool key, once per process */
+static void ctx_pool_key_init(void)
+{
+    pthread_key_create(&ctx_pool_key, ctx_pool_free);
+}
+
+/* Take a context from the calling thread's pool */
+CodecContext *codec_ctx_acquire(void)
+{
+    CodecContext *ctx = ctx_pool;
+
+    if(ctx != NULL)         // Reuse a pooled context
+    {
+        ctx_pool = ctx -> next;
+        ctx -> next = NULL;
+        pthread_setspecific(ctx_pool_key, ctx_pool);
+        return ctx;
+    }
+
+    // Pool is empty, build a fresh context
+    ctx = calloc(1, sizeof(CodecContext));
+    if(ctx == NULL)
+    {
+        return NULL;
+    }
+    atomic_fetch_add(&ctx_alloc_count, 1);
+
+    ctx -> io_block = ctx_grow(NULL, 0, CODEC_IO_BLOCK_SIZE);
+    if(ctx -> io_block == NULL)
+    {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/* Forget per-job state without freeing buffers */
+void codec_ctx_reset(CodecContext *ctx)
+{
+    memset(ctx -> header, 0, sizeof(ctx -> header));
+    ctx -> width = 0;
+    ctx -> height = 0;
+    ctx -> bits_per_pixel = 0;
+    ctx -> window_len = 0;
+    ctx -> window_start = 0;
+    ctx -> window_pos = 0;
+}
+
+/* Reset a context and return it to the calling thread's pool */
+void codec_ctx_release(CodecContext *ctx)
+{
+    if(ctx == NULL)
+    {
+        return;
+    }
+    codec_ctx_reset(ctx);
+    ctx -> next = ctx_pool;
+    ctx_pool = ctx;
+
+    // Hand the pool to the key so it is freed when the thread exits
+    pthread_once(&ctx_pool_once, ctx_pool_key_init);
+    pthread_setspecific(ctx_pool_key, ctx_pool);
+}
+
+/* Make sure the payload window can hold len bytes */
+Status codec_ctx_reserve_window(CodecContext *ctx, size_t len)
+{
+    if(len <= ctx -> window_size)   // Already big enough
+    {
+        return e_success;
+    }
+
+    // At least double, so a window filled piece by piece is copied O(log n) times
+    if(len < ctx -> window_size * 2)
+    {
+        len = ctx -> window_size * 2;
+    }
+
+    unsigned char *buf = ctx_grow(ctx -> window, ctx -> window_len, len);
+    if(buf == NULL)
+    {
+        return e_failure;
+    }
+    ctx -> window = buf;
+    ctx -> window_size = len;
+    return e_success;
+}
+
+/* Make sure the scratch buffer can hold len bytes */
+Status codec_ctx_reserve_scratch(CodecContext *ctx, size_t len)
+{
+    if(len <= ctx -> scratch_size)  // Already big enough
+    {
+        return e_success;
+    }
+
+    unsigned char *buf = ctx_grow(ctx -> scratch, 0, len);
+    if(buf == NULL)
+    {
+        return e_failure;
+    }
+    ctx -> scratch = buf;
+    ctx -> scratch_size = len;
+    return e_success;
+}
+
+/* Make sure the texture map buffer can hold len bytes */
+Status codec_ctx_reserve_map(CodecContext *ctx, size_t len)
+{
+    if(len <= ctx -> map_size)      // Already big enough
+    {
+        return e_success;
+    }
+
+    unsigned char *buf = ctx_grow(ctx -> map, 0, len);
+    if(buf == NULL)
+    {
+        return e_failure;
+    }
+    ctx -> map = buf;
+    ctx -> map_size = len;
+    return e_success;
+}
+
+/* Read next len carrier bytes into the window, NULL on short read */
+unsigned char *codec_ctx_fill(CodecContext *ctx, FILE *fptr, size_t len)
+{
+    if(codec_ctx_reserve_window(ctx, ctx -> window_len + len) == e_failure)
+    {
+        return NULL;
+    }
+
+    unsigned char *dest = ctx -> window + ctx -> window_len;
+
+    if(fread(dest, 1, len, fptr) != len)    // Carrier ended early
+    {
+        return NULL;
+    }
+    ctx -> window_len += len;
+    return dest;
+}
+
+/* Read up to len carrier bytes, zero filling past the end of file; got is set to the bytes read */
+unsigned char *codec_ctx_fill_zero(CodecContext *ctx, FILE *fptr, size_t len, size_t *got)
+{
+    if(codec_ctx_reserve_window(ctx, ctx -> window_len + len) == e_failure)
+    {
+        return NULL;
+    }
+
+    unsigned char *dest = ctx -> window + ctx -> window_len;
+    *got = fread(dest, 1, len, fptr);
+    memset(dest + *got, 0, len - *got);
+    ctx -> window_len += len;
+    return dest;
+}
+
+/* Drop the window and seek past the next len carrier bytes without reading them */
+Status codec_ctx_skip(CodecContext *ctx, FILE *fptr, size_t len)
+{
+    if(fseeko(fptr, len, SEEK_CUR) != 0)
+    {
+        return e_failure;
+    }
+    ctx -> window_start += ctx -> window_len + len;
+    ctx -> window_len = 0;
+    ctx -> window_pos = 0;
+    return e_success;
+}
+
+/* Drop the window, the next fill starts where it ended */
+void codec_ctx_drop(CodecContext *ctx)
+{
+    ctx -> window_start += ctx -> window_len;
+    ctx -> window_len = 0;
+    ctx -> window_pos = 0;
+}
+
+/* Append len bytes from memory to the window, NULL on failure */
+unsigned char *codec_ctx_copy(CodecContext *ctx, const unsigned char *src, size_t len)
+{
+    if(codec_ctx_reserve_window(ctx, ctx -> window_len + len) == e_failure)
+    {
+        return NULL;
+    }
+
+    unsigned char *dest = ctx -> window + ctx -> window_len;
+    memcpy(dest, src, len);
+    ctx -> window_len += len;
+    return dest;
+}
+
+/* Hand out the next len bytes of the window, NULL when exhausted */
+unsigned char *codec_ctx_next(CodecContext *ctx, size_t len)
+{
+    if(ctx -> window_len - ctx -> window_pos < len)
+    {
+        return NULL;
+    }
+
+    unsigned char *ptr = ctx -> window + ctx -> window_pos;
+    ctx -> window_pos += len;
+    return ptr;
+}
+
+/* Parse a BMP header held in memory into the cache
+ * Description: width is stored at offset 18, height at
+ * offset 22 and bits per pixel at offset 28 (little endian)
+ */
+void codec_ctx_parse_header(CodecContext *ctx, const unsigned char *header)
+{
+    const unsigned char *h = ctx -> header;
+
+    if(header != ctx -> header)
+    {
+        memcpy(ctx -> header, header, BMP_HEADER_SIZE);
+    }
+    ctx -> width = h[18] | (h[19] << 8) | (h[20] << 16) | ((uint)h[21] << 24);
+    ctx -> height = h[22] | (h[23] << 8) | (h[24] << 16) | ((uint)h[25] << 24);
+    ctx -> bits_per_pixel = h[28] | (h[29] << 8);
+}
+
+/* Read and parse the BMP header into the cache */
+Status codec_ctx_load_header(CodecContext *ctx, FILE *fptr)
+{
+    rewind(fptr);
+
+    if(fread(ctx -> header, 1, BMP_HEADER_SIZE, fptr) != BMP_HEADER_SIZE)
+    {
+        return e_failure;
+    }
+
+    codec_ctx_parse_header(ctx, ctx -> header);
+    return e_success;
+}
+
+/* Number of buffer allocations done by all contexts so far */
+unsigned long codec_ctx_alloc_count(void)
+{
+    return atomic_load(&ctx_alloc_count);
+}
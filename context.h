@@ -0,0 +1,94 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Reusable codec context shared by encoding and decoding.
+ * Holds the parsed BMP header, the payload window (carrier
+ * bytes that carry LSBs), a block buffer for streaming the
+ * untouched remainder and a scratch buffer for secret data.
+ * Buffers only ever grow, so repeated jobs on same-sized
+ * carriers do not allocate after the first run.
+ */
+
+#define BMP_HEADER_SIZE 54              // Size of BMP file + info header
+#define CODEC_IO_ALIGN 64               // Alignment of every context buffer
+#define CODEC_IO_BLOCK_SIZE (64 * 1024) // Block size for streaming remaining image data
+
+typedef struct _CodecContext
+{
+    /* Parsed header cache */
+    unsigned char header[BMP_HEADER_SIZE];  // Raw 54 byte header
+    uint width;                             // Width in pixels (offset 18)
+    uint height;                            // Height in pixels (offset 22)
+    uint bits_per_pixel;                    // Colour depth (offset 28)
+
+    /* Payload window */
+    unsigned char *window;      // Carrier bytes being read / modified
+    size_t window_size;         // Allocated size of window
+    size_t window_len;          // Bytes currently held in window
+    size_t window_start;        // Carrier offset of window[0], moved by codec_ctx_skip
+    size_t window_pos;          // Next byte handed out by codec_ctx_next
+
+    /* Streaming block */
+    unsigned char *io_block;    // CODEC_IO_BLOCK_SIZE bytes
+
+    /* Scratch for secret / decoded data */
+    unsigned char *scratch;     // Secret bytes (encode) or decoded bytes (decode)
+    size_t scratch_size;        // Allocated size of scratch
+
+    /* Per-block flags of the adaptive texture map */
+    unsigned char *map;         // One byte per carrier block
+    size_t map_size;            // Allocated size of map
+
+    struct _CodecContext *next; // Link in the per-thread pool
+} CodecContext;
+
+/* Take a context from the calling thread's pool */
+CodecContext *codec_ctx_acquire(void);
+
+/* Reset a context and return it to the calling thread's pool */
+void codec_ctx_release(CodecContext *ctx);
+
+/* Forget per-job state without freeing buffers */
+void codec_ctx_reset(CodecContext *ctx);
+
+/* Make sure the payload window can hold len bytes */
+Status codec_ctx_reserve_window(CodecContext *ctx, size_t len);
+
+/* Make sure the scratch buffer can hold len bytes */
+Status codec_ctx_reserve_scratch(CodecContext *ctx, size_t len);
+
+/* Make sure the texture map buffer can hold len bytes */
+Status codec_ctx_reserve_map(CodecContext *ctx, size_t len);
+
+/* Read next len carrier bytes into the window, NULL on short read */
+unsigned char *codec_ctx_fill(CodecContext *ctx, FILE *fptr, size_t len);
+
+/* Read up to len carrier bytes, zero filling past the end of file; got is set to the bytes read */
+unsigned char *codec_ctx_fill_zero(CodecContext *ctx, FILE *fptr, size_t len, size_t *got);
+
+/* Drop the window and seek past the next len carrier bytes without reading them */
+Status codec_ctx_skip(CodecContext *ctx, FILE *fptr, size_t len);
+
+/* Drop the window, the next fill starts where it ended */
+void codec_ctx_drop(CodecContext *ctx);
+
+/* Hand out the next len bytes of the window, NULL when exhausted */
+unsigned char *codec_ctx_next(CodecContext *ctx, size_t len);
+
+/* Append len bytes from memory to the window, NULL on failure */
+unsigned char *codec_ctx_copy(CodecContext *ctx, const unsigned char *src, size_t len);
+
+/* Parse a BMP header held in memory into the cache */
+void codec_ctx_parse_header(CodecContext *ctx, const unsigned char *header);
+
+/* Read and parse the BMP header into the cache */
+Status codec_ctx_load_header(CodecContext *ctx, FILE *fptr);
+
+/* Number of buffer allocations done by all contexts so far */
+unsigned long codec_ctx_alloc_count(void);
+
+#endif
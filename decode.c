@@ -1,11 +1,15 @@
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
 #include "decode.h"
 #include "types.h"
 #include <string.h>
 #include "common.h"
 
-
-char str[50];
+static atomic_uint temp_count;  // Makes temporary output names unique within the process
 
 /* Function Definitions */
 
@@ -45,17 +49,25 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 /* Get File pointers for i/p and o/p files */
 Status open_files_for_decoding(DecodeInfo *decInfo)
 {
-    decInfo -> fptr_dest_image = fopen(decInfo -> dest_image_fname, "r");   // Open stego image for reading
+    // The caller may already have opened the image (e.g. from a received fd)
+    if(decInfo -> fptr_dest_image == NULL)
+    {
+        decInfo -> fptr_dest_image = fopen(decInfo -> dest_image_fname, "r");   // Open stego image for reading
+    }
 
     // Do Error handling
     if (decInfo -> fptr_dest_image == NULL)
     {
     	perror("fopen");
     	fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo -> dest_image_fname);
+        report_error(decInfo -> report, e_err_open);
 
     	return e_failure;
     }
 
+    // Small header reads are served from the context block instead of a malloc'd stdio buffer
+    setvbuf(decInfo -> fptr_dest_image, (char *)decInfo -> ctx -> io_block, _IOFBF, CODEC_IO_BLOCK_SIZE);
+
     return e_success;
 }
 
@@ -73,57 +85,225 @@ Status skip_bmp_header(FILE *fptr_dest_image)
 /* Decode byte from LSB*/
 Status decode_byte_from_lsb(char *data, char *image_buffer)  
 {
-    char decoded_byte = 0;
-    char bit_data;
+    // One bit per image byte, MSB first
+    lsb_codec_default.extract((const unsigned char *)image_buffer, 0, (unsigned char *)data, 1);
+    return e_success; 
+}
+
+/* Decode int from LSB*/
+Status decode_int_from_lsb(int *size, char *image_buffer)  
+{
+    unsigned char field[4];
 
-    for(int i = 7; i >= 0; i--)
+    lsb_codec_default.extract((const unsigned char *)image_buffer, 0, field, 4);
+    *size = lsb_load_be32(field);
+    return e_success; 
+}
+
+/* Extract len bytes from the next image bytes with the image's codec, returns how many were there
+ * Description: with FEC a short carrier is zero filled, the
+ * missing bytes are then repaired as erasures
+ */
+static size_t decode_payload_raw(DecodeInfo *decInfo, unsigned char *data, size_t len)
+{
+    const LsbCodec *codec = decInfo -> codec;
+    size_t phase = lsb_phase(codec, decInfo -> ctx -> window_start + decInfo -> ctx -> window_len);
+    size_t need = lsb_carrier_bytes(codec, phase, len);
+    size_t got = need;
+    unsigned char *arr;
+
+    // Adaptive layouts only use the textured blocks
+    if(decInfo -> layout.adaptive)
     {
-        bit_data = image_buffer[7 - i] & 1;  // Get the LSB from image byte
-        decoded_byte = decoded_byte | (bit_data << i);
+        size_t n = texture_map_extract(&decInfo -> texture, codec, data, len);
+        memset(data + n, 0, len - n);
+        return n;
     }
 
-    *data = decoded_byte;   // Store decoded byte in output parameter  
-    return e_success; 
+    // Earlier blocks are extracted already, so the window only ever holds one
+    codec_ctx_drop(decInfo -> ctx);
+    if(decInfo -> layout.fec)
+    {
+        arr = codec_ctx_fill_zero(decInfo -> ctx, decInfo -> fptr_dest_image, need, &got);
+    }
+    else
+    {
+        arr = codec_ctx_fill(decInfo -> ctx, decInfo -> fptr_dest_image, need);
+    }
+    if(arr == NULL)
+    {
+        return 0;
+    }
+
+    codec -> extract(arr, phase, data, len);
+    return got == need ? len : lsb_data_bytes(codec, phase, got);
 }
 
-/* Decode int from LSB*/
-Status decode_int_from_lsb(int *size, char *image_buffer)  
+/* FEC input comes straight from the carrier */
+static size_t decode_fec_source(void *arg, unsigned char *bytes, size_t len)
 {
-    int decoded_size = 0;
-    char bit_data;
+    return decode_payload_raw(arg, bytes, len);
+}
 
-    for(int i = 31; i >= 0; i--)
+/* Decode up to len payload bytes after the layout word, returns how many were recovered */
+size_t decode_payload_stream(DecodeInfo *decInfo, unsigned char *data, size_t len)
+{
+    if(decInfo -> layout.fec)
     {
-        bit_data = image_buffer[31 - i] & 1;    // Get the LSB
-        decoded_size = decoded_size | (bit_data << i);
+        return fec_stream_get(&decInfo -> fec, data, len, decode_fec_source, decInfo);
     }
+    return decode_payload_raw(decInfo, data, len);
+}
 
-    *size = decoded_size;    
-    return e_success; 
+/* Move past len bytes of the image's codec without extracting them */
+static Status decode_payload_raw_skip(DecodeInfo *decInfo, size_t len)
+{
+    const LsbCodec *codec = decInfo -> codec;
+    CodecContext *ctx = decInfo -> ctx;
+
+    // The texture map is built from the whole image already, only its cursor moves
+    if(decInfo -> layout.adaptive)
+    {
+        return texture_map_skip(&decInfo -> texture, codec, len) == len || decInfo -> layout.fec ? e_success : e_failure;
+    }
+
+    return codec_ctx_skip(ctx, decInfo -> fptr_dest_image, lsb_carrier_bytes(codec, lsb_phase(codec, ctx -> window_start + ctx -> window_len), len));
+}
+
+/* FEC skips whole groups in the carrier */
+static Status decode_fec_skip(void *arg, size_t len)
+{
+    return decode_payload_raw_skip(arg, len);
+}
+
+/* Pass over len payload bytes without decoding them where the layout allows */
+Status decode_payload_skip(DecodeInfo *decInfo, size_t len)
+{
+    if(decInfo -> layout.fec)
+    {
+        return fec_stream_skip(&decInfo -> fec, len, decode_fec_source, decode_fec_skip, decInfo);
+    }
+    return decode_payload_raw_skip(decInfo, len);
+}
+
+/* Upper bound on the payload bytes still in the carrier
+ * Description: FEC knows the exact length from its validated
+ * length copies, adaptive layouts the capacity of the textured
+ * blocks, otherwise it is what the rest of the file can hold
+ */
+size_t decode_payload_capacity(DecodeInfo *decInfo)
+{
+    CodecContext *ctx = decInfo -> ctx;
+    size_t used = ctx -> window_start + ctx -> window_len;
+    struct stat st;
+
+    if(decInfo -> layout.fec)
+    {
+        return decInfo -> fec.length - decInfo -> fec.out;
+    }
+    if(decInfo -> layout.adaptive)
+    {
+        return decInfo -> texture.capacity;
+    }
+    if(fstat(fileno(decInfo -> fptr_dest_image), &st) != 0 || st.st_size < (off_t)(BMP_HEADER_SIZE + used))
+    {
+        return 0;
+    }
+    return lsb_data_bytes(decInfo -> codec, lsb_phase(decInfo -> codec, used), st.st_size - BMP_HEADER_SIZE - used);
+}
+
+/* Pixel bytes the BMP header declares, rows padded to 4 bytes
+ * Description: at most UINT32_MAX, the most a BMP's 32 bit
+ * size fields can describe
+ */
+static size_t decode_declared_image_size(CodecContext *ctx)
+{
+    int height = (int)ctx -> height;    // Negative for top-down images
+    uint64_t rows = height < 0 ? -(int64_t)height : height;
+    uint64_t stride = ((uint64_t)ctx -> width * ctx -> bits_per_pixel + 31) / 32 * 4;
+
+    if(stride != 0 && rows > UINT32_MAX / stride)
+    {
+        return UINT32_MAX;
+    }
+    return stride * rows;
 }
 
-/* Store Magic String */
+/* Stream bytes the carrier holds after the magic string and layout word
+ * Description: the larger of the pixel data the header declares
+ * and what the file holds, so a truncated FEC image still gets
+ * as far as its erasure repair
+ */
+static size_t decode_stream_capacity(DecodeInfo *decInfo)
+{
+    size_t size = decode_declared_image_size(decInfo -> ctx);
+    struct stat st;
+
+    if(decInfo -> layout.adaptive)
+    {
+        return decInfo -> texture.capacity;
+    }
+    if(fstat(fileno(decInfo -> fptr_dest_image), &st) == 0 && st.st_size > (off_t)BMP_HEADER_SIZE && (size_t)(st.st_size - BMP_HEADER_SIZE) > size)
+    {
+        size = st.st_size - BMP_HEADER_SIZE;
+    }
+    if(size < LSB_EXT_HEADER_BYTES)
+    {
+        return 0;
+    }
+    return lsb_data_bytes(decInfo -> codec, lsb_phase(decInfo -> codec, LSB_EXT_HEADER_BYTES), size - LSB_EXT_HEADER_BYTES);
+}
+
+/* Decode exactly len payload bytes */
+static Status decode_payload_bytes(DecodeInfo *decInfo, unsigned char *data, size_t len)
+{
+    if(decode_payload_stream(decInfo, data, len) != len)
+    {
+        if(decInfo -> layout.fec)
+        {
+            printf("Error: Payload damaged beyond repair\n");
+        }
+        report_error(decInfo -> report, e_err_corrupt);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Store Magic String
+ * Description: the extended magic string is accepted as
+ * well, codec then stays NULL until decode_layout_word()
+ */
 Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
 {
-    char arr[8];
+    char *arr;
     char decoded_char;
+    int original = 1;   // Still matching magic_string
+    int extended = 1;   // Still matching MAGIC_STRING_EXT
 
     //Run the loop strlen(magic_string) times
-    for(int i = 0; i < strlen(magic_string); i++)   // Process each character in magic string
+    for(size_t i = 0; i < strlen(magic_string); i++)   // Process each character in magic string
     {
         //Read the 8byte of data from src file
-        fread(arr, 1, 8, decInfo -> fptr_dest_image);
+        if((arr = (char *)codec_ctx_fill(decInfo -> ctx, decInfo -> fptr_dest_image, 8)) == NULL)
+        {
+            report_error(decInfo -> report, e_err_format);
+            return e_failure;
+        }
 
         /* Decode a byte from LSB of image data */
         if((decode_byte_from_lsb(&decoded_char, arr)) == e_success)  
         {
+            original = original && decoded_char == magic_string[i];
+            extended = extended && decoded_char == MAGIC_STRING_EXT[i];
+
             //Verify the decoded character matches magic string
-            if(decoded_char == magic_string[i])
+            if(original || extended)
             {
                 continue;
             }
             else
             {
+                report_error(decInfo -> report, e_err_format);   // Not a stego image
                 return e_failure;
             }
         }
@@ -132,18 +312,104 @@ Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
             return e_failure;
         }
     }
+
+    // Original magic string: original layout, nothing else to read
+    decInfo -> codec = extended ? NULL : &lsb_codec_default;
+    decInfo -> layout = lsb_codec_default.layout;
+    return e_success;
+}
+
+/* Decode the layout word that follows the extended magic string */
+Status decode_layout_word(DecodeInfo *decInfo)
+{
+    char *arr;
+    int word;
+
+    if(decInfo -> codec != NULL)
+    {
+        return e_success;
+    }
+
+    // Read 32 bytes for the layout word
+    if((arr = (char *)codec_ctx_fill(decInfo -> ctx, decInfo -> fptr_dest_image, 32)) == NULL)
+    {
+        report_error(decInfo -> report, e_err_format);
+        return e_failure;
+    }
+
+    decode_int_from_lsb(&word, arr);
+    lsb_layout_from_word(&decInfo -> layout, word, decInfo -> ctx -> bits_per_pixel / 8);
+    const RsCode *rs = decInfo -> layout.fec ? rs_code_get(decInfo -> layout.fec) : NULL;
+    if((decInfo -> codec = lsb_codec_lookup(&decInfo -> layout)) == NULL || (decInfo -> layout.fec && rs == NULL))
+    {
+        printf("Error: Unsupported layout word 0x%x\n", word);
+        report_error(decInfo -> report, e_err_format);
+        return e_failure;
+    }
+
+    if(decInfo -> layout.adaptive && decode_texture_map(decInfo) == e_failure)
+    {
+        return e_failure;
+    }
+
+    // Payload length copies lead the coded stream
+    if(decInfo -> layout.fec)
+    {
+        if(fec_stream_open(&decInfo -> fec, rs, decode_fec_source, decInfo) == e_failure)
+        {
+            return e_failure;
+        }
+
+        // The length comes from the image, its coded stream must fit the carrier
+        size_t capacity = decode_stream_capacity(decInfo);
+        if(fec_stream_size(rs, decInfo -> fec.length) > capacity)
+        {
+            printf("Error: Payload length %zu out of range, the image holds %zu coded bytes\n", decInfo -> fec.length, capacity);
+            report_error(decInfo -> report, e_err_corrupt);
+            return e_failure;
+        }
+    }
     return e_success;
 }
 
+/* Read the rest of the image and rebuild the encoder's texture map from it */
+Status decode_texture_map(DecodeInfo *decInfo)
+{
+    CodecContext *ctx = decInfo -> ctx;
+    struct stat st;
+    unsigned char *pixels;
+
+    if(fstat(fileno(decInfo -> fptr_dest_image), &st) != 0 || st.st_size < (off_t)(BMP_HEADER_SIZE + ctx -> window_len))
+    {
+        return e_failure;
+    }
+
+    // Every block after the layout word may carry payload
+    size_t len = st.st_size - BMP_HEADER_SIZE - ctx -> window_len;
+    if((pixels = codec_ctx_fill(ctx, decInfo -> fptr_dest_image, len)) == NULL)
+    {
+        return e_failure;
+    }
+    return texture_map_build(&decInfo -> texture, ctx, pixels, len, &decInfo -> layout);
+}
+
 /* Decode secret file extension size */
 Status decode_secret_file_extn_size(int *size, DecodeInfo *decInfo)  
 {
-    char arr[32];       // Buffer for 32 image bytes
-
-    fread(arr, 1, 32, decInfo->fptr_dest_image);   // Read 32 bytes for extension size
+    unsigned char field[4];
 
-    if((decode_int_from_lsb(size, arr)) == e_success)  
+    // Read the 32 bit extension size
+    if((decode_payload_bytes(decInfo, field, 4)) == e_success)  
     {
+        *size = lsb_load_be32(field);
+
+        // Anything longer is not a header this encoder wrote
+        if(*size < 0 || *size > MAX_FILE_SUFFIX_DECODE)
+        {
+            printf("Error: Secret file extension size %d out of range\n", *size);
+            report_error(decInfo -> report, e_err_corrupt);
+            return e_failure;
+        }
         return e_success;
     } 
     else
@@ -155,15 +421,12 @@ Status decode_secret_file_extn_size(int *size, DecodeInfo *decInfo)
 /* Decode secret file extension */
 Status decode_secret_file_extn(int file_extn, DecodeInfo *decInfo)
 {
-    char arr[8];
-    char decoded_char;
+    unsigned char decoded_char;
 
     // Process each character in extension
     for(int i = 0; i < file_extn; i++)
     {
-        fread(arr, 1, 8, decInfo->fptr_dest_image);  // Read 8 bytes for one character
-
-        if((decode_byte_from_lsb(&decoded_char, arr)) == e_success) // Decode one character
+        if((decode_payload_bytes(decInfo, &decoded_char, 1)) == e_success) // Decode one character
         {
             decInfo -> extn_output_file[i] = decoded_char;  
             
@@ -178,8 +441,9 @@ Status decode_secret_file_extn(int file_extn, DecodeInfo *decInfo)
 
     decInfo -> extn_output_file[file_extn] = '\0';
     
+    char *str = decInfo -> output_name;
     int i=0;    // Index for filename processing
-    while(decInfo -> output_fname[i])   // Process each character in output filename
+    while(decInfo -> output_fname[i] && i < MAX_OUTPUT_NAME - MAX_FILE_SUFFIX_DECODE - 1)   // Process each character in output filename
     {
         if(decInfo -> output_fname[i] != '.')   // Check if character is not a dot
         {
@@ -192,9 +456,8 @@ Status decode_secret_file_extn(int file_extn, DecodeInfo *decInfo)
         i++;       // Move to next character
     }
 
-    str[i] = '\0';
-
-    strcat(str, decInfo -> extn_output_file);      // Append decoded file extension to base filename
+    // Append decoded file extension (and its terminator) to base filename
+    memcpy(str + i, decInfo -> extn_output_file, strlen(decInfo -> extn_output_file) + 1);
     decInfo -> output_fname = str;                // Update output filename with full name
     printf("--%s\n",decInfo -> output_fname);   // Print final output filename
     return e_success;
@@ -203,100 +466,231 @@ Status decode_secret_file_extn(int file_extn, DecodeInfo *decInfo)
 /* Decode secret file size */
 Status decode_secret_file_size(int *file_size, DecodeInfo *decInfo)
 {
-    char arr[32];
-
-    fread(arr, 1, 32, decInfo->fptr_dest_image);    // Read 32 bytes for file size
+    unsigned char field[4];
 
-    if((decode_int_from_lsb(file_size, arr)) == e_success)  // Decode file size as integer
+    if((decode_payload_bytes(decInfo, field, 4)) == e_success)  // Decode file size as integer
     {
+        *file_size = lsb_load_be32(field);
+
+        // A bogus size fails here, before anything is allocated or written
+        size_t capacity = decode_payload_capacity(decInfo);
+        if(*file_size < 0 || (size_t)*file_size > capacity)
+        {
+            printf("Error: Secret file size %d out of range, the image holds at most %zu more bytes\n", *file_size, capacity);
+            report_error(decInfo -> report, e_err_corrupt);
+            return e_failure;
+        }
         decInfo-> size_output_file = (*file_size);
+        if(decInfo -> report != NULL)
+        {
+            // Payload after the magic string / layout word: both sizes, extension and data
+            size_t header = 8 + strlen(decInfo -> extn_output_file);
+            decInfo -> report -> bytes = *file_size;
+            decInfo -> report -> payload_bytes = header + *file_size;
+            decInfo -> report -> capacity_bytes = header + capacity;
+        }
         return e_success;
     }
     return e_failure;
 }
 
-/* Decode secret file data*/
-Status decode_secret_file_data(DecodeInfo *decInfo)
+/* Create a temporary file next to fname as the output, its name goes to temp_name */
+Status open_output_temp(DecodeInfo *decInfo, const char *fname, char *temp_name)
 {
-    char arr[8];
-    char decoded_char;
+    int fd;
+
+    // Same directory, so the final rename cannot cross file systems
+    snprintf(temp_name, MAX_TEMP_NAME, "%s.part%ld.%u", fname, (long)getpid(), atomic_fetch_add(&temp_count, 1));
+    if((fd = open(temp_name, O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0)
+    {
+        perror("open");
+        report_error(decInfo -> report, e_err_open);
+        return e_failure;
+    }
+    if((decInfo -> fptr_output = fdopen(fd, "w")) == NULL)
+    {
+        close(fd);
+        unlink(temp_name);
+        report_error(decInfo -> report, e_err_open);
+        return e_failure;
+    }
+
+    // Blocks are written whole, stdio would only copy them
+    setvbuf(decInfo -> fptr_output, NULL, _IONBF, 0);
+    return e_success;
+}
+
+/* Close the temporary output, renaming it to fname on success and removing it otherwise */
+Status finish_output_temp(DecodeInfo *decInfo, const char *fname, const char *temp_name, Status ret)
+{
+    if(fclose(decInfo -> fptr_output) != 0)
+    {
+        ret = e_failure;
+    }
+    decInfo -> fptr_output = NULL;
+
+    if(ret == e_success && rename(temp_name, fname) != 0)
+    {
+        perror("rename");
+        ret = e_failure;
+    }
+    if(ret == e_failure)
+    {
+        unlink(temp_name);
+        report_error(decInfo -> report, e_err_io);
+    }
+    return ret;
+}
 
-    // Open output file for writing
-    decInfo->fptr_output = fopen(decInfo->output_fname, "w");   // Open output file
-    if(decInfo->fptr_output == NULL)
+/* Decode secret file data
+ * Description: decoded DECODE_OUTPUT_BLOCK bytes at a time; the
+ * output is only created once the first block decodes, under a
+ * temporary name that becomes output_fname when all is written
+ */
+Status decode_secret_file_data(DecodeInfo *decInfo)
+{
+    CodecContext *ctx = decInfo -> ctx;
+    size_t size = decInfo -> size_output_file;
+    size_t block = size < DECODE_OUTPUT_BLOCK ? size : DECODE_OUTPUT_BLOCK;
+    int own_output = decInfo -> fptr_output == NULL;   // Caller may hand in its own stream (e.g. the daemon's in-memory reply)
+    char temp_name[MAX_TEMP_NAME];
+    Status ret = e_success;
+
+    if(codec_ctx_reserve_scratch(ctx, block) == e_failure)
     {
         return e_failure;
     }
 
-    // Process each byte of secret data
-    for(int i = 0; i < decInfo->size_output_file; i++)
+    // An empty secret still goes through once, to create its file
+    size_t done = 0;
+    do
     {
-        fread(arr, 1, 8, decInfo->fptr_dest_image); // Read 8 bytes for one secret byte
+        size_t len = size - done < block ? size - done : block;
 
-        if((decode_byte_from_lsb(&decoded_char, arr)) == e_success) // Decode one character  
+        ret = decode_payload_bytes(decInfo, ctx -> scratch, len);
+        if(ret == e_success && decInfo -> fptr_output == NULL)
         {
-            fwrite(&decoded_char, 1, 1, decInfo->fptr_output);  // Write character to output file
+            ret = open_output_temp(decInfo, decInfo -> output_fname, temp_name);
         }
-        else
+        if(ret == e_success && fwrite(ctx -> scratch, 1, len, decInfo -> fptr_output) != len)
         {
-            fclose(decInfo->fptr_output);
-            return e_failure;
+            report_error(decInfo -> report, e_err_io);
+            ret = e_failure;
+        }
+        if(ret == e_success && decInfo -> report != NULL && decInfo -> report -> want_crc)
+        {
+            decInfo -> report -> crc = fec_crc32(decInfo -> report -> crc, ctx -> scratch, len);
+            decInfo -> report -> has_crc = 1;
         }
+        done += len;
+    } while(ret == e_success && done < size);
+
+    if(ret == e_success && decInfo -> layout.fec && decInfo -> fec.corrected > 0)
+    {
+        printf("FEC repaired %lu damaged bytes\n", decInfo -> fec.corrected);
     }
-    
-    fclose(decInfo->fptr_output);
-    return e_success;
+    if(own_output && decInfo -> fptr_output != NULL)
+    {
+        ret = finish_output_temp(decInfo, decInfo -> output_fname, temp_name, ret);
+    }
+    return ret;
 }
 
-/* Perform the decoding */
-Status do_decoding(DecodeInfo *decInfo)
+/* Decode everything in front of the secret data: magic string, extension and size */
+Status decode_stego_header(DecodeInfo *decInfo)
 {
     int extn_size;  
     int file_size;
 
-    /* Get File pointers for i/p files */
-    if((open_files_for_decoding(decInfo)) == e_success)
+    /* Skip bmp image header, keeping its pixel size for the layout */
+    report_stage(decInfo -> report, "header");
+    if((codec_ctx_load_header(decInfo -> ctx, decInfo -> fptr_dest_image)) == e_success && (skip_bmp_header(decInfo -> fptr_dest_image)) == e_success)
     {
-        printf("Stego image file opened successfully\n");
+        printf("BMP header skipped\n");
 
-        /* Skip bmp image header */
-        if((skip_bmp_header(decInfo -> fptr_dest_image)) == e_success)
+        /* Decode Magic String, and the layout word of a non original layout */
+        if((decode_magic_string(MAGIC_STRING, decInfo)) == e_success && (decode_layout_word(decInfo)) == e_success)
         {
-            printf("BMP header skipped\n");
+            printf("Magic string verified\n");
 
-            /* Decode Magic String */
-            if((decode_magic_string(MAGIC_STRING, decInfo)) == e_success)
+            // Several files: only -l / -x know where they are
+            if(decInfo -> layout.container)
             {
-                printf("Magic string verified\n");
+                printf("Error: Image holds a container, list it with -l or extract with -x\n");
+                report_error(decInfo -> report, e_err_format);
+                return e_failure;
+            }
 
-                /* Decode secret file extension size */
-                if((decode_secret_file_extn_size(&extn_size, decInfo)) == e_success)  
+            /* Decode secret file extension size */
+            if((decode_secret_file_extn_size(&extn_size, decInfo)) == e_success)  
+            {
+                printf("Secret file extension size decoded: %d\n", extn_size);
+
+                /* Decode secret file extension */
+                if((decode_secret_file_extn(extn_size, decInfo)) == e_success)
                 {
-                    printf("Secret file extension size decoded: %d\n", extn_size);
+                    printf("Secret file extension decoded: %s\n", decInfo->extn_output_file);
+                    if(decInfo -> report != NULL)
+                    {
+                        decInfo -> report -> output = decInfo -> output_fname;
+                    }
 
-                    /* Decode secret file extension */
-                    if((decode_secret_file_extn(extn_size, decInfo)) == e_success)
+                    /* Decode secret file size */
+                    if((decode_secret_file_size(&file_size, decInfo)) == e_success)
                     {
-                        printf("Secret file extension decoded: %s\n", decInfo->extn_output_file);
-
-                        /* Decode secret file size */
-                        if((decode_secret_file_size(&file_size, decInfo)) == e_success)
-                        {
-                            printf("Secret file size decoded: %ld\n", decInfo->size_output_file);
-                                
-                            /* Decode secret file data */
-                            if((decode_secret_file_data(decInfo)) == e_success)
-                            {
-                                printf("Secret file data decoded successfully\n");
-
-                                return e_success;
-                            }
-                        }
+                        printf("Secret file size decoded: %ld\n", decInfo->size_output_file);
+                        return e_success;
                     }
                 }
             }
         }
     }
-
+    else
+    {
+        report_error(decInfo -> report, e_err_format);
+    }
     return e_failure;
+}
+
+/* Perform the decoding */
+Status do_decoding(DecodeInfo *decInfo)
+{
+    Status ret = e_failure;
+
+    // Take codec buffers from this thread's pool
+    if((decInfo -> ctx = codec_ctx_acquire()) == NULL)
+    {
+        return e_failure;
+    }
+
+    /* Get File pointers for i/p files */
+    report_stage(decInfo -> report, "open");
+    if((open_files_for_decoding(decInfo)) == e_success)
+    {
+        printf("Stego image file opened successfully\n");
+
+        /* Decode magic string, extension and size */
+        if((decode_stego_header(decInfo)) == e_success)
+        {
+            /* Decode secret file data */
+            report_stage(decInfo -> report, "data");
+            if((decode_secret_file_data(decInfo)) == e_success)
+            {
+                printf("Secret file data decoded successfully\n");
+
+                ret = e_success;
+            }
+        }
+    }
+
+    // Close before releasing, the stream buffer belongs to the context
+    if(decInfo -> fptr_dest_image != NULL)
+    {
+        fclose(decInfo -> fptr_dest_image);
+        decInfo -> fptr_dest_image = NULL;
+    }
+    codec_ctx_release(decInfo -> ctx);
+    decInfo -> ctx = NULL;
+
+    return ret;
 }
\ No newline at end of file
@@ -2,10 +2,19 @@
 #define DECODE_H
 #include<stdio.h>
 #include "types.h" // Contains user defined types
+#include "context.h" // Reusable codec context
+#include "lsb_codec.h" // Specialised embed / extract kernels
+#include "texture.h" // Adaptive embedding map
+#include "fec.h" // Reed-Solomon error correction
+#include "container.h" // Several named secrets in one carrier
+#include "report.h" // Machine readable job report
 
 #define MAX_SECRET_BUF_SIZE 1
 #define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
 #define MAX_FILE_SUFFIX_DECODE 4
+#define MAX_OUTPUT_NAME 256     // Output filename incl. decoded extension
+#define MAX_TEMP_NAME (MAX_OUTPUT_NAME + 32)    // Output filename and temporary suffix
+#define DECODE_OUTPUT_BLOCK (1024 * 1024)       // Secret bytes decoded and written per block
 
 typedef struct _DecodeInfo
 {
@@ -15,10 +24,31 @@ typedef struct _DecodeInfo
 
     /* output File Info */       
     char *output_fname;  
-    FILE *fptr_output;
-    char extn_output_file[MAX_FILE_SUFFIX_DECODE]; 
+    char output_name[MAX_OUTPUT_NAME];  // Storage for output_fname once extension is known
+    FILE *fptr_output;      // Opened on output_fname unless set by the caller
+    char extn_output_file[MAX_FILE_SUFFIX_DECODE + 1]; 
     long size_output_file;
 
+    /* Codec buffers, drawn from the per-thread pool */
+    CodecContext *ctx;
+
+    /* Embedding layout, read from the image */
+    LsbLayout layout;
+    const LsbCodec *codec;  // NULL until the magic string / layout word are decoded
+    TextureMap texture;     // Textured blocks, adaptive layouts only
+    FecStream fec;          // Error correction, layouts with FEC only
+
+    /* Container images */
+    ContainerIndex index;   // Entries, once decode_container_index() has run
+    char *entry_name;       // -x: entry to extract
+
+    /* Stage timings, sizes and the error class of the job, NULL when not wanted */
+    JobReport *report;
+
+    /* Verify mode: original secret to compare against */
+    char *secret_fname;
+    long mismatch_offset;   // First differing byte, -1 when none
+
 } DecodeInfo;
 
 /* Decoding function prototype */
@@ -26,9 +56,18 @@ typedef struct _DecodeInfo
 /* Read and validate Decode args from argv */
 Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
 
-/* Perform the decoding */
+/* Perform the decoding, file pointers left NULL are opened by name */
 Status do_decoding(DecodeInfo *decInfo);
 
+/* Decode everything in front of the secret data: magic string, extension and size */
+Status decode_stego_header(DecodeInfo *decInfo);
+
+/* Read and validate Verify args from argv */
+Status read_and_validate_verify_args(char *argv[], DecodeInfo *decInfo);
+
+/* Check that the stego image carries the secret file, without writing output */
+Status do_verification(DecodeInfo *decInfo);
+
 /* Get File pointers for i/p and o/p files */
 Status open_files_for_decoding(DecodeInfo *decInfo);
 
@@ -38,6 +77,33 @@ Status skip_bmp_header(FILE *fptr_dest_image);
 /* Store Magic String */
 Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo);
 
+/* Decode the layout word that follows the extended magic string */
+Status decode_layout_word(DecodeInfo *decInfo);
+
+/* Read the rest of the image and rebuild the encoder's texture map from it */
+Status decode_texture_map(DecodeInfo *decInfo);
+
+/* Decode up to len payload bytes after the layout word, returns how many were recovered */
+size_t decode_payload_stream(DecodeInfo *decInfo, unsigned char *data, size_t len);
+
+/* Pass over len payload bytes without decoding them where the layout allows */
+Status decode_payload_skip(DecodeInfo *decInfo, size_t len);
+
+/* Decode the container index, nothing after it is read */
+Status decode_container_index(DecodeInfo *decInfo);
+
+/* Read and validate List args from argv */
+Status read_and_validate_list_args(char *argv[], DecodeInfo *decInfo);
+
+/* Read and validate Extract args from argv */
+Status read_and_validate_extract_args(char *argv[], DecodeInfo *decInfo);
+
+/* Print the entries of a container, only its index is decoded */
+Status do_listing(DecodeInfo *decInfo);
+
+/* Extract one entry of a container, seeking straight to its carrier span */
+Status do_extraction(DecodeInfo *decInfo);
+
 /* Decode extenstion size */
 Status decode_secret_file_extn_size(int *size, DecodeInfo *decInfo); 
 
@@ -50,6 +116,15 @@ Status decode_secret_file_size(int *file_size, DecodeInfo *decInfo);
 /* Decode secret file data*/
 Status decode_secret_file_data(DecodeInfo *decInfo);
 
+/* Upper bound on the payload bytes still in the carrier */
+size_t decode_payload_capacity(DecodeInfo *decInfo);
+
+/* Create a temporary file next to fname as the output, its name goes to temp_name */
+Status open_output_temp(DecodeInfo *decInfo, const char *fname, char *temp_name);
+
+/* Close the temporary output, renaming it to fname on success and removing it otherwise */
+Status finish_output_temp(DecodeInfo *decInfo, const char *fname, const char *temp_name, Status ret);
+
 /* Decode int from LSB*/
 Status decode_int_from_lsb(int *size, char *image_buffer); //collecting 32 bytes of data
 
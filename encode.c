@@ -1,33 +1,29 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "encode.h"
 #include "types.h"
 #include<string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "common.h"
 
 /* Function Definitions */
 
 /* Get image size
- * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
+ * Input: Codec context with a loaded header, size of the image file
+ * Output: Bytes of pixel data, row padding included
+ * Description: Width and height are parsed once from the
+ * cached header by codec_ctx_load_header(). The size comes
+ * from the file rather than width * height * 3, which wraps
+ * on large images and ignores the row stride.
  */
-uint get_image_size_for_bmp(FILE *fptr_image)
+size_t get_image_size_for_bmp(CodecContext *ctx, size_t file_size)
 {
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
-
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf("width = %u\n", width);
-
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    printf("height = %u\n", height);
+    printf("width = %u\n", ctx -> width);
+    printf("height = %u\n", ctx -> height);
 
     // Return image capacity
-    return width * height * 3;
+    return file_size > BMP_HEADER_SIZE ? file_size - BMP_HEADER_SIZE : 0;
 }
 
 /* 
@@ -39,8 +35,13 @@ uint get_image_size_for_bmp(FILE *fptr_image)
  */
 Status open_files(EncodeInfo *encInfo)
 {
+    // Files already set by the caller (e.g. from received fds) are used as they are
+
     // Src Image file
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
+    if(encInfo->fptr_src_image == NULL)
+    {
+        encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
+    }
     
     // Do Error handling
     if (encInfo->fptr_src_image == NULL)
@@ -51,20 +52,41 @@ Status open_files(EncodeInfo *encInfo)
     	return e_failure;
     }
 
-    // Secret file
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
-    
-    // Do Error handling
-    if (encInfo->fptr_secret == NULL)
+    // Whole spans are read / written at once, skip stdio buffering
+    setvbuf(encInfo->fptr_src_image, NULL, _IONBF, 0);
+
+    // Reused cover images are served from the carrier cache
+    if(encInfo->cache_carrier)
     {
-    	perror("fopen");
-    	fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
+        encInfo->carrier = carrier_cache_get(fileno(encInfo->fptr_src_image));
+    }
 
-    	return e_failure;
+    // Secret file, container entries are opened one by one while packing
+    if(encInfo->fptr_secret == NULL && encInfo->entry_count == 0)
+    {
+        encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+
+        // Do Error handling
+        if (encInfo->fptr_secret == NULL)
+        {
+            perror("fopen");
+            fprintf(stderr, "ERROR: Unable to open file %s\n", encInfo->secret_fname);
+
+            return e_failure;
+        }
+    }
+
+    // Whole spans are read / written at once, skip stdio buffering
+    if(encInfo->fptr_secret != NULL)
+    {
+        setvbuf(encInfo->fptr_secret, NULL, _IONBF, 0);
     }
 
     // Stego Image file
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
+    if(encInfo->fptr_stego_image == NULL)
+    {
+        encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
+    }
    
     // Do Error handling
     if (encInfo->fptr_stego_image == NULL)
@@ -75,6 +97,9 @@ Status open_files(EncodeInfo *encInfo)
     	return e_failure;
     }
 
+    // Whole spans are read / written at once, skip stdio buffering
+    setvbuf(encInfo->fptr_stego_image, NULL, _IONBF, 0);
+
     // No failure return e_success
     return e_success;
 }
@@ -103,7 +128,7 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     if(argv[3][0] != '.')       // Ensure filename doesn't start with dot
     {
         // Check for supported secret file extensions
-        if(strstr(argv[3], ".txt") || strstr(argv[3], ".c") || strstr(argv[3], ".sh") || strstr(argv[3], ".h"))  
+        if((strstr(argv[3], ".txt") || strstr(argv[3], ".c") || strstr(argv[3], ".sh") || strstr(argv[3], ".h")) && get_secret_extn(argv[3]) != NULL)
         {
             encInfo -> secret_fname = argv[3]; // Store secret filename
         }
@@ -118,9 +143,10 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     }
 
     // Handle output filename (optional argument)
-    if(argv[4] == NULL)
+    if(argv[4] == NULL || strncmp(argv[4], "--", 2) == 0)
     {
         encInfo -> stego_image_fname = "default.bmp"; // Use default output name
+        return argv[4] == NULL ? e_success : read_layout_options(argv + 4, encInfo);
     }
     else
     {
@@ -129,6 +155,7 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
             if(strstr(argv[4], ".bmp"))  // Check for .bmp extension
             {   
                 encInfo -> stego_image_fname = argv[4]; // Store output filename
+                return read_layout_options(argv + 5, encInfo);
             }
             else
             {
@@ -144,21 +171,131 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     return e_success;
 }
 
-/* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+/* Read and validate Container args from argv
+ * Description: -c src.bmp stego.bmp file... [layout options],
+ * the files are any regular files, packed under their names
+ */
+Status read_and_validate_container_args(char *argv[], EncodeInfo *encInfo)
 {
-    unsigned char header[54];       // Buffer for 54-byte BMP header
+    // Source and stego image
+    if(argv[2][0] == '.' || strstr(argv[2], ".bmp") == NULL || argv[3] == NULL || argv[3][0] == '.' || strstr(argv[3], ".bmp") == NULL)
+    {
+        return e_failure;
+    }
+    encInfo -> src_image_fname = argv[2];
+    encInfo -> stego_image_fname = argv[3];
 
-    // Reset source file pointer to beginning
-    rewind(fptr_src_image);
+    // Files up to the first option
+    encInfo -> entry_fnames = argv + 4;
+    encInfo -> entry_count = 0;
+    while(argv[4 + encInfo -> entry_count] != NULL && strncmp(argv[4 + encInfo -> entry_count], "--", 2) != 0)
+    {
+        encInfo -> entry_count++;
+    }
+    if(encInfo -> entry_count == 0)
+    {
+        return e_failure;
+    }
 
-    // Read complete BMP header from source image
-    fread(header, 1, 54, fptr_src_image);
-    // Write header to destination image
-    fwrite(header, 1, 54, fptr_dest_image);
-    
-    // Verify both files are at same position after copy
-    if(ftell(fptr_src_image) == ftell(fptr_dest_image)) 
+    encInfo -> layout.container = 1;
+    return read_layout_options(argv + 4 + encInfo -> entry_count, encInfo);
+}
+
+/* Read layout options (--bits, --lsb-first, --channels, --adaptive, --fec) and --analyze starting at argv[0] */
+Status read_layout_options(char *argv[], EncodeInfo *encInfo)
+{
+    for(int i = 0; argv[i] != NULL; i++)
+    {
+        if(strcmp(argv[i], "--bits") == 0 && argv[i + 1] != NULL)
+        {
+            // Bits replaced in every carrier byte
+            if(strcmp(argv[i + 1], "1") == 0 || strcmp(argv[i + 1], "2") == 0)
+            {
+                encInfo -> layout.bits = argv[++i][0] - '0';
+            }
+            else
+            {
+                return e_failure;
+            }
+        }
+        else if(strcmp(argv[i], "--lsb-first") == 0)
+        {
+            encInfo -> layout.lsb_first = 1;
+        }
+        else if(strcmp(argv[i], "--channels") == 0 && argv[i + 1] != NULL)
+        {
+            // Any of b, g and r, e.g. "b" or "bg"
+            const char *ch = argv[++i];
+            encInfo -> layout.channel_mask = 0;
+            for(; *ch; ch++)
+            {
+                if(*ch == 'b')
+                {
+                    encInfo -> layout.channel_mask |= LSB_CHANNEL_BLUE;
+                }
+                else if(*ch == 'g')
+                {
+                    encInfo -> layout.channel_mask |= LSB_CHANNEL_GREEN;
+                }
+                else if(*ch == 'r')
+                {
+                    encInfo -> layout.channel_mask |= LSB_CHANNEL_RED;
+                }
+                else
+                {
+                    return e_failure;
+                }
+            }
+            if(encInfo -> layout.channel_mask == 0)
+            {
+                return e_failure;
+            }
+        }
+        else if(strcmp(argv[i], "--adaptive") == 0)
+        {
+            // Optional level 1..15, blocks need a variance of 2^level
+            encInfo -> layout.adaptive = TEXTURE_DEFAULT_LEVEL;
+            if(argv[i + 1] != NULL && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9')
+            {
+                int level = atoi(argv[++i]);
+                if(level < 1 || level > 15)
+                {
+                    return e_failure;
+                }
+                encInfo -> layout.adaptive = level;
+            }
+        }
+        else if(strcmp(argv[i], "--fec") == 0)
+        {
+            // Optional parity bytes per 255 byte codeword, even, 2..64
+            encInfo -> layout.fec = FEC_DEFAULT_ROOTS;
+            if(argv[i + 1] != NULL && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9')
+            {
+                int nroots = atoi(argv[++i]);
+                if(nroots < 2 || nroots > FEC_MAX_ROOTS || nroots % 2 != 0)
+                {
+                    return e_failure;
+                }
+                encInfo -> layout.fec = nroots;
+            }
+        }
+        else if(strcmp(argv[i], "--analyze") == 0)
+        {
+            encInfo -> analyze = 1;
+        }
+        else
+        {
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/* Copy bmp image header */
+Status copy_bmp_header(CodecContext *ctx, FILE *fptr_dest_image)
+{
+    // Write the cached header to destination image
+    if(fwrite(ctx -> header, 1, BMP_HEADER_SIZE, fptr_dest_image) == BMP_HEADER_SIZE)
     {
         return e_success;
     }
@@ -168,6 +305,98 @@ Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
     }
 }
 
+/* Read secret file and the carrier bytes that will hold the payload */
+Status read_payload_window(EncodeInfo *encInfo)
+{
+    CodecContext *ctx = encInfo -> ctx;
+    size_t secret_size = encInfo -> size_secret_file;
+
+    size_t payload_size = get_payload_window_size(encInfo);
+
+    if(encInfo -> entry_count > 0)
+    {
+        // Container index and every entry, packed as they are embedded
+        if(codec_ctx_reserve_scratch(ctx, encInfo -> index.index_size + encInfo -> index.data_size) == e_failure ||
+           container_index_pack(&encInfo -> index, encInfo -> entry_fnames, ctx -> scratch) == e_failure)
+        {
+            return e_failure;
+        }
+    }
+    else
+    {
+        // Read the whole secret file into scratch
+        if(codec_ctx_reserve_scratch(ctx, secret_size) == e_failure)
+        {
+            return e_failure;
+        }
+        rewind(encInfo -> fptr_secret);
+        if(fread(ctx -> scratch, 1, secret_size, encInfo -> fptr_secret) != secret_size)
+        {
+            return e_failure;
+        }
+    }
+
+    // Cached carrier: copy only the payload span out of the shared mapping
+    if(encInfo -> carrier != NULL)
+    {
+        if(BMP_HEADER_SIZE + payload_size > encInfo -> carrier -> map_len ||
+           codec_ctx_copy(ctx, encInfo -> carrier -> map + BMP_HEADER_SIZE, payload_size) == NULL)
+        {
+            return e_failure;
+        }
+        return e_success;
+    }
+
+    // Read every image byte the payload will touch in one go
+    if(codec_ctx_fill(ctx, encInfo -> fptr_src_image, payload_size) == NULL)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Map the textured blocks of the window and check they hold the payload (adaptive layouts) */
+Status build_texture_map(EncodeInfo *encInfo)
+{
+    CodecContext *ctx = encInfo -> ctx;
+    size_t payload = get_payload_stream_size(encInfo);
+
+    if(encInfo -> layout.adaptive == 0)
+    {
+        return e_success;
+    }
+
+    // Blocks start right after the layout word
+    if(texture_map_build(&encInfo -> texture, ctx, ctx -> window + LSB_EXT_HEADER_BYTES, ctx -> window_len - LSB_EXT_HEADER_BYTES, &encInfo -> layout) == e_failure)
+    {
+        return e_failure;
+    }
+    if(encInfo -> report != NULL)
+    {
+        encInfo -> report -> payload_bytes = payload;
+        encInfo -> report -> capacity_bytes = encInfo -> texture.capacity;
+    }
+    if(payload > encInfo -> texture.capacity)
+    {
+        printf("Capacity check failed: textured blocks hold %zu bytes\n", encInfo -> texture.capacity);
+        report_error(encInfo -> report, e_err_capacity);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Write the modified payload window to stego image */
+Status write_payload_window(EncodeInfo *encInfo)
+{
+    CodecContext *ctx = encInfo -> ctx;
+
+    if(fwrite(ctx -> window, 1, ctx -> window_len, encInfo -> fptr_stego_image) != ctx -> window_len)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
 /* Get size of any file in bytes */
 uint get_file_size(FILE *fptr)
 {
@@ -176,56 +405,253 @@ uint get_file_size(FILE *fptr)
     return size;                 // Return file size in bytes
 }
 
+/* Extension of a secret file name from its first dot, NULL when there is none or it is longer than MAX_FILE_SUFFIX */
+const char *get_secret_extn(const char *secret_fname)
+{
+    const char *extn = strchr(secret_fname, '.');
+
+    if(extn == NULL || strlen(extn) > MAX_FILE_SUFFIX)
+    {
+        return NULL;
+    }
+    return extn;
+}
+
+/* Store the secret's extension in extn_secret_file, e_failure when it does not fit */
+static Status store_secret_extn(EncodeInfo *encInfo)
+{
+    const char *extn = get_secret_extn(encInfo -> secret_fname);
+
+    if(extn == NULL)
+    {
+        fprintf(stderr, "ERROR: Extension of %s is longer than %d characters\n", encInfo -> secret_fname, MAX_FILE_SUFFIX);
+        return e_failure;
+    }
+    memcpy(encInfo -> extn_secret_file, extn, strlen(extn) + 1);
+    return e_success;
+}
+
+/* Payload bytes before any FEC: both sizes, extension and data, or the whole container */
+static size_t get_payload_size(EncodeInfo *encInfo)
+{
+    const char *extn;
+
+    if(encInfo -> entry_count > 0)
+    {
+        return encInfo -> index.index_size + encInfo -> index.data_size;
+    }
+    extn = get_secret_extn(encInfo -> secret_fname);
+    return 4 + (extn != NULL ? strlen(extn) : 0) + 4 + encInfo -> size_secret_file;
+}
+
+/* Original layout: "#*" and no layout word */
+static int is_original_layout(EncodeInfo *encInfo)
+{
+    return encInfo -> codec == &lsb_codec_default && encInfo -> layout.adaptive == 0 && encInfo -> layout.fec == 0 && encInfo -> layout.container == 0;
+}
+
+/* Pick the codec for the requested layout and the image's pixel size */
+Status select_codec(EncodeInfo *encInfo)
+{
+    LsbLayout *layout = &encInfo -> layout;
+
+    // Fields left zero keep their original meaning
+    if(layout -> bits == 0)
+    {
+        layout -> bits = 1;
+    }
+    if(layout -> channel_mask == 0)
+    {
+        layout -> channel_mask = LSB_CHANNEL_ALL;
+    }
+    layout -> bytes_per_pixel = encInfo -> ctx -> bits_per_pixel / 8;
+
+    if((encInfo -> codec = lsb_codec_lookup(layout)) == NULL)
+    {
+        printf("Error: Layout not supported for %u bits per pixel\n", encInfo -> ctx -> bits_per_pixel);
+        return e_failure;
+    }
+    if(!lsb_channels_fit_rows(layout, encInfo -> ctx -> width))
+    {
+        printf("Error: --channels needs rows without padding, %u pixels of %u bytes is not a multiple of 4\n", encInfo -> ctx -> width, layout -> bytes_per_pixel);
+        return e_failure;
+    }
+    if(layout -> fec && (encInfo -> fec.rs = rs_code_get(layout -> fec)) == NULL)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Bytes embedded after the layout word: both sizes, extension and data, plus any FEC */
+size_t get_payload_stream_size(EncodeInfo *encInfo)
+{
+    size_t payload = get_payload_size(encInfo);
+
+    return encInfo -> layout.fec ? fec_stream_size(encInfo -> fec.rs, payload) : payload;
+}
+
+/* Image bytes the whole payload occupies */
+size_t get_payload_window_size(EncodeInfo *encInfo)
+{
+    const LsbCodec *codec = encInfo -> codec;
+
+    // Adaptive layouts scatter the payload over the whole image
+    if(encInfo -> layout.adaptive)
+    {
+        return encInfo -> image_data_size;
+    }
+
+    // Magic string (and layout word) always use 1 bit per image byte
+    size_t header = strlen(MAGIC_STRING) * 8 + (is_original_layout(encInfo) ? 0 : 32);
+
+    // Both sizes, extension and data follow in the job's layout
+    return header + lsb_carrier_bytes(codec, lsb_phase(codec, header), get_payload_stream_size(encInfo));
+}
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo)
 {
-    uint size = get_image_size_for_bmp(encInfo->fptr_src_image);
-    encInfo -> size_secret_file = get_file_size(encInfo -> fptr_secret);
+    // Parse the header once, every later stage uses the cache
+    if(encInfo -> carrier != NULL)
+    {
+        codec_ctx_parse_header(encInfo -> ctx, encInfo -> carrier -> map);
+    }
+    else if(codec_ctx_load_header(encInfo -> ctx, encInfo -> fptr_src_image) == e_failure)
+    {
+        report_error(encInfo -> report, e_err_format);
+        return e_failure;
+    }
+
+    // Pixel bytes the carrier really has
+    struct stat st;
+    if(encInfo -> carrier != NULL)
+    {
+        encInfo -> image_data_size = get_image_size_for_bmp(encInfo -> ctx, encInfo -> carrier -> map_len);
+    }
+    else if(fstat(fileno(encInfo -> fptr_src_image), &st) == 0)
+    {
+        encInfo -> image_data_size = get_image_size_for_bmp(encInfo -> ctx, st.st_size);
+    }
+    else
+    {
+        report_error(encInfo -> report, e_err_io);
+        return e_failure;
+    }
+    size_t size = encInfo -> image_data_size;
+
+    // Sizes of every file to pack, or of the secret file
+    if(encInfo -> entry_count > 0)
+    {
+        if(container_index_build(&encInfo -> index, encInfo -> entry_fnames, encInfo -> entry_count) == e_failure)
+        {
+            report_error(encInfo -> report, e_err_open);
+            return e_failure;
+        }
+    }
+    else
+    {
+        encInfo -> size_secret_file = get_file_size(encInfo -> fptr_secret);
+    }
+
+    if(select_codec(encInfo) == e_failure)
+    {
+        report_error(encInfo -> report, e_err_format);
+        return e_failure;
+    }
+
+    // Textured blocks are only known once the pixels are read, see build_texture_map()
+    if(encInfo -> layout.adaptive)
+    {
+        if(size < LSB_EXT_HEADER_BYTES)
+        {
+            report_error(encInfo -> report, e_err_format);
+            return e_failure;
+        }
+        return e_success;
+    }
+
+    // Stream bytes after the magic string (and layout word) against what the rest of the image holds
+    if(encInfo -> report != NULL)
+    {
+        size_t header = strlen(MAGIC_STRING) * 8 + (is_original_layout(encInfo) ? 0 : 32);
+        encInfo -> report -> payload_bytes = get_payload_stream_size(encInfo);
+        encInfo -> report -> capacity_bytes = size > header ? lsb_data_bytes(encInfo -> codec, lsb_phase(encInfo -> codec, header), size - header) : 0;
+    }
 
     // Calculate if image can hold magic string + extension + file size + secret data
-    if(size > ((strlen(MAGIC_STRING) + MAX_FILE_SUFFIX + sizeof(encInfo -> extn_secret_file) + sizeof(encInfo -> size_secret_file) + encInfo -> size_secret_file ) * 8) + 54)
+    if(size >= get_payload_window_size(encInfo))
     {
         return e_success;
     }
 
+    report_error(encInfo -> report, e_err_capacity);
     return e_failure;
 }
 
 /* Encode a byte into LSB of image data array */
 Status encode_byte_to_lsb(char data, char *image_buffer)
 {
-    char bit_data;
+    // One bit per image byte, MSB first
+    lsb_codec_default.embed((unsigned char *)image_buffer, 0, (const unsigned char *)&data, 1);
 
-    // Process each bit from MSB to LSB
-    for(int i = 7; i >= 0; i--)
+    return e_success; 
+}
+
+/* Embed len bytes at the current window position with the job's codec */
+static Status encode_payload_raw(EncodeInfo *encInfo, const unsigned char *data, size_t len)
+{
+    const LsbCodec *codec = encInfo -> codec;
+    size_t phase = lsb_phase(codec, encInfo -> ctx -> window_pos);
+    unsigned char *arr;
+
+    // Adaptive layouts only use the textured blocks
+    if(encInfo -> layout.adaptive)
     {
-        bit_data = ((data >> i) & 1);                           //Get the bit
-        image_buffer[7 - i] = image_buffer[7 - i] & (~1);       //clear the bit
-        image_buffer[7 - i] = image_buffer[7 - i] | bit_data;   //set the bit
+        return texture_map_embed(&encInfo -> texture, codec, data, len) == len ? e_success : e_failure;
     }
 
-    return e_success; 
+    if((arr = codec_ctx_next(encInfo -> ctx, lsb_carrier_bytes(codec, phase, len))) == NULL)
+    {
+        return e_failure;
+    }
+
+    codec -> embed(arr, phase, data, len);
+    return e_success;
+}
+
+/* FEC output goes straight into the carrier */
+static Status encode_fec_sink(void *arg, const unsigned char *bytes, size_t len)
+{
+    return encode_payload_raw(arg, bytes, len);
+}
+
+/* Embed len payload bytes, through the error correction code when the layout has one */
+static Status encode_payload_bytes(EncodeInfo *encInfo, const unsigned char *data, size_t len)
+{
+    if(encInfo -> layout.fec)
+    {
+        return fec_stream_put(&encInfo -> fec, data, len, encode_fec_sink, encInfo);
+    }
+    return encode_payload_raw(encInfo, data, len);
 }
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 {
-    //Declare array of size 8
-    char arr[8];
+    char *arr;
 
     // Process each character in magic string
-    for(int i = 0; i < strlen(magic_string); i++)
+    for(size_t i = 0; i < strlen(magic_string); i++)
     {
-        // Read 8 image bytes for encoding one character
-        fread(arr, 1, 8, encInfo -> fptr_src_image);
-
-        /* Encode a byte into LSB of image data array */
-        if((encode_byte_to_lsb(magic_string[i], arr)) == e_success)
+        // Take next 8 image bytes of the payload window
+        if((arr = (char *)codec_ctx_next(encInfo -> ctx, 8)) == NULL)
         {
-            // Write modified image bytes to output file
-            fwrite(arr, 1, 8, encInfo -> fptr_stego_image);
+            return e_failure;
         }
-        else
+
+        /* Encode a byte into LSB of image data array */
+        if((encode_byte_to_lsb(magic_string[i], arr)) == e_failure)
         {
             return e_failure;
         }
@@ -236,157 +662,346 @@ Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 /* Encode function, which does the real encoding */
 Status encode_int_to_lsb(int size, char *image_buffer) //collecting 32 bytes of data
 {
-    char bit_data;
+    unsigned char field[4];
 
-    // Process each of 32 bits from MSB to LSB
-    for(int i = 31; i >= 0; i--)
-    {
-        bit_data = ((size >> i) & 1);                             //Get the bit
-        image_buffer[31 - i] = image_buffer[31 - i] & (~1);      //clear the bit
-        image_buffer[31 - i] = image_buffer[31 - i] | bit_data; //set the bit
-    }
+    // 32 bits from MSB to LSB, one per image byte
+    lsb_store_be32(field, size);
+    lsb_codec_default.embed((unsigned char *)image_buffer, 0, field, 4);
 
     return e_success; 
 }
 
-/* Encode extenstion size */
-Status encode_secret_extn_file_size(int size, EncodeInfo *encInfo)
+/* Store the layout word, only images in a non original layout have one */
+Status encode_layout_word(EncodeInfo *encInfo)
 {
-    //Declare the array with size 32
-    char arr[32];
-
-    strcpy(encInfo->extn_secret_file, strstr(encInfo->secret_fname,".")); 
-
-    //Read 32 byte of data from src file
-    fread(arr, 1, 32, encInfo -> fptr_src_image);
+    char *arr;
 
-    if((encode_int_to_lsb(strlen(encInfo -> extn_secret_file), arr)) == e_success)
+    if(is_original_layout(encInfo))
     {
-        //write  the 32 byte data into dest file
-        fwrite(arr, 1, 32, encInfo->fptr_stego_image);
         return e_success;
-    } 
+    }
 
-    return e_failure;
+    //Take next 32 bytes of the payload window
+    if((arr = (char *)codec_ctx_next(encInfo -> ctx, 32)) == NULL)
+    {
+        return e_failure;
+    }
+
+    encode_int_to_lsb(lsb_layout_to_word(&encInfo -> layout), arr);
+
+    // Payload length copies lead the coded stream
+    if(encInfo -> layout.fec)
+    {
+        return fec_stream_begin(&encInfo -> fec, encInfo -> fec.rs, get_payload_size(encInfo), encode_fec_sink, encInfo);
+    }
+    return e_success;
 }
 
-/* Encode secret file extenstion */
-Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+/* Encode extenstion size */
+Status encode_secret_extn_file_size(EncodeInfo *encInfo)
 {
-    //Declare array of size 8
-    char arr[8];
+    unsigned char field[4];
 
-    // Process each character in file extension
-    for(int i = 0; i < strlen(file_extn); i++)
+    if(store_secret_extn(encInfo) == e_failure)
     {
-        //Read the 8byte of data from src file
-        fread(arr, 1, 8, encInfo -> fptr_src_image);
-
-        /* Encode a byte into LSB of image data array */
-        if((encode_byte_to_lsb(file_extn[i], arr)) == e_success)
-        {
-            //Write the 8byted data to destination
-            fwrite(arr, 1, 8, encInfo -> fptr_stego_image);
-        } 
-        else
-        {
-            return e_failure;
-        }
+        return e_failure;
     }
-    return e_success;
+
+    lsb_store_be32(field, strlen(encInfo -> extn_secret_file));
+    return encode_payload_bytes(encInfo, field, 4);
+}
+
+/* Encode secret file extenstion */
+Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
+{
+    return encode_payload_bytes(encInfo, (const unsigned char *)file_extn, strlen(file_extn));
 }
 
 /* Encode secret file size */
 Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
 {
-    //Declare the array with size 32
-    char arr[32];
-
-    //Read 32 byte of data from src file
-    fread(arr, 1, 32, encInfo->fptr_src_image);
+    unsigned char field[4];
 
     // Encode file size as 32-bit integer
-    if((encode_int_to_lsb(file_size, arr)) == e_success)
+    lsb_store_be32(field, file_size);
+    return encode_payload_bytes(encInfo, field, 4);
+}
+
+/* Checksum the secret bytes for the report, only when one is wanted */
+static void report_secret_crc(EncodeInfo *encInfo, const unsigned char *data, size_t len)
+{
+    if(encInfo -> report != NULL && encInfo -> report -> want_crc)
     {
-        //write  the 32 byte data into dest file
-        fwrite(arr, 1, 32, encInfo->fptr_stego_image);
-        return e_success;
+        encInfo -> report -> crc = fec_crc32(0, data, len);
+        encInfo -> report -> has_crc = 1;
     }
-    return e_failure;
 }
 
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo)
 {
-    char arr[8];    // Buffer for 8 image bytes
-    char ch;        // Buffer for one secret data byte
+    // Secret file read by read_payload_window(), embedded in one pass
+    report_secret_crc(encInfo, encInfo -> ctx -> scratch, encInfo -> size_secret_file);
+    return encode_payload_bytes(encInfo, encInfo -> ctx -> scratch, encInfo -> size_secret_file);
+}
+
+/* Encode the container index and every entry after it */
+Status encode_container(EncodeInfo *encInfo)
+{
+    // Packed by read_payload_window(), embedded in one pass
+    report_secret_crc(encInfo, encInfo -> ctx -> scratch, get_payload_size(encInfo));
+    return encode_payload_bytes(encInfo, encInfo -> ctx -> scratch, get_payload_size(encInfo));
+}
 
-    // Reset secret file pointer to beginning
-    rewind(encInfo -> fptr_secret);
+/* Checksum the secret file for the report when the stripes read it themselves */
+static Status report_secret_file_crc(EncodeInfo *encInfo)
+{
+    unsigned char block[CODEC_IO_BLOCK_SIZE];  // The context's block is busy with the tail copy
+    uint32_t crc = 0;
+    off_t offset = 0;
+    ssize_t got;
 
-    // Process each byte of secret file data
-    for(int i = 0; i < encInfo -> size_secret_file; i++)
+    if(encInfo -> report == NULL || !encInfo -> report -> want_crc)
     {
-        // Read one byte from secret file
-        fread(&ch, 1, 1, encInfo -> fptr_secret);
-        
-        // Read 8 image bytes for encoding one secret byte
-        fread(arr, 1, 8, encInfo -> fptr_src_image);
+        return e_success;
+    }
+    while((got = pread(fileno(encInfo -> fptr_secret), block, sizeof(block), offset)) > 0)
+    {
+        crc = fec_crc32(crc, block, got);
+        offset += got;
+    }
+    if(got < 0 || offset != encInfo -> size_secret_file)
+    {
+        return e_failure;
+    }
+    encInfo -> report -> crc = crc;
+    encInfo -> report -> has_crc = 1;
+    return e_success;
+}
 
-        /* Encode a byte into LSB of image data array */
-        if((encode_byte_to_lsb(ch, arr)) == e_success)
-        {
-            // Write modified image bytes to output file
-            fwrite(arr, 1, 8, encInfo -> fptr_stego_image);
-        }
-        else
-        {
-            return e_failure;
-        }
+/* Whether the payload window is large enough, and the layout simple enough, for stripes
+ * Description: FEC and adaptive layouts produce the payload
+ * as one sequential stream, and containers and cached
+ * carriers already live in memory, so those stay serial;
+ * stripes pread the secret, so it needs a descriptor (the
+ * daemon's inline secrets are memory streams without one)
+ */
+int use_striped_encoding(EncodeInfo *encInfo)
+{
+    return encInfo -> carrier == NULL && encInfo -> entry_count == 0 && encInfo -> layout.adaptive == 0 && encInfo -> layout.fec == 0 &&
+           fileno(encInfo -> fptr_secret) >= 0 && get_payload_window_size(encInfo) >= STRIPE_MIN_WINDOW;
+}
+
+/* Embed the whole payload straight from the files, stripe by stripe, with bounded memory */
+Status encode_striped(EncodeInfo *encInfo)
+{
+    StripeJob job;
+    unsigned char prefix[4 + MAX_FILE_SUFFIX + 4];
+    size_t extn_len;
+    size_t window = get_payload_window_size(encInfo);
+
+    // Extension size, extension and secret size lead the stream
+    if(store_secret_extn(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    extn_len = strlen(encInfo -> extn_secret_file);
+    lsb_store_be32(prefix, extn_len);
+    memcpy(prefix + 4, encInfo -> extn_secret_file, extn_len);
+    lsb_store_be32(prefix + 4 + extn_len, encInfo -> size_secret_file);
+
+    job.src_fd = fileno(encInfo -> fptr_src_image);
+    job.stego_fd = fileno(encInfo -> fptr_stego_image);
+    job.secret_fd = fileno(encInfo -> fptr_secret);
+    job.magic = is_original_layout(encInfo) ? MAGIC_STRING : MAGIC_STRING_EXT;
+    job.has_word = !is_original_layout(encInfo);
+    job.word = lsb_layout_to_word(&encInfo -> layout);
+    job.header = strlen(job.magic) * 8 + (job.has_word ? 32 : 0);
+    job.codec = encInfo -> codec;
+    job.prefix = prefix;
+    job.prefix_len = 8 + extn_len;
+    job.stream_len = get_payload_size(encInfo);
+    job.window = window;
+
+    // Both files continue after the window, where the tail copy picks up
+    if(codec_ctx_skip(encInfo -> ctx, encInfo -> fptr_src_image, window) == e_failure ||
+       fseeko(encInfo -> fptr_stego_image, BMP_HEADER_SIZE + window, SEEK_SET) != 0)
+    {
+        return e_failure;
+    }
+
+    if(start_remaining_img_copy(encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    if(stripe_embed(&job) == e_failure || report_secret_file_crc(encInfo) == e_failure)
+    {
+        return e_failure;
     }
-    return e_success;  
+    return finish_remaining_img_copy(encInfo);
 }
 
 /* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, CodecContext *ctx)
 { 
-   char ch;   // Buffer for one byte
+   size_t len;   // Bytes in current block
 
-   // Copy all remaining bytes from source to destination
-   while(fread(&ch, 1, 1, fptr_src))
+   // Copy all remaining bytes from source to destination, one block at a time
+   while((len = fread(ctx -> io_block, 1, CODEC_IO_BLOCK_SIZE, fptr_src)) > 0)
    {
-        fwrite(&ch, 1, 1, fptr_dest);   // Write byte to destination
+        if(fwrite(ctx -> io_block, 1, len, fptr_dest) != len)   // Write block to destination
+        {
+            return e_failure;
+        }
    }
 
    return e_success;
 }
 
+/* Start copying the image bytes after the payload window in the background */
+Status start_remaining_img_copy(EncodeInfo *encInfo)
+{
+    struct stat st;
+    int src_fd = fileno(encInfo -> fptr_src_image);
+
+    // Source is unbuffered, so its position is exactly the end of the payload window
+    off_t offset = BMP_HEADER_SIZE + encInfo -> ctx -> window_start + encInfo -> ctx -> window_len;
+
+    // A cached carrier is written straight from its mapping later
+    if(encInfo -> carrier != NULL)
+    {
+        return e_success;
+    }
+
+    if(fstat(src_fd, &st) != 0 || st.st_size < offset)
+    {
+        return e_failure;
+    }
+
+    if(aio_copy_start(&encInfo -> tail_copy, src_fd, offset, fileno(encInfo -> fptr_stego_image), offset, st.st_size - offset) == e_success)
+    {
+        encInfo -> tail_async = 1;
+    }
+    return e_success;
+}
+
+/* Wait for the background copy, or copy serially if it never started */
+Status finish_remaining_img_copy(EncodeInfo *encInfo)
+{
+    if(encInfo -> tail_async)
+    {
+        encInfo -> tail_async = 0;
+        return aio_copy_wait(&encInfo -> tail_copy);
+    }
+
+    // Stream the untouched remainder of a cached carrier from its mapping
+    if(encInfo -> carrier != NULL)
+    {
+        size_t offset = BMP_HEADER_SIZE + encInfo -> ctx -> window_len;
+        size_t len = encInfo -> carrier -> map_len - offset;
+
+        return fwrite(encInfo -> carrier -> map + offset, 1, len, encInfo -> fptr_stego_image) == len ? e_success : e_failure;
+    }
+
+    return copy_remaining_img_data(encInfo -> fptr_src_image, encInfo -> fptr_stego_image, encInfo -> ctx);
+}
+
+/* Close all files opened for encoding */
+void close_files(EncodeInfo *encInfo)
+{
+    if(encInfo -> fptr_src_image != NULL)
+    {
+        fclose(encInfo -> fptr_src_image);
+        encInfo -> fptr_src_image = NULL;
+    }
+    if(encInfo -> fptr_secret != NULL)
+    {
+        fclose(encInfo -> fptr_secret);
+        encInfo -> fptr_secret = NULL;
+    }
+    if(encInfo -> fptr_stego_image != NULL)
+    {
+        fclose(encInfo -> fptr_stego_image);
+        encInfo -> fptr_stego_image = NULL;
+    }
+    container_index_free(&encInfo -> index);
+}
+
 /* Perform the encoding */
 Status do_encoding(EncodeInfo *encInfo)
 {
+    Status ret = e_failure;
+
+    encInfo -> tail_async = 0;
+    encInfo -> carrier = NULL;
+
+    // Take codec buffers from this thread's pool
+    if((encInfo -> ctx = codec_ctx_acquire()) == NULL)
+    {
+        return e_failure;
+    }
+    if(encInfo -> report != NULL)
+    {
+        encInfo -> report -> output = encInfo -> stego_image_fname;
+    }
+
     /* Get File pointers for i/p and o/p files */
+    report_stage(encInfo -> report, "open");
     if((open_files(encInfo)) == e_success)
     {
         printf("Opening Files Done...\n");
         
         // Initialize file information
-        encInfo->size_secret_file = get_file_size(encInfo->fptr_secret); 
-        
-        printf("Secret file size: %ld bytes\n", encInfo->size_secret_file);
+        if(encInfo->fptr_secret != NULL)
+        {
+            encInfo->size_secret_file = get_file_size(encInfo->fptr_secret); 
+
+            printf("Secret file size: %ld bytes\n", encInfo->size_secret_file);
+        }
         
+        report_stage(encInfo -> report, "capacity");
         if((check_capacity(encInfo)) == e_success)
         {
             printf("Checking the capacity done...\n");
+            if(encInfo -> report != NULL)
+            {
+                encInfo -> report -> bytes = encInfo -> entry_count > 0 ? encInfo -> index.data_size : (uint64_t)encInfo -> size_secret_file;
+            }
+
+            report_stage(encInfo -> report, "embed");
+            /* Large carriers are embedded stripe by stripe */
+            if(use_striped_encoding(encInfo))
+            {
+                if((copy_bmp_header(encInfo -> ctx, encInfo -> fptr_stego_image)) == e_success && (encode_striped(encInfo)) == e_success)
+                {
+                    printf("Encoded payload in stripes Successfully...\n");
+                    ret = e_success;
+                }
+            }
             /* Copy bmp image header */
-            if((copy_bmp_header(encInfo -> fptr_src_image, encInfo -> fptr_stego_image)) == e_success)
+            else if((copy_bmp_header(encInfo -> ctx, encInfo -> fptr_stego_image)) == e_success && (read_payload_window(encInfo)) == e_success && (build_texture_map(encInfo)) == e_success && (start_remaining_img_copy(encInfo)) == e_success)
             {
                 printf("Header Copied Successfully...\n");
-                /* Store Magic String */
-                if((encode_magic_string(MAGIC_STRING, encInfo)) == e_success)
+                /* Store Magic String, and the layout word of a non original layout */
+                if((encode_magic_string(is_original_layout(encInfo) ? MAGIC_STRING : MAGIC_STRING_EXT, encInfo)) == e_success &&
+                   (encode_layout_word(encInfo)) == e_success)
                 {
                     printf("Encoded Magic string Successfully...\n");
+                    if(encInfo -> entry_count > 0)
+                    {
+                        /* Encode the container index and its entries */
+                        if((encode_container(encInfo)) == e_success)
+                        {
+                            printf("Encoded container of %u files Successfully...\n", encInfo -> index.count);
+                            report_stage(encInfo -> report, "write");
+                            if((write_payload_window(encInfo)) == e_success && (finish_remaining_img_copy(encInfo)) == e_success)
+                            {
+                                ret = e_success;
+                            }
+                        }
+                    }
                     /* Encode extenstion size */
-                    if((encode_secret_extn_file_size(MAX_FILE_SUFFIX, encInfo)) == e_success)
+                    else if((encode_secret_extn_file_size(encInfo)) == e_success)
                     {
                         printf("Encoded secret File extention Size Successfully...\n");
                         /* Encode secret file extenstion */
@@ -401,9 +1016,10 @@ Status do_encoding(EncodeInfo *encInfo)
                                 if((encode_secret_file_data(encInfo)) == e_success)
                                 {
                                     printf("Encoded secret File data Successfully...\n");
-                                    if((copy_remaining_img_data(encInfo -> fptr_src_image, encInfo -> fptr_stego_image)) == e_success)
+                                    report_stage(encInfo -> report, "write");
+                                    if((write_payload_window(encInfo)) == e_success && (finish_remaining_img_copy(encInfo)) == e_success)
                                     {                                    
-                                        return e_success; 
+                                        ret = e_success; 
                                     }
                                 }
                             }
@@ -417,5 +1033,30 @@ Status do_encoding(EncodeInfo *encInfo)
             printf("Capacity check failed\n");
         }
     }
-    return e_failure;
+    else
+    {
+        report_error(encInfo -> report, e_err_open);
+    }
+
+    // Anything else that stopped the job was reading or writing a file
+    if(ret == e_failure)
+    {
+        report_error(encInfo -> report, e_err_io);
+    }
+
+    // Never close files under a copy that is still in flight
+    if(encInfo -> tail_async)
+    {
+        aio_copy_wait(&encInfo -> tail_copy);
+        encInfo -> tail_async = 0;
+    }
+    close_files(encInfo);
+    carrier_cache_put(encInfo -> carrier);
+    encInfo -> carrier = NULL;
+
+    // Hand the buffers back for the next job
+    codec_ctx_release(encInfo -> ctx);
+    encInfo -> ctx = NULL;
+
+    return ret;
 }
\ No newline at end of file
@@ -2,6 +2,15 @@
 #define ENCODE_H
 #include <stdio.h>
 #include "types.h" // Contains user defined types
+#include "context.h" // Reusable codec context
+#include "aio.h" // Asynchronous block copy
+#include "carrier_cache.h" // Cache of reused cover images
+#include "lsb_codec.h" // Specialised embed / extract kernels
+#include "texture.h" // Adaptive embedding map
+#include "fec.h" // Reed-Solomon error correction
+#include "container.h" // Several named secrets in one carrier
+#include "stripe.h" // Striped embedding of large carriers
+#include "report.h" // Machine readable job report
 
 /* 
  * Structure to store information required for
@@ -21,19 +30,46 @@ typedef struct _EncodeInfo
     FILE *fptr_src_image;   // File pointer to read source image
     uint image_capacity;    // Total bytes available: width × height × 3
     uint bits_per_pixel;    // Color depth (usually 24 for BMP)
-    char image_data[MAX_IMAGE_BUF_SIZE];    // Buffer: stores 8 image bytes
+    size_t image_data_size; // Bytes after the header
 
     /* Secret File Info */
     char *secret_fname;     // Pointer to secret filename: "secret.txt"
     FILE *fptr_secret;      // File pointer to read secret file
-    char extn_secret_file[MAX_FILE_SUFFIX];     // File extension: ".txt" 
-    char secret_data[MAX_SECRET_BUF_SIZE];      // Buffer: stores 1 secret byte
+    char extn_secret_file[MAX_FILE_SUFFIX + 1]; // File extension: ".txt" 
     long size_secret_file;                      // Size of secret file in bytes
 
+    /* Container of several secret files (-c), used instead of the secret file */
+    char **entry_fnames;    // Files to pack, entry_count of them
+    uint entry_count;       // 0 when encoding a single secret file
+    ContainerIndex index;   // Entries and their place in the payload
+
     /* Stego Image Info */
     char *stego_image_fname;        // Pointer to output filename: "stego.bmp"
     FILE *fptr_stego_image;         // File pointer to write stego image
 
+    /* Codec buffers, drawn from the per-thread pool */
+    CodecContext *ctx;
+
+    /* Embedding layout, all zero means the original one */
+    LsbLayout layout;       // Requested bits per byte, channels and bit order
+    const LsbCodec *codec;  // Kernels for layout, picked once the header is known
+    TextureMap texture;     // Textured blocks, adaptive layouts only
+    FecStream fec;          // Error correction, layouts with FEC only
+
+    /* Score source and stego image for detectability once encoded (--analyze) */
+    int analyze;
+
+    /* Stage timings, sizes and the error class of the job, NULL when not wanted */
+    JobReport *report;
+
+    /* Source image from the carrier cache */
+    int cache_carrier;      // 1 to look the source image up in the carrier cache
+    CarrierEntry *carrier;  // Cached mapping, NULL when reading the file
+
+    /* Copy of the image bytes after the payload window */
+    AioCopy tail_copy;      // Runs while the payload is embedded
+    int tail_async;         // 1 while tail_copy is in flight
+
 } EncodeInfo;
 
 
@@ -45,29 +81,59 @@ OperationType check_operation_type(char *argv[]);
 /* Read and validate Encode args from argv */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
 
-/* Perform the encoding */
+/* Perform the encoding, file pointers left NULL are opened by name */
 Status do_encoding(EncodeInfo *encInfo);
 
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Read and validate Container args from argv */
+Status read_and_validate_container_args(char *argv[], EncodeInfo *encInfo);
+
+/* Read layout options (--bits, --lsb-first, --channels, --adaptive, --fec) and --analyze starting at argv[0] */
+Status read_layout_options(char *argv[], EncodeInfo *encInfo);
+
+/* Pick the codec for the requested layout and the image's pixel size */
+Status select_codec(EncodeInfo *encInfo);
+
+/* Bytes embedded after the layout word: both sizes, extension and data, plus any FEC */
+size_t get_payload_stream_size(EncodeInfo *encInfo);
+
+/* Image bytes the whole payload occupies */
+size_t get_payload_window_size(EncodeInfo *encInfo);
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+/* Get image size from the cached header */
+size_t get_image_size_for_bmp(CodecContext *ctx, size_t file_size);
 
 /* Get file size */
 uint get_file_size(FILE *fptr);
 
+/* Extension of a secret file name from its first dot, NULL when there is none or it is longer than MAX_FILE_SUFFIX */
+const char *get_secret_extn(const char *secret_fname);
+
 /* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+Status copy_bmp_header(CodecContext *ctx, FILE *fptr_dest_image);
+
+/* Read secret file and the carrier bytes that will hold the payload */
+Status read_payload_window(EncodeInfo *encInfo);
+
+/* Map the textured blocks of the window and check they hold the payload (adaptive layouts) */
+Status build_texture_map(EncodeInfo *encInfo);
+
+/* Write the modified payload window to stego image */
+Status write_payload_window(EncodeInfo *encInfo);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 
+/* Store the layout word, only images in a non original layout have one */
+Status encode_layout_word(EncodeInfo *encInfo);
+
 /* Encode extenstion size */
-Status encode_secret_extn_file_size(int size, EncodeInfo *encInfo);
+Status encode_secret_extn_file_size(EncodeInfo *encInfo);
 
 /* Encode secret file extenstion */
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
@@ -78,6 +144,15 @@ Status encode_secret_file_size(long file_size, EncodeInfo *encInfo);
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
+/* Encode the container index and every entry after it */
+Status encode_container(EncodeInfo *encInfo);
+
+/* Whether the payload window is large enough, and the layout simple enough, for stripes */
+int use_striped_encoding(EncodeInfo *encInfo);
+
+/* Embed the whole payload straight from the files, stripe by stripe, with bounded memory */
+Status encode_striped(EncodeInfo *encInfo);
+
 /* Encode int into LSB*/
 Status encode_int_to_lsb(int size, char *image_buffer); 
 
@@ -85,6 +160,15 @@ Status encode_int_to_lsb(int size, char *image_buffer);
 Status encode_byte_to_lsb(char data, char *image_buffer); 
 
 /* Copy remaining image bytes from src to stego image after encoding */
-Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
+Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest, CodecContext *ctx);
+
+/* Start copying the image bytes after the payload window in the background */
+Status start_remaining_img_copy(EncodeInfo *encInfo);
+
+/* Wait for the background copy, or copy serially if it never started */
+Status finish_remaining_img_copy(EncodeInfo *encInfo);
+
+/* Close all files opened for encoding */
+void close_files(EncodeInfo *encInfo);
 
 #endif
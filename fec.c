@@ -0,0 +1,1012 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "fec.h"
+#include "lsb_codec.h"
+#include "types.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_HAVE_SSSE3 1
+#endif
+
+#define GF_POLY 0x11d       // x^8 + x^4 + x^3 + x^2 + 1
+#define GF_A0 255           // Log of zero
+
+/* GF(256) tables, filled once */
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+static pthread_once_t gf_once = PTHREAD_ONCE_INIT;
+
+/* CRC-32 tables for 8 bytes at a time, filled once */
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/* Codes built so far, by nroots / 2 */
+static RsCode *rs_codes[FEC_MAX_ROOTS / 2 + 1];
+static pthread_mutex_t rs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Function Definitions */
+
+/* Fill the exponent and log tables */
+static void gf_init(void)
+{
+    uint x = 1;
+
+    for(int i = 0; i < 255; i++)
+    {
+        gf_exp[i] = x;
+        gf_exp[i + 255] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if(x & 0x100)
+        {
+            x ^= GF_POLY;
+        }
+    }
+    gf_exp[510] = gf_exp[0];
+    gf_exp[511] = gf_exp[1];
+    gf_log[0] = GF_A0;
+}
+
+/* Fill the CRC-32 tables, reflected IEEE polynomial
+ * Description: crc_table[t][x] is the CRC of byte x followed
+ * by t zero bytes, so 8 bytes are folded with 8 lookups
+ */
+static void crc_init(void)
+{
+    for(uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+
+        for(int j = 0; j < 8; j++)
+        {
+            c = c & 1 ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for(uint32_t i = 0; i < 256; i++)
+    {
+        for(int t = 1; t < 8; t++)
+        {
+            crc_table[t][i] = crc_table[0][crc_table[t - 1][i] & 0xff] ^ (crc_table[t - 1][i] >> 8);
+        }
+    }
+}
+
+/* Running CRC-32 of data, start from 0 */
+uint32_t fec_crc32(uint32_t crc, const unsigned char *data, size_t len)
+{
+    size_t i = 0;
+
+    pthread_once(&crc_once, crc_init);
+
+    crc = ~crc;
+    for(; i + 8 <= len; i += 8)
+    {
+        uint32_t lo = crc ^ ((uint32_t)data[i] | (uint32_t)data[i + 1] << 8 | (uint32_t)data[i + 2] << 16 | (uint32_t)data[i + 3] << 24);
+        uint32_t hi = (uint32_t)data[i + 4] | (uint32_t)data[i + 5] << 8 | (uint32_t)data[i + 6] << 16 | (uint32_t)data[i + 7] << 24;
+
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^ crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^ crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+    }
+    for(; i < len; i++)
+    {
+        crc = crc_table[0][(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/* Product of two field elements */
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    if(a == 0 || b == 0)
+    {
+        return 0;
+    }
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+/* Reduce a log sum modulo 255 */
+static int modnn(int x)
+{
+    return x % 255;
+}
+
+/* Fill a 256 entry product table and its nibble split for constant c */
+static void rs_fill_tables(unsigned char *full, unsigned char *nib, unsigned char c)
+{
+    for(int x = 0; x < 256; x++)
+    {
+        full[x] = gf_mul(x, c);
+    }
+    for(int x = 0; x < 16; x++)
+    {
+        nib[x] = gf_mul(x, c);
+        nib[16 + x] = gf_mul(x << 4, c);
+    }
+}
+
+/* Bit matrix of the product by c, for GF2P8AFFINEQB
+ * Description: byte 7 - i holds the input bits that make up
+ * bit i of the product
+ */
+static uint64_t rs_affine(unsigned char c)
+{
+    uint64_t matrix = 0;
+
+    for(int i = 0; i < 8; i++)
+    {
+        uint row = 0;
+        for(int j = 0; j < 8; j++)
+        {
+            row |= ((gf_mul(c, 1 << j) >> i) & 1) << j;
+        }
+        matrix |= (uint64_t)row << (8 * (7 - i));
+    }
+    return matrix;
+}
+
+/* Generator polynomial (x - alpha^0) ... (x - alpha^(nroots - 1)) and its tables */
+static void rs_build(RsCode *rs, uint nroots)
+{
+    unsigned char *g = rs -> genpoly;
+
+    rs -> nroots = nroots;
+    rs -> k = FEC_BLOCK_LEN - nroots;
+
+    memset(g, 0, sizeof(rs -> genpoly));
+    g[0] = 1;
+    for(uint i = 0; i < nroots; i++)
+    {
+        g[i + 1] = 1;
+        for(uint j = i; j > 0; j--)
+        {
+            g[j] = g[j - 1] ^ gf_mul(g[j], gf_exp[i]);
+        }
+        g[0] = gf_mul(g[0], gf_exp[i]);
+    }
+
+    for(uint i = 0; i < nroots; i++)
+    {
+        rs_fill_tables(rs -> gen_mul[i], rs -> gen_nib[i], g[nroots - 1 - i]);
+        rs_fill_tables(rs -> root_mul[i], rs -> root_nib[i], gf_exp[i]);
+        rs -> root_aff[i] = rs_affine(gf_exp[i]);
+    }
+}
+
+/* Shared code for nroots parity bytes (even, 2 to FEC_MAX_ROOTS), NULL if unsupported */
+const RsCode *rs_code_get(uint nroots)
+{
+    RsCode *rs;
+
+    if(nroots < 2 || nroots > FEC_MAX_ROOTS || nroots % 2 != 0)
+    {
+        return NULL;
+    }
+    pthread_once(&gf_once, gf_init);
+
+    pthread_mutex_lock(&rs_lock);
+    if((rs = rs_codes[nroots / 2]) == NULL && (rs = malloc(sizeof(RsCode))) != NULL)
+    {
+        rs_build(rs, nroots);
+        rs_codes[nroots / 2] = rs;
+    }
+    pthread_mutex_unlock(&rs_lock);
+    return rs;
+}
+
+/* Compute the parity of one codeword */
+void rs_encode(const RsCode *rs, const unsigned char *data, unsigned char *parity)
+{
+    uint nroots = rs -> nroots;
+
+    memset(parity, 0, nroots);
+    for(uint i = 0; i < rs -> k; i++)
+    {
+        // Shift register division by the generator
+        unsigned char fb = data[i] ^ parity[0];
+        for(uint t = 0; t + 1 < nroots; t++)
+        {
+            parity[t] = parity[t + 1] ^ rs -> gen_mul[t][fb];
+        }
+        parity[nroots - 1] = rs -> gen_mul[nroots - 1][fb];
+    }
+}
+
+/* Correct one codeword in place, eras lists known bad positions; returns bytes fixed, -1 if beyond repair
+ * Description: Berlekamp-Massey seeded with the erasure locator,
+ * Chien search for the error positions and Forney for the values
+ */
+int rs_decode(const RsCode *rs, unsigned char *block, const int *eras, int neras)
+{
+    const int nroots = rs -> nroots;
+    int lambda[FEC_MAX_ROOTS + 1], b[FEC_MAX_ROOTS + 1], t[FEC_MAX_ROOTS + 1];
+    int s[FEC_MAX_ROOTS], omega[FEC_MAX_ROOTS + 1], reg[FEC_MAX_ROOTS + 1];
+    int root[FEC_MAX_ROOTS], loc[FEC_MAX_ROOTS];
+    int syn_error = 0, count = 0, deg_lambda = 0;
+
+    if(neras > nroots)
+    {
+        return -1;
+    }
+
+    // Syndromes: the codeword evaluated at every root
+    for(int i = 0; i < nroots; i++)
+    {
+        uint v = block[0];
+        for(int j = 1; j < FEC_BLOCK_LEN; j++)
+        {
+            v = rs -> root_mul[i][v] ^ block[j];
+        }
+        syn_error |= v;
+        s[i] = gf_log[v];
+    }
+    if(syn_error == 0)
+    {
+        return 0;
+    }
+
+    // Erasure locator
+    memset(lambda, 0, sizeof(lambda));
+    lambda[0] = 1;
+    for(int i = 0; i < neras; i++)
+    {
+        int u = FEC_BLOCK_LEN - 1 - eras[i];
+        for(int j = i + 1; j > 0; j--)
+        {
+            if(lambda[j - 1] != 0)
+            {
+                lambda[j] ^= gf_exp[modnn(u + gf_log[lambda[j - 1]])];
+            }
+        }
+    }
+    for(int i = 0; i <= nroots; i++)
+    {
+        b[i] = gf_log[lambda[i]];
+    }
+
+    // Berlekamp-Massey, lambda in value form, b in log form
+    int el = neras;
+    for(int r = neras + 1; r <= nroots; r++)
+    {
+        int discr = 0;
+        for(int i = 0; i < r; i++)
+        {
+            if(lambda[i] != 0 && s[r - i - 1] != GF_A0)
+            {
+                discr ^= gf_exp[gf_log[lambda[i]] + s[r - i - 1]];
+            }
+        }
+        discr = gf_log[discr];
+
+        if(discr == GF_A0)
+        {
+            memmove(&b[1], b, nroots * sizeof(int));
+            b[0] = GF_A0;
+            continue;
+        }
+
+        t[0] = lambda[0];
+        for(int i = 0; i < nroots; i++)
+        {
+            t[i + 1] = b[i] != GF_A0 ? lambda[i + 1] ^ gf_exp[discr + b[i]] : lambda[i + 1];
+        }
+        if(2 * el <= r + neras - 1)
+        {
+            el = r + neras - el;
+            for(int i = 0; i <= nroots; i++)
+            {
+                b[i] = lambda[i] == 0 ? GF_A0 : modnn(gf_log[lambda[i]] - discr + 255);
+            }
+        }
+        else
+        {
+            memmove(&b[1], b, nroots * sizeof(int));
+            b[0] = GF_A0;
+        }
+        memcpy(lambda, t, (nroots + 1) * sizeof(int));
+    }
+
+    // Locator to log form
+    for(int i = 0; i <= nroots; i++)
+    {
+        lambda[i] = gf_log[lambda[i]];
+        if(lambda[i] != GF_A0)
+        {
+            deg_lambda = i;
+        }
+    }
+    if(deg_lambda == 0)
+    {
+        return -1;
+    }
+
+    // Chien search: alpha^i is a root when position i - 1 is bad
+    memcpy(&reg[1], &lambda[1], nroots * sizeof(int));
+    for(int i = 1; i <= FEC_BLOCK_LEN; i++)
+    {
+        int q = 1;
+        for(int j = deg_lambda; j > 0; j--)
+        {
+            if(reg[j] != GF_A0)
+            {
+                reg[j] = modnn(reg[j] + j);
+                q ^= gf_exp[reg[j]];
+            }
+        }
+        if(q != 0)
+        {
+            continue;
+        }
+        root[count] = i;
+        loc[count] = i - 1;
+        if(++count == deg_lambda)
+        {
+            break;
+        }
+    }
+    if(count != deg_lambda)
+    {
+        return -1;
+    }
+
+    // Error evaluator omega = s * lambda mod x^nroots
+    int deg_omega = deg_lambda - 1;
+    for(int i = 0; i <= deg_omega; i++)
+    {
+        int tmp = 0;
+        for(int j = i; j >= 0; j--)
+        {
+            if(s[i - j] != GF_A0 && lambda[j] != GF_A0)
+            {
+                tmp ^= gf_exp[s[i - j] + lambda[j]];
+            }
+        }
+        omega[i] = gf_log[tmp];
+    }
+
+    // Forney: value = X * omega(1 / X) / lambda'(1 / X)
+    for(int j = count - 1; j >= 0; j--)
+    {
+        int num1 = 0, den = 0;
+
+        for(int i = deg_omega; i >= 0; i--)
+        {
+            if(omega[i] != GF_A0)
+            {
+                num1 ^= gf_exp[modnn(omega[i] + i * root[j])];
+            }
+        }
+        for(int i = (deg_lambda < nroots - 1 ? deg_lambda : nroots - 1) & ~1; i >= 0; i -= 2)
+        {
+            if(lambda[i + 1] != GF_A0)
+            {
+                den ^= gf_exp[modnn(lambda[i + 1] + i * root[j])];
+            }
+        }
+        if(den == 0)
+        {
+            return -1;
+        }
+        if(num1 != 0)
+        {
+            int num2 = modnn(255 - root[j]);    // log of X
+            block[loc[j]] ^= gf_exp[modnn(gf_log[num1] + num2 + 255 - gf_log[den])];
+        }
+    }
+    return count;
+}
+
+#ifdef FEC_HAVE_SSSE3
+/* 16 products by one constant, from its nibble tables */
+static inline __attribute__((target("ssse3"), always_inline)) __m128i gf_mul16(__m128i v, __m128i lo, __m128i hi)
+{
+    __m128i mask = _mm_set1_epi8(0x0f);
+
+    return _mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(v, mask)),
+                         _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(v, 4), mask)));
+}
+
+/* Parity of 16 interleaved codewords, par[t] holds byte t of every parity */
+__attribute__((target("ssse3")))
+static void rs_encode16(const RsCode *rs, const unsigned char *lanes, unsigned char *par)
+{
+    __m128i p[FEC_MAX_ROOTS];
+    uint nroots = rs -> nroots;
+
+    for(uint t = 0; t < nroots; t++)
+    {
+        p[t] = _mm_setzero_si128();
+    }
+    for(uint j = 0; j < rs -> k; j++)
+    {
+        __m128i fb = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(lanes + j * 16)), p[0]);
+        for(uint t = 0; t + 1 < nroots; t++)
+        {
+            p[t] = _mm_xor_si128(p[t + 1], gf_mul16(fb, _mm_loadu_si128((const __m128i *)rs -> gen_nib[t]),
+                                                    _mm_loadu_si128((const __m128i *)(rs -> gen_nib[t] + 16))));
+        }
+        p[nroots - 1] = gf_mul16(fb, _mm_loadu_si128((const __m128i *)rs -> gen_nib[nroots - 1]),
+                                 _mm_loadu_si128((const __m128i *)(rs -> gen_nib[nroots - 1] + 16)));
+    }
+    for(uint t = 0; t < nroots; t++)
+    {
+        _mm_storeu_si128((__m128i *)(par + t * 16), p[t]);
+    }
+}
+
+/* Syndromes of 16 interleaved codewords, two roots per pass to keep two chains in flight */
+__attribute__((target("ssse3")))
+static void rs_syndromes16(const RsCode *rs, const unsigned char *lanes, unsigned char *syn)
+{
+    for(uint i = 0; i < rs -> nroots; i += 2)
+    {
+        __m128i lo0 = _mm_loadu_si128((const __m128i *)rs -> root_nib[i]);
+        __m128i hi0 = _mm_loadu_si128((const __m128i *)(rs -> root_nib[i] + 16));
+        __m128i lo1 = _mm_loadu_si128((const __m128i *)rs -> root_nib[i + 1]);
+        __m128i hi1 = _mm_loadu_si128((const __m128i *)(rs -> root_nib[i + 1] + 16));
+        __m128i s0 = _mm_loadu_si128((const __m128i *)lanes);
+        __m128i s1 = s0;
+
+        for(uint j = 1; j < FEC_BLOCK_LEN; j++)
+        {
+            __m128i row = _mm_loadu_si128((const __m128i *)(lanes + j * 16));
+            s0 = _mm_xor_si128(gf_mul16(s0, lo0, hi0), row);
+            s1 = _mm_xor_si128(gf_mul16(s1, lo1, hi1), row);
+        }
+        _mm_storeu_si128((__m128i *)(syn + i * 16), s0);
+        _mm_storeu_si128((__m128i *)(syn + (i + 1) * 16), s1);
+    }
+}
+
+/* Transpose 16 rows of 16 bytes, row c of the result goes to out + c * stride
+ * Description: four rounds of pairing row i with row i + 8
+ */
+__attribute__((target("ssse3")))
+static void fec_transpose16(const unsigned char *in, unsigned char *out, size_t stride, size_t rows)
+{
+    __m128i x[16], y[16];
+
+    for(int i = 0; i < 16; i++)
+    {
+        x[i] = _mm_loadu_si128((const __m128i *)(in + i * 16));
+    }
+    for(int round = 0; round < 4; round++)
+    {
+        for(int i = 0; i < 8; i++)
+        {
+            y[2 * i] = _mm_unpacklo_epi8(x[i], x[i + 8]);
+            y[2 * i + 1] = _mm_unpackhi_epi8(x[i], x[i + 8]);
+        }
+        memcpy(x, y, sizeof(x));
+    }
+    for(size_t c = 0; c < rows; c++)
+    {
+        _mm_storeu_si128((__m128i *)(out + c * stride), x[c]);
+    }
+}
+
+/* 32 products, the low lane by one constant and the high lane by another */
+static inline __attribute__((target("avx2"), always_inline)) __m256i gf_mul32(__m256i v, __m256i lo, __m256i hi)
+{
+    __m256i mask = _mm256_set1_epi8(0x0f);
+
+    return _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, mask)),
+                            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(v, 4), mask)));
+}
+
+/* Nibble tables of roots i and i + 1, one per lane */
+static inline __attribute__((target("avx2"), always_inline)) void gf_root_pair(const RsCode *rs, uint i, __m256i *lo, __m256i *hi)
+{
+    *lo = _mm256_set_m128i(_mm_loadu_si128((const __m128i *)rs -> root_nib[i + 1]), _mm_loadu_si128((const __m128i *)rs -> root_nib[i]));
+    *hi = _mm256_set_m128i(_mm_loadu_si128((const __m128i *)(rs -> root_nib[i + 1] + 16)), _mm_loadu_si128((const __m128i *)(rs -> root_nib[i] + 16)));
+}
+
+/* Syndromes of 16 interleaved codewords with AVX2
+ * Description: every row goes to both lanes, so one register
+ * runs the chains of two roots, and two registers four
+ */
+__attribute__((target("avx2")))
+static void rs_syndromes32(const RsCode *rs, const unsigned char *lanes, unsigned char *syn)
+{
+    uint i = 0;
+
+    for(; i + 4 <= rs -> nroots; i += 4)
+    {
+        __m256i lo0, hi0, lo1, hi1;
+        gf_root_pair(rs, i, &lo0, &hi0);
+        gf_root_pair(rs, i + 2, &lo1, &hi1);
+        __m256i s0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lanes));
+        __m256i s1 = s0;
+
+        for(uint j = 1; j < FEC_BLOCK_LEN; j++)
+        {
+            __m256i row = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(lanes + j * 16)));
+            s0 = _mm256_xor_si256(gf_mul32(s0, lo0, hi0), row);
+            s1 = _mm256_xor_si256(gf_mul32(s1, lo1, hi1), row);
+        }
+        _mm256_storeu_si256((__m256i *)(syn + i * 16), s0);
+        _mm256_storeu_si256((__m256i *)(syn + (i + 2) * 16), s1);
+    }
+    for(; i < rs -> nroots; i += 2)
+    {
+        __m256i lo0, hi0;
+        gf_root_pair(rs, i, &lo0, &hi0);
+        __m256i s0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lanes));
+
+        for(uint j = 1; j < FEC_BLOCK_LEN; j++)
+        {
+            __m256i row = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(lanes + j * 16)));
+            s0 = _mm256_xor_si256(gf_mul32(s0, lo0, hi0), row);
+        }
+        _mm256_storeu_si256((__m256i *)(syn + i * 16), s0);
+    }
+}
+
+/* Syndromes of 16 interleaved codewords with GFNI
+ * Description: one matrix product per two roots and row; the
+ * chains of eight roots run side by side to cover its latency,
+ * the last pass repeats the last pair when nroots is short
+ */
+__attribute__((target("gfni,avx2")))
+static void rs_syndromes_gfni(const RsCode *rs, const unsigned char *lanes, unsigned char *syn)
+{
+    uint nroots = rs -> nroots;
+
+    for(uint i = 0; i < nroots; i += 8)
+    {
+        uint p[4];
+        __m256i m[4], s[4];
+
+        for(int t = 0; t < 4; t++)
+        {
+            p[t] = i + 2 * t < nroots ? i + 2 * t : nroots - 2;
+            m[t] = _mm256_set_epi64x(rs -> root_aff[p[t] + 1], rs -> root_aff[p[t] + 1], rs -> root_aff[p[t]], rs -> root_aff[p[t]]);
+            s[t] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lanes));
+        }
+        for(uint j = 1; j < FEC_BLOCK_LEN; j++)
+        {
+            __m256i row = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(lanes + j * 16)));
+            s[0] = _mm256_xor_si256(_mm256_gf2p8affine_epi64_epi8(s[0], m[0], 0), row);
+            s[1] = _mm256_xor_si256(_mm256_gf2p8affine_epi64_epi8(s[1], m[1], 0), row);
+            s[2] = _mm256_xor_si256(_mm256_gf2p8affine_epi64_epi8(s[2], m[2], 0), row);
+            s[3] = _mm256_xor_si256(_mm256_gf2p8affine_epi64_epi8(s[3], m[3], 0), row);
+        }
+        for(int t = 0; t < 4; t++)
+        {
+            _mm256_storeu_si256((__m256i *)(syn + p[t] * 16), s[t]);
+        }
+    }
+}
+
+/* SIMD level, checked once: 0 none, 1 SSSE3, 2 AVX2, 3 AVX2 and GFNI */
+static int fec_simd(void)
+{
+    static int simd = -1;
+
+    if(simd < 0)
+    {
+        simd = !__builtin_cpu_supports("avx2") ? (__builtin_cpu_supports("ssse3") ? 1 : 0) : __builtin_cpu_supports("gfni") ? 3 : 2;
+    }
+    return simd;
+}
+#else
+static int fec_simd(void)
+{
+    return 0;
+}
+#endif
+
+/* Codewords in the next group, with bytes stream bytes still to code
+ * Description: groups are FEC_INTERLEAVE deep, except that the
+ * last two share what is left evenly, so the final group is never
+ * a lone codeword a burst could wipe out
+ */
+static size_t fec_group_codewords(const RsCode *rs, size_t bytes)
+{
+    size_t codewords = (bytes + rs -> k - 1) / rs -> k;
+
+    if(codewords <= FEC_INTERLEAVE)
+    {
+        return codewords;
+    }
+    if(codewords < 2 * FEC_INTERLEAVE)
+    {
+        return codewords - codewords / 2;
+    }
+    return FEC_INTERLEAVE;
+}
+
+/* Encode g codewords of data (k bytes each, back to back) into an interleaved group */
+static void fec_encode_group(const RsCode *rs, const unsigned char *data, size_t g, unsigned char *out)
+{
+    uint k = rs -> k;
+
+#ifdef FEC_HAVE_SSSE3
+    if(fec_simd())
+    {
+        unsigned char lanes[FEC_BLOCK_LEN * 16];
+        unsigned char par[FEC_MAX_ROOTS * 16];
+
+        // Transpose to one 16 byte row per position, unused lanes are zero
+        memset(lanes, 0, k * 16);
+        for(size_t c = 0; c < g; c++)
+        {
+            for(uint j = 0; j < k; j++)
+            {
+                lanes[j * 16 + c] = data[c * k + j];
+            }
+        }
+        rs_encode16(rs, lanes, par);
+
+        for(uint j = 0; j < FEC_BLOCK_LEN; j++)
+        {
+            memcpy(out + j * g, j < k ? lanes + j * 16 : par + (j - k) * 16, g);
+        }
+        return;
+    }
+#endif
+
+    for(size_t c = 0; c < g; c++)
+    {
+        unsigned char par[FEC_MAX_ROOTS];
+
+        rs_encode(rs, data + c * k, par);
+        for(uint j = 0; j < FEC_BLOCK_LEN; j++)
+        {
+            out[j * g + c] = j < k ? data[c * k + j] : par[j - k];
+        }
+    }
+}
+
+/* Correct an interleaved group of g codewords of which the first valid bytes arrived, payload to data */
+static Status fec_decode_group(const RsCode *rs, const unsigned char *group, size_t g, size_t valid, unsigned char *data, unsigned long *corrected)
+{
+    unsigned char buf[FEC_BLOCK_LEN * 16];
+    unsigned char syn[FEC_MAX_ROOTS * 16];
+    const unsigned char *lanes = group;
+    uint k = rs -> k;
+
+    // One 16 byte row per position, as a full group already is; unused lanes are zero
+    if(g < 16)
+    {
+        memset(buf, 0, sizeof(buf));
+        for(uint j = 0; j < FEC_BLOCK_LEN; j++)
+        {
+            memcpy(buf + j * 16, group + j * g, g);
+        }
+        lanes = buf;
+    }
+
+    // Cheap check first: which codewords have any non zero syndrome
+#ifdef FEC_HAVE_SSSE3
+    if(fec_simd() == 3)
+    {
+        rs_syndromes_gfni(rs, lanes, syn);
+    }
+    else if(fec_simd() == 2)
+    {
+        rs_syndromes32(rs, lanes, syn);
+    }
+    else if(fec_simd())
+    {
+        rs_syndromes16(rs, lanes, syn);
+    }
+    else
+#endif
+    {
+        for(uint i = 0; i < rs -> nroots; i++)
+        {
+            for(size_t c = 0; c < 16; c++)
+            {
+                uint v = lanes[c];
+                for(uint j = 1; j < FEC_BLOCK_LEN; j++)
+                {
+                    v = rs -> root_mul[i][v] ^ lanes[j * 16 + c];
+                }
+                syn[i * 16 + c] = v;
+            }
+        }
+    }
+
+    // Payload of every codeword as it arrived, the damaged ones are redone below
+    uint j0 = 0;
+#ifdef FEC_HAVE_SSSE3
+    if(fec_simd())
+    {
+        for(; j0 + 16 <= k; j0 += 16)
+        {
+            fec_transpose16(lanes + j0 * 16, data + j0, k, g);
+        }
+    }
+#endif
+    for(uint j = j0; j < k; j++)
+    {
+        for(size_t c = 0; c < g; c++)
+        {
+            data[c * k + j] = lanes[j * 16 + c];
+        }
+    }
+
+    for(size_t c = 0; c < g; c++)
+    {
+        int eras[FEC_MAX_ROOTS + 1];
+        int neras = 0;
+        uint bad = 0;
+
+        for(uint i = 0; i < rs -> nroots; i++)
+        {
+            bad |= syn[i * 16 + c];
+        }
+
+        // Positions past the end of what arrived are known to be missing
+        for(uint j = valid / g; valid < g * FEC_BLOCK_LEN && j < FEC_BLOCK_LEN && neras <= (int)rs -> nroots; j++)
+        {
+            if(j * g + c >= valid)
+            {
+                eras[neras++] = j;
+            }
+        }
+
+        if(bad != 0 || neras > 0)
+        {
+            unsigned char block[FEC_BLOCK_LEN];
+            int fixed;
+
+            for(uint j = 0; j < FEC_BLOCK_LEN; j++)
+            {
+                block[j] = lanes[j * 16 + c];
+            }
+            if((fixed = rs_decode(rs, block, eras, neras)) < 0)
+            {
+                return e_failure;
+            }
+            *corrected += fixed;
+            memcpy(data + c * k, block, k);
+        }
+    }
+    return e_success;
+}
+
+/* Coded bytes for length payload bytes, including the length copies */
+size_t fec_stream_size(const RsCode *rs, size_t length)
+{
+    return FEC_LENGTH_BYTES + (length + FEC_CRC_BYTES + rs -> k - 1) / rs -> k * FEC_BLOCK_LEN;
+}
+
+/* Start encoding length payload bytes, emits the length copies */
+Status fec_stream_begin(FecStream *fs, const RsCode *rs, size_t length, FecSink sink, void *arg)
+{
+    unsigned char copies[FEC_LENGTH_BYTES];
+
+    fs -> rs = rs;
+    fs -> length = length;
+    fs -> remaining = length + FEC_CRC_BYTES;
+    fs -> fill = 0;
+    fs -> avail = 0;
+    fs -> out = 0;
+    fs -> skipped = 0;
+    fs -> crc = 0;
+    fs -> corrected = 0;
+
+    for(int i = 0; i < FEC_LENGTH_COPIES; i++)
+    {
+        copies[i * 4] = length >> 24;
+        copies[i * 4 + 1] = length >> 16;
+        copies[i * 4 + 2] = length >> 8;
+        copies[i * 4 + 3] = length;
+    }
+    return sink(arg, copies, sizeof(copies));
+}
+
+/* Code len stream bytes, emitting every group that fills up (and the last one) */
+static Status fec_stream_push(FecStream *fs, const unsigned char *data, size_t len, FecSink sink, void *arg)
+{
+    const RsCode *rs = fs -> rs;
+
+    while(len > 0)
+    {
+        // What is left to code stays the same while a group fills
+        size_t cap = fec_group_codewords(rs, fs -> remaining + fs -> fill) * rs -> k;
+        size_t n = cap - fs -> fill < len ? cap - fs -> fill : len;
+
+        memcpy(fs -> data + fs -> fill, data, n);
+        fs -> fill += n;
+        fs -> remaining -= n;
+        data += n;
+        len -= n;
+
+        if(fs -> fill == cap || fs -> remaining == 0)
+        {
+            // Pad the last codeword with zeros
+            size_t g = (fs -> fill + rs -> k - 1) / rs -> k;
+            memset(fs -> data + fs -> fill, 0, g * rs -> k - fs -> fill);
+
+            fec_encode_group(rs, fs -> data, g, fs -> group);
+            fs -> fill = 0;
+            if(sink(arg, fs -> group, g * FEC_BLOCK_LEN) == e_failure)
+            {
+                return e_failure;
+            }
+        }
+    }
+    return e_success;
+}
+
+/* Take len payload bytes, the CRC follows the last one */
+Status fec_stream_put(FecStream *fs, const unsigned char *data, size_t len, FecSink sink, void *arg)
+{
+    unsigned char crc[FEC_CRC_BYTES];
+
+    if(len > fs -> remaining - FEC_CRC_BYTES)
+    {
+        return e_failure;
+    }
+
+    fs -> crc = fec_crc32(fs -> crc, data, len);
+    if(fec_stream_push(fs, data, len, sink, arg) == e_failure)
+    {
+        return e_failure;
+    }
+
+    if(fs -> remaining == FEC_CRC_BYTES)
+    {
+        crc[0] = fs -> crc >> 24;
+        crc[1] = fs -> crc >> 16;
+        crc[2] = fs -> crc >> 8;
+        crc[3] = fs -> crc;
+        return fec_stream_push(fs, crc, sizeof(crc), sink, arg);
+    }
+    return e_success;
+}
+
+/* Start decoding, recovers the payload length from its copies */
+Status fec_stream_open(FecStream *fs, const RsCode *rs, FecSource source, void *arg)
+{
+    unsigned char copies[FEC_LENGTH_BYTES];
+    size_t length = 0;
+
+    if(source(arg, copies, sizeof(copies)) != sizeof(copies))
+    {
+        return e_failure;
+    }
+
+    // Bitwise majority of three copies
+    for(int i = 0; i < 4; i++)
+    {
+        unsigned char a = copies[i], b = copies[4 + i], c = copies[8 + i];
+        length = (length << 8) | ((a & b) | (a & c) | (b & c));
+    }
+
+    fs -> rs = rs;
+    fs -> length = length;
+    fs -> remaining = length + FEC_CRC_BYTES;
+    fs -> fill = 0;
+    fs -> avail = 0;
+    fs -> out = 0;
+    fs -> skipped = 0;
+    fs -> crc = 0;
+    fs -> corrected = 0;
+    return e_success;
+}
+
+/* Hand out up to len decoded stream bytes, returns how many were recovered */
+static size_t fec_stream_pull(FecStream *fs, unsigned char *data, size_t len, FecSource source, void *arg)
+{
+    const RsCode *rs = fs -> rs;
+    size_t done = 0;
+
+    while(done < len)
+    {
+        // Decode the next group once this one is used up
+        if(fs -> fill == fs -> avail)
+        {
+            if(fs -> remaining == 0)
+            {
+                break;
+            }
+
+            size_t g = fec_group_codewords(rs, fs -> remaining);
+            size_t valid = source(arg, fs -> group, g * FEC_BLOCK_LEN);
+
+            if(fec_decode_group(rs, fs -> group, g, valid, fs -> data, &fs -> corrected) == e_failure)
+            {
+                break;
+            }
+            fs -> avail = fs -> remaining < g * rs -> k ? fs -> remaining : g * rs -> k;
+            fs -> remaining -= fs -> avail;
+            fs -> fill = 0;
+        }
+
+        size_t n = fs -> avail - fs -> fill < len - done ? fs -> avail - fs -> fill : len - done;
+        memcpy(data + done, fs -> data + fs -> fill, n);
+        fs -> fill += n;
+        done += n;
+    }
+    return done;
+}
+
+/* Hand out up to len corrected payload bytes, returns how many were recovered
+ * Description: once the last payload byte is out the CRC is checked,
+ * and on a mismatch nothing of that call counts as recovered
+ */
+size_t fec_stream_get(FecStream *fs, unsigned char *data, size_t len, FecSource source, void *arg)
+{
+    unsigned char crc[FEC_CRC_BYTES];
+
+    if(len > fs -> length - fs -> out)
+    {
+        len = fs -> length - fs -> out;
+    }
+
+    size_t done = fec_stream_pull(fs, data, len, source, arg);
+    fs -> crc = fec_crc32(fs -> crc, data, done);
+    fs -> out += done;
+
+    if(fs -> out == fs -> length && done > 0 && !fs -> skipped)
+    {
+        if(fec_stream_pull(fs, crc, sizeof(crc), source, arg) != sizeof(crc) ||
+           lsb_load_be32(crc) != fs -> crc)
+        {
+            return 0;
+        }
+    }
+    return done;
+}
+
+/* Pass over len payload bytes, skipping whole groups without decoding them
+ * Description: only the group the skip ends in is decoded;
+ * the stream CRC no longer covers what is handed out, so
+ * the caller checks the bytes it is after itself
+ */
+Status fec_stream_skip(FecStream *fs, size_t len, FecSource source, FecSkip skip, void *arg)
+{
+    const RsCode *rs = fs -> rs;
+    unsigned char drop[256];
+    size_t blind = 0;
+
+    if(len > fs -> length - fs -> out)
+    {
+        return e_failure;
+    }
+    fs -> skipped = 1;
+    fs -> out += len;
+
+    // Rest of the group already decoded
+    size_t n = fs -> avail - fs -> fill < len ? fs -> avail - fs -> fill : len;
+    fs -> fill += n;
+    len -= n;
+
+    // Groups the skip passes over whole are skipped blind
+    while(fs -> fill == fs -> avail)
+    {
+        size_t g = fec_group_codewords(rs, fs -> remaining);
+        size_t bytes = fs -> remaining < g * rs -> k ? fs -> remaining : g * rs -> k;
+
+        if(bytes == 0 || len < bytes)
+        {
+            break;
+        }
+        blind += g * FEC_BLOCK_LEN;
+        fs -> remaining -= bytes;
+        len -= bytes;
+    }
+    if(blind > 0 && skip(arg, blind) == e_failure)
+    {
+        return e_failure;
+    }
+
+    // Decode the group the skip ends in
+    while(len > 0)
+    {
+        n = len < sizeof(drop) ? len : sizeof(drop);
+        if(fec_stream_pull(fs, drop, n, source, arg) != n)
+        {
+            return e_failure;
+        }
+        len -= n;
+    }
+    return e_success;
+}
@@ -0,0 +1,106 @@
+#ifndef FEC_H
+#define FEC_H
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Reed-Solomon forward error correction over GF(256).
+ * Codewords are 255 bytes: 255 - nroots payload bytes and
+ * nroots parity bytes, correcting nroots / 2 bad bytes, or
+ * up to nroots bytes that are known to be missing.
+ *
+ * The payload is cut into groups of FEC_INTERLEAVE codewords
+ * that are interleaved byte by byte, so damage to a run of
+ * carrier bytes is spread over every codeword of its group.
+ * Groups are coded one at a time, so decoding streams with a
+ * fixed amount of memory. The payload length goes first,
+ * FEC_LENGTH_COPIES times, and is recovered by majority vote.
+ * A CRC-32 of the payload is coded after it, so a codeword
+ * the decoder "repairs" into the wrong one is still caught.
+ *
+ * Group syndromes and parity use SSSE3 table lookups on x86
+ * when the CPU has them, 16 codewords at once, and plain
+ * tables otherwise; syndromes run two roots per register with
+ * AVX2, as GFNI bit matrix products where there is GFNI. Only
+ * codewords with a non zero syndrome go through the (scalar)
+ * error locator, so an undamaged group costs its syndromes.
+ */
+
+#define FEC_BLOCK_LEN 255           // Bytes per codeword
+#define FEC_MAX_ROOTS 64            // Largest supported parity size
+#define FEC_DEFAULT_ROOTS 32        // RS(255, 223)
+#define FEC_INTERLEAVE 16           // Codewords per group
+#define FEC_LENGTH_COPIES 3         // Copies of the payload length
+#define FEC_LENGTH_BYTES (4 * FEC_LENGTH_COPIES)
+#define FEC_CRC_BYTES 4             // CRC-32 after the payload
+
+/* One Reed-Solomon code and its multiply tables */
+typedef struct _RsCode
+{
+    uint nroots;                                    // Parity bytes per codeword
+    uint k;                                         // Payload bytes per codeword
+    unsigned char genpoly[FEC_MAX_ROOTS + 1];       // Generator polynomial, genpoly[0] is the constant term
+    unsigned char gen_mul[FEC_MAX_ROOTS][256];      // x * genpoly[nroots - 1 - i]
+    unsigned char root_mul[FEC_MAX_ROOTS][256];     // x * alpha^i
+    unsigned char gen_nib[FEC_MAX_ROOTS][32];       // Same products by low / high nibble
+    unsigned char root_nib[FEC_MAX_ROOTS][32];
+    uint64_t root_aff[FEC_MAX_ROOTS];               // x * alpha^i as a GFNI bit matrix
+} RsCode;
+
+/* Emits coded bytes into the carrier */
+typedef Status (*FecSink)(void *arg, const unsigned char *bytes, size_t len);
+
+/* Fetches coded bytes from the carrier, returns how many were really there (the rest is zeroed) */
+typedef size_t (*FecSource)(void *arg, unsigned char *bytes, size_t len);
+
+/* Moves the carrier past len coded bytes without reading them */
+typedef Status (*FecSkip)(void *arg, size_t len);
+
+/* Payload running through the code, one group at a time */
+typedef struct _FecStream
+{
+    const RsCode *rs;
+    size_t length;                  // Payload bytes in the whole stream
+    size_t remaining;               // Coded stream bytes (payload and CRC) not yet taken in / decoded
+    size_t fill;                    // Encode: bytes in data, decode: bytes of data handed out
+    size_t avail;                   // Decode: stream bytes decoded into data
+    size_t out;                     // Decode: payload bytes handed out or skipped
+    int skipped;                    // Decode: payload was skipped, so the CRC cannot be checked
+    uint32_t crc;                   // CRC-32 of the payload so far
+    unsigned long corrected;        // Bytes repaired so far
+    unsigned char data[FEC_INTERLEAVE * FEC_BLOCK_LEN];     // Payload of the group, codeword after codeword
+    unsigned char group[FEC_INTERLEAVE * FEC_BLOCK_LEN];    // Interleaved codewords
+} FecStream;
+
+/* Running CRC-32 (IEEE) of len bytes, start from 0 */
+uint32_t fec_crc32(uint32_t crc, const unsigned char *data, size_t len);
+
+/* Shared code for nroots parity bytes (even, 2 to FEC_MAX_ROOTS), NULL if unsupported */
+const RsCode *rs_code_get(uint nroots);
+
+/* Compute the parity of one codeword */
+void rs_encode(const RsCode *rs, const unsigned char *data, unsigned char *parity);
+
+/* Correct one codeword in place, eras lists known bad positions; returns bytes fixed, -1 if beyond repair */
+int rs_decode(const RsCode *rs, unsigned char *block, const int *eras, int neras);
+
+/* Coded bytes for length payload bytes, including the length copies */
+size_t fec_stream_size(const RsCode *rs, size_t length);
+
+/* Start encoding length payload bytes, emits the length copies */
+Status fec_stream_begin(FecStream *fs, const RsCode *rs, size_t length, FecSink sink, void *arg);
+
+/* Take len payload bytes, emitting every group that fills up (and the last one with the CRC) */
+Status fec_stream_put(FecStream *fs, const unsigned char *data, size_t len, FecSink sink, void *arg);
+
+/* Start decoding, recovers the payload length from its copies */
+Status fec_stream_open(FecStream *fs, const RsCode *rs, FecSource source, void *arg);
+
+/* Hand out up to len corrected payload bytes, returns how many were recovered (none on a CRC mismatch) */
+size_t fec_stream_get(FecStream *fs, unsigned char *data, size_t len, FecSource source, void *arg);
+
+/* Pass over len payload bytes, skipping whole groups without decoding them */
+Status fec_stream_skip(FecStream *fs, size_t len, FecSource source, FecSkip skip, void *arg);
+
+#endif
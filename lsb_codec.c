@@ -0,0 +1,347 @@
+#include <stdint.h>
+#include <string.h>
+#include "lsb_codec.h"
+#include "types.h"
+
+#define LSB_INLINE static inline __attribute__((always_inline))
+
+/* Function Definitions */
+
+/* Generic embed kernel, only ever called with constant layout arguments */
+LSB_INLINE size_t embed_kernel(unsigned char *carrier, size_t phase, const unsigned char *data, size_t len,
+                               const uint bits, const uint bpp, const uint mask, const int lsb_first)
+{
+    const uint full = (1u << bpp) - 1;
+    const uint value_mask = (1u << bits) - 1;
+    size_t j = 0;           // Carrier byte index
+    uint ch = phase;        // Channel of carrier[j]
+
+    for(size_t i = 0; i < len; i++)
+    {
+        // 8 / bits groups per data byte, unrolled
+        for(uint b = 0; b < 8; b += bits)
+        {
+            if((mask & full) != full)
+            {
+                // Skip channels that carry no data
+                while(!((mask >> ch) & 1))
+                {
+                    j++;
+                    ch = ch + 1 == bpp ? 0 : ch + 1;
+                }
+            }
+
+            uint value = lsb_first ? (data[i] >> b) & value_mask : (data[i] >> (8 - bits - b)) & value_mask;
+            carrier[j] = (carrier[j] & ~value_mask) | value;
+            j++;
+            if((mask & full) != full)
+            {
+                ch = ch + 1 == bpp ? 0 : ch + 1;
+            }
+        }
+    }
+    return j;
+}
+
+/* Generic extract kernel, only ever called with constant layout arguments */
+LSB_INLINE size_t extract_kernel(const unsigned char *carrier, size_t phase, unsigned char *data, size_t len,
+                                 const uint bits, const uint bpp, const uint mask, const int lsb_first)
+{
+    const uint full = (1u << bpp) - 1;
+    const uint value_mask = (1u << bits) - 1;
+    size_t j = 0;           // Carrier byte index
+    uint ch = phase;        // Channel of carrier[j]
+
+    for(size_t i = 0; i < len; i++)
+    {
+        uint byte = 0;
+
+        // 8 / bits groups per data byte, unrolled
+        for(uint b = 0; b < 8; b += bits)
+        {
+            if((mask & full) != full)
+            {
+                // Skip channels that carry no data
+                while(!((mask >> ch) & 1))
+                {
+                    j++;
+                    ch = ch + 1 == bpp ? 0 : ch + 1;
+                }
+            }
+
+            uint value = carrier[j] & value_mask;
+            byte |= lsb_first ? value << b : value << (8 - bits - b);
+            j++;
+            if((mask & full) != full)
+            {
+                ch = ch + 1 == bpp ? 0 : ch + 1;
+            }
+        }
+        data[i] = byte;
+    }
+    return j;
+}
+
+/* Original layout, 8 carrier bytes per data byte handled as one 64 bit word */
+static size_t embed_default(unsigned char *carrier, size_t phase, const unsigned char *data, size_t len)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    (void)phase;
+    for(size_t i = 0; i < len; i++)
+    {
+        uint64_t group;
+
+        // Copy the byte into every lane, keep bit 7 - k in lane k, then squash each lane to 0 / 1
+        uint64_t lanes = (data[i] * 0x0101010101010101ULL) & 0x0102040810204080ULL;
+        uint64_t bits = ((lanes + 0x7F7F7F7F7F7F7F7FULL) >> 7) & 0x0101010101010101ULL;
+
+        memcpy(&group, carrier + i * 8, 8);
+        group = (group & ~0x0101010101010101ULL) | bits;
+        memcpy(carrier + i * 8, &group, 8);
+    }
+    return len * 8;
+#else
+    return embed_kernel(carrier, phase, data, len, 1, 4, LSB_CHANNEL_ALL, 0);
+#endif
+}
+
+/* Original layout, the 8 LSBs of a word are gathered by one multiply */
+static size_t extract_default(const unsigned char *carrier, size_t phase, unsigned char *data, size_t len)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    (void)phase;
+    for(size_t i = 0; i < len; i++)
+    {
+        uint64_t group;
+
+        memcpy(&group, carrier + i * 8, 8);
+        data[i] = ((group & 0x0101010101010101ULL) * 0x8040201008040201ULL) >> 56;
+    }
+    return len * 8;
+#else
+    return extract_kernel(carrier, phase, data, len, 1, 4, LSB_CHANNEL_ALL, 0);
+#endif
+}
+
+const LsbCodec lsb_codec_default = {
+    .layout = { .bits = 1, .bytes_per_pixel = 0, .channel_mask = LSB_CHANNEL_ALL, .lsb_first = 0 },
+    .embed = embed_default,
+    .extract = extract_default
+};
+
+/* Stamp out one embed / extract pair per layout */
+#define LSB_NAME(KIND, BITS, BPP, MASK, LSBF) KIND##_##BITS##_##BPP##_##MASK##_##LSBF
+
+#define LSB_DEFINE(BITS, BPP, MASK, LSBF) \
+    static size_t LSB_NAME(embed, BITS, BPP, MASK, LSBF)(unsigned char *carrier, size_t phase, const unsigned char *data, size_t len) \
+    { \
+        return embed_kernel(carrier, phase, data, len, BITS, BPP, MASK, LSBF); \
+    } \
+    static size_t LSB_NAME(extract, BITS, BPP, MASK, LSBF)(const unsigned char *carrier, size_t phase, unsigned char *data, size_t len) \
+    { \
+        return extract_kernel(carrier, phase, data, len, BITS, BPP, MASK, LSBF); \
+    }
+
+#define LSB_ENTRY(BITS, BPP, MASK, LSBF) \
+    { .layout = { .bits = BITS, .bytes_per_pixel = BPP, .channel_mask = MASK, .lsb_first = LSBF }, \
+      .embed = LSB_NAME(embed, BITS, BPP, MASK, LSBF), .extract = LSB_NAME(extract, BITS, BPP, MASK, LSBF) },
+
+/* Every non-empty subset of blue, green and red */
+#define LSB_MASKS(X, BITS, BPP, LSBF) \
+    X(BITS, BPP, 1, LSBF) X(BITS, BPP, 2, LSBF) X(BITS, BPP, 3, LSBF) X(BITS, BPP, 4, LSBF) \
+    X(BITS, BPP, 5, LSBF) X(BITS, BPP, 6, LSBF) X(BITS, BPP, 7, LSBF)
+
+/* Layouts that use only some channels depend on pixel size */
+#define LSB_MASKED_LAYOUTS(X) \
+    LSB_MASKS(X, 1, 3, 0) LSB_MASKS(X, 1, 3, 1) LSB_MASKS(X, 1, 4, 0) LSB_MASKS(X, 1, 4, 1) \
+    LSB_MASKS(X, 2, 3, 0) LSB_MASKS(X, 2, 3, 1) LSB_MASKS(X, 2, 4, 0) LSB_MASKS(X, 2, 4, 1)
+
+/* Layouts that use every channel do not (bpp 4 here only sizes the kernel's mask) */
+#define LSB_FULL_LAYOUTS(X) \
+    X(1, 4, 15, 1) X(2, 4, 15, 0) X(2, 4, 15, 1)
+
+LSB_MASKED_LAYOUTS(LSB_DEFINE)
+LSB_FULL_LAYOUTS(LSB_DEFINE)
+
+static const LsbCodec lsb_masked_codecs[] = { LSB_MASKED_LAYOUTS(LSB_ENTRY) };
+static const LsbCodec lsb_full_codecs[] = { LSB_FULL_LAYOUTS(LSB_ENTRY) };
+
+/* Find the specialised codec for a layout, NULL if not supported */
+const LsbCodec *lsb_codec_lookup(const LsbLayout *layout)
+{
+    // Original layout works on any pixel size
+    if(layout -> bits == 1 && layout -> channel_mask == LSB_CHANNEL_ALL && layout -> lsb_first == 0)
+    {
+        return &lsb_codec_default;
+    }
+
+    if(layout -> bytes_per_pixel != 3 && layout -> bytes_per_pixel != 4)
+    {
+        return NULL;
+    }
+
+    uint full = (1u << layout -> bytes_per_pixel) - 1;
+    uint mask = layout -> channel_mask & full;
+
+    // Every channel used: pixel size does not matter
+    if(mask == full)
+    {
+        if(layout -> bits == 1 && layout -> lsb_first == 0)
+        {
+            return &lsb_codec_default;
+        }
+        for(size_t i = 0; i < sizeof(lsb_full_codecs) / sizeof(lsb_full_codecs[0]); i++)
+        {
+            if(lsb_full_codecs[i].layout.bits == layout -> bits && lsb_full_codecs[i].layout.lsb_first == layout -> lsb_first)
+            {
+                return &lsb_full_codecs[i];
+            }
+        }
+        return NULL;
+    }
+
+    for(size_t i = 0; i < sizeof(lsb_masked_codecs) / sizeof(lsb_masked_codecs[0]); i++)
+    {
+        const LsbLayout *cand = &lsb_masked_codecs[i].layout;
+
+        if(cand -> bits == layout -> bits && cand -> bytes_per_pixel == layout -> bytes_per_pixel &&
+           cand -> channel_mask == mask && cand -> lsb_first == layout -> lsb_first)
+        {
+            return &lsb_masked_codecs[i];
+        }
+    }
+    return NULL;
+}
+
+/* Carrier bytes needed to hold len data bytes, starting at phase */
+size_t lsb_carrier_bytes(const LsbCodec *codec, size_t phase, size_t len)
+{
+    const LsbLayout *layout = &codec -> layout;
+    size_t units = len * 8 / layout -> bits;    // Carrier bytes that receive data
+    uint bpp = layout -> bytes_per_pixel;
+    uint full = (1u << bpp) - 1;
+    size_t j = 0;
+    uint ch = phase;
+
+    if(bpp == 0 || (layout -> channel_mask & full) == full)
+    {
+        return units;
+    }
+
+    // Finish the pixel the range starts in
+    while(units > 0 && ch != 0)
+    {
+        units -= (layout -> channel_mask >> ch) & 1;
+        j++;
+        ch = ch + 1 == bpp ? 0 : ch + 1;
+    }
+    if(units == 0)
+    {
+        return j;
+    }
+
+    // Whole pixels, leaving at least one unit for the last pixel
+    uint per_pixel = __builtin_popcount(layout -> channel_mask & full);
+    size_t pixels = (units - 1) / per_pixel;
+    j += pixels * bpp;
+    units -= pixels * per_pixel;
+
+    // Last pixel ends right after its final used channel
+    for(ch = 0; units > 0; ch++)
+    {
+        units -= (layout -> channel_mask >> ch) & 1;
+        j++;
+    }
+    return j;
+}
+
+/* 1 when the layout's channels stay colours on rows of width pixels: all are used, or rows have no padding
+ * Description: padding bytes at the end of a row would shift
+ * the byte positions of the channels in every row after it
+ */
+int lsb_channels_fit_rows(const LsbLayout *layout, uint width)
+{
+    uint bpp = layout -> bytes_per_pixel;
+    uint all = (1u << bpp) - 1;
+
+    return bpp == 0 || (layout -> channel_mask & all) == all || (width * bpp) % 4 == 0;
+}
+
+/* Data bytes that fit whole in carrier carrier bytes, starting at phase */
+size_t lsb_data_bytes(const LsbCodec *codec, size_t phase, size_t carrier)
+{
+    const LsbLayout *layout = &codec -> layout;
+    uint bpp = layout -> bytes_per_pixel;
+    uint used = bpp;    // Carrier bytes per pixel that take data
+    size_t len;
+
+    if(bpp == 0 || (layout -> channel_mask & ((1u << bpp) - 1)) == ((1u << bpp) - 1))
+    {
+        bpp = used = 1;
+    }
+    else
+    {
+        used = __builtin_popcount(layout -> channel_mask & ((1u << bpp) - 1));
+    }
+
+    // Round the estimate up, then step down to what really fits
+    len = carrier / bpp * used * layout -> bits / 8 + used;
+    while(len > 0 && lsb_carrier_bytes(codec, phase, len) > carrier)
+    {
+        len--;
+    }
+    return len;
+}
+
+/* Phase of the carrier byte at offset bytes into pixel data */
+size_t lsb_phase(const LsbCodec *codec, size_t offset)
+{
+    uint bpp = codec -> layout.bytes_per_pixel;
+
+    return bpp != 0 ? offset % bpp : 0;
+}
+
+/* Pack a layout into its layout word (pixel size is not stored) */
+uint lsb_layout_to_word(const LsbLayout *layout)
+{
+    uint word = layout -> bits & LSB_WORD_BITS_MASK;
+
+    if(layout -> lsb_first)
+    {
+        word |= LSB_WORD_LSB_FIRST;
+    }
+    word |= (layout -> channel_mask & 0xF) << LSB_WORD_CHANNEL_SHIFT;
+    word |= (layout -> adaptive & 0xF) << LSB_WORD_ADAPTIVE_SHIFT;
+    word |= (layout -> fec & 0xFF) << LSB_WORD_FEC_SHIFT;
+    if(layout -> container)
+    {
+        word |= LSB_WORD_CONTAINER;
+    }
+    return word;
+}
+
+/* Unpack a layout word, pixel size comes from the image header */
+void lsb_layout_from_word(LsbLayout *layout, uint word, uint bytes_per_pixel)
+{
+    layout -> bits = word & LSB_WORD_BITS_MASK;
+    layout -> bytes_per_pixel = bytes_per_pixel;
+    layout -> channel_mask = (word >> LSB_WORD_CHANNEL_SHIFT) & 0xF;
+    layout -> lsb_first = (word & LSB_WORD_LSB_FIRST) != 0;
+    layout -> adaptive = (word >> LSB_WORD_ADAPTIVE_SHIFT) & 0xF;
+    layout -> fec = (word >> LSB_WORD_FEC_SHIFT) & 0xFF;
+    layout -> container = (word & LSB_WORD_CONTAINER) != 0;
+}
+
+/* Big endian 32 bit fields, as the original format stores its sizes */
+void lsb_store_be32(unsigned char *buf, uint value)
+{
+    buf[0] = value >> 24;
+    buf[1] = value >> 16;
+    buf[2] = value >> 8;
+    buf[3] = value;
+}
+
+uint lsb_load_be32(const unsigned char *buf)
+{
+    return ((uint)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
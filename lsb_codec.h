@@ -0,0 +1,92 @@
+#ifndef LSB_CODEC_H
+#define LSB_CODEC_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Specialised LSB kernels.
+ * Every supported layout (bits per channel, bytes per pixel,
+ * channel mask, bit order) gets its own embed / extract pair,
+ * stamped out from one always-inline kernel with the layout
+ * as compile time constants, so the inner loops are fully
+ * unrolled with no per-bit branches. A job looks its codec
+ * up once and then only calls through the pointers.
+ *
+ * "phase" is the channel of the first carrier byte, i.e. its
+ * offset from the start of pixel data modulo bytes per pixel.
+ * Pixel data is treated as one stream, so a channel is a colour
+ * only while rows carry no padding (width * bytes per pixel a
+ * multiple of 4); a channel mask is refused on padded images,
+ * see lsb_channels_fit_rows().
+ */
+
+/* Channel masks, bit n selects byte n of a pixel (BMP stores B, G, R, A), counted from the start of pixel data */
+#define LSB_CHANNEL_BLUE  0x1
+#define LSB_CHANNEL_GREEN 0x2
+#define LSB_CHANNEL_RED   0x4
+#define LSB_CHANNEL_ALL   0xF   // Every channel of the pixel, whatever its size
+
+/* Layout word stored after MAGIC_STRING_EXT */
+#define LSB_WORD_BITS_MASK      0x0000000F  // Bits per carrier byte
+#define LSB_WORD_LSB_FIRST      0x00000010  // Data bytes stored LSB first
+#define LSB_WORD_CHANNEL_SHIFT  8           // Channel mask, 4 bits
+#define LSB_WORD_ADAPTIVE_SHIFT 12          // Texture level, 4 bits, 0 when not adaptive
+#define LSB_WORD_FEC_SHIFT      16          // Reed-Solomon parity bytes, 8 bits, 0 without FEC
+#define LSB_WORD_CONTAINER      0x01000000  // Payload is a container index and its entries
+
+/* Carrier bytes taken by MAGIC_STRING_EXT and the layout word */
+#define LSB_EXT_HEADER_BYTES    48
+
+typedef struct _LsbLayout
+{
+    uint bits;              // Bits stored per carrier byte (1 or 2)
+    uint bytes_per_pixel;   // 3 for 24 bpp, 4 for 32 bpp
+    uint channel_mask;      // LSB_CHANNEL_* bits of channels that carry data
+    uint lsb_first;         // 0: MSB of each data byte first (original format), 1: LSB first
+    uint adaptive;          // Texture level, 0: every carrier byte is used (not part of the codec)
+    uint fec;               // Parity bytes per codeword, 0: no FEC (not part of the codec)
+    uint container;         // 1: payload is a container of several files (not part of the codec)
+} LsbLayout;
+
+/* Store len data bytes into carrier, returns carrier bytes used */
+typedef size_t (*LsbEmbedFn)(unsigned char *carrier, size_t phase, const unsigned char *data, size_t len);
+
+/* Collect len data bytes from carrier, returns carrier bytes used */
+typedef size_t (*LsbExtractFn)(const unsigned char *carrier, size_t phase, unsigned char *data, size_t len);
+
+typedef struct _LsbCodec
+{
+    LsbLayout layout;
+    LsbEmbedFn embed;
+    LsbExtractFn extract;
+} LsbCodec;
+
+/* Original layout: 1 bit in every byte, MSB first */
+extern const LsbCodec lsb_codec_default;
+
+/* Find the specialised codec for a layout, NULL if not supported */
+const LsbCodec *lsb_codec_lookup(const LsbLayout *layout);
+
+/* 1 when the layout's channels stay colours on rows of width pixels: all are used, or rows have no padding */
+int lsb_channels_fit_rows(const LsbLayout *layout, uint width);
+
+/* Carrier bytes needed to hold len data bytes, starting at phase */
+size_t lsb_carrier_bytes(const LsbCodec *codec, size_t phase, size_t len);
+
+/* Data bytes that fit whole in carrier carrier bytes, starting at phase */
+size_t lsb_data_bytes(const LsbCodec *codec, size_t phase, size_t carrier);
+
+/* Phase of the carrier byte at offset bytes into pixel data */
+size_t lsb_phase(const LsbCodec *codec, size_t offset);
+
+/* Pack a layout into its layout word (pixel size is not stored) */
+uint lsb_layout_to_word(const LsbLayout *layout);
+
+/* Unpack a layout word, pixel size comes from the image header */
+void lsb_layout_from_word(LsbLayout *layout, uint word, uint bytes_per_pixel);
+
+/* Big endian 32 bit fields, as the original format stores its sizes */
+void lsb_store_be32(unsigned char *buf, uint value);
+uint lsb_load_be32(const unsigned char *buf);
+
+#endif
@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include "encode.h"
 #include "decode.h"
+#include "stegd.h"
+#include "analyze.h"
+#include "sequence.h"
+#include "report.h"
 #include "types.h"
+#include <stdlib.h>
 #include <string.h>
 
 /* Check operation type */
@@ -15,6 +20,42 @@ OperationType check_operation_type(char *argv[])
     {
         return e_decode;                // Return decode operation type
     }
+    else if(strcmp(argv[1], "-v") == 0) // Check stego image against the original secret
+    {
+        return e_verify;
+    }
+    else if(strcmp(argv[1], "-c") == 0) // Pack several files into one stego image
+    {
+        return e_container;
+    }
+    else if(strcmp(argv[1], "-l") == 0) // List the files of a container
+    {
+        return e_list;
+    }
+    else if(strcmp(argv[1], "-x") == 0) // Extract one file of a container
+    {
+        return e_extract;
+    }
+    else if(strcmp(argv[1], "-se") == 0) // Spread a secret over numbered frames
+    {
+        return e_seq_encode;
+    }
+    else if(strcmp(argv[1], "-sd") == 0) // Decode a secret from numbered frames
+    {
+        return e_seq_decode;
+    }
+    else if(strcmp(argv[1], "--analyze") == 0) // Score images for LSB detectability
+    {
+        return e_analyze;
+    }
+    else if(strcmp(argv[1], "--daemon") == 0) // Serve requests on a Unix socket
+    {
+        return e_daemon;
+    }
+    else if(strcmp(argv[1], "--client") == 0) // Send one request to a running daemon
+    {
+        return e_client;
+    }
     else
     {
         return e_unsupported;           // Return unsupported for invalid operation
@@ -22,20 +63,85 @@ OperationType check_operation_type(char *argv[])
 }
 
 
+/* Take "--json <file|fd:N>" out of argv, returns its target or NULL */
+static char *take_json_option(int *argc, char *argv[])
+{
+    for(int i = 2; i < *argc; i++)
+    {
+        if(strcmp(argv[i], "--json") == 0 && i + 1 < *argc)
+        {
+            char *target = argv[i + 1];
+
+            // Shift the rest down, NULL terminator included
+            memmove(&argv[i], &argv[i + 2], (*argc - i - 1) * sizeof(argv[0]));
+            *argc -= 2;
+            return target;
+        }
+    }
+    return NULL;
+}
+
+/* End a job: exit code from its error class, and the JSON report when asked for */
+static int finish_job(JobReport *report, Status status, const char *json)
+{
+    int code = report_finish(report, status);
+
+    fflush(stdout);     // Progress text first when the report shares stdout (fd:1)
+    if(json != NULL && report_write(report, json) == e_failure)
+    {
+        fprintf(stderr, "ERROR: Unable to write the report to %s\n", json);
+    }
+    return code;
+}
+
+/* Print every operation and its arguments */
+static void print_usage(void)
+{
+    printf("Usage:\n");
+    printf("  steg -e <src.bmp> <secret> [stego.bmp] [--bits N] [--lsb-first] [--channels bgr] [--adaptive [level]] [--fec [nroots]] [--analyze]\n");
+    printf("  steg -d <stego.bmp> [output]\n");
+    printf("  steg -v <stego.bmp> <secret>\n");
+    printf("  steg -c <src.bmp> <stego.bmp> <files...> [layout options] [--analyze]\n");
+    printf("  steg -l <stego.bmp>\n");
+    printf("  steg -x <stego.bmp> <name> [output]\n");
+    printf("  steg -se <frames> <secret> <stego frames> [--bits N] [--lsb-first] [--channels bgr]\n");
+    printf("  steg -sd <stego frames> [output] [--from N]\n");
+    printf("  steg --analyze <image.bmp>...\n");
+    printf("  steg --daemon <socket> [threads] [cache MB]\n");
+    printf("  steg --client <socket> -e/-d/-p <files...> or -s\n");
+    printf("Any job also takes --json <file|fd:N> to append a report line\n");
+}
+
+/* Reject the arguments of a job */
+static int usage_error(JobReport *report, const char *json, const char *what)
+{
+    printf("Error: Invalid argument for %s\n", what);
+    print_usage();
+    report_error(report, e_err_usage);
+    return finish_job(report, e_failure, json);
+}
+
 int main(int argc, char *argv[])
 {
     if(argc < 2)
     {
         printf("Error: Insufficient arguments\n");
-        return 1;
+        print_usage();
+        return e_err_usage;
     }
 
-    EncodeInfo encInfo;  //structure variable for encoding operations
-    
+    EncodeInfo encInfo = {0};  //structure variable for encoding operations
+    JobReport report = {0};    // Status, timings and sizes of the job
+    char *json = take_json_option(&argc, argv);
+
+    encInfo.report = &report;
+    report.want_crc = json != NULL;     // Checksums only cost time when someone reads them
+
     int ret = check_operation_type(argv); 
 
     if(ret == 0)    // If operation is encoding (e_encode = 0)
     {
+        report_start(&report, "encode", argc >= 3 ? argv[2] : NULL);
         if(argc >= 4)   // Check if minimum 4 arguments provided for encoding
         {
            /* Read and validate Encode args from argv */
@@ -43,8 +149,7 @@ int main(int argc, char *argv[])
 
            if(ret1 == e_failure)     // If argument validation failed
            {
-                printf("Error: Invalid argument for encoding\n");      // Print error message
-                return 0;
+                return usage_error(&report, json, "encoding");
            }
            else     // If argument validation successful
            {
@@ -52,22 +157,33 @@ int main(int argc, char *argv[])
                 if(do_encoding(&encInfo) == e_success)      // Execute encoding process
                 {
                     printf("ENCODING COMPLETED SUCCESSFULLY!\n");   
+
+                    // Detectability of the source against the stego image
+                    if(encInfo.analyze)
+                    {
+                        char *images[] = { encInfo.src_image_fname, encInfo.stego_image_fname, NULL };
+                        do_analysis(images, NULL);
+                    }
+                    return finish_job(&report, e_success, json);
                 }
                 else                                       // If encoding failed
                 {
                     printf("Encoding failed!\n");
+                    return finish_job(&report, e_failure, json);
                 }
            }
         }
         else         // If insufficient arguments for encoding
         {
-            printf("Error: Invalid argument for encoding\n");
+            return usage_error(&report, json, "encoding");
         }
     }
     else if(ret == 1)        // If operation is decoding (e_decode = 1)
     {
-        DecodeInfo decInfo;  // Structure variable for decoding operations
+        DecodeInfo decInfo = {0};  // Structure variable for decoding operations
 
+        decInfo.report = &report;
+        report_start(&report, "decode", argc >= 3 ? argv[2] : NULL);
         if(argc >= 3)        // Check if minimum 3 arguments provided for decoding
         {
             /* Read and validate Decode args from argv */
@@ -75,35 +191,172 @@ int main(int argc, char *argv[])
 
             if(ret2 == e_failure)
             {
-                printf("Error: Invalid argument for decoding\n");
-                return 0;
+                return usage_error(&report, json, "decoding");
             }
             else        // If argument validation successful
             {
                 if(do_decoding(&decInfo) == e_success)
                 {
                     printf("DECODING COMPLETED SUCCESSFULLY!\n");
-                    return 0;
+                    return finish_job(&report, e_success, json);
                 }
                 else
                 {
                     printf("Decoding failed!\n");
-                    return 1;
+                    return finish_job(&report, e_failure, json);
                 }
             }
         }
         else       // If insufficient arguments for decoding
         {
-            printf("Error: Invalid argument for decoding\n");
-            return 1;
+            return usage_error(&report, json, "decoding");
+        }
+    }
+    else if(ret == e_verify)    // -v <stego.bmp> <secret>
+    {
+        DecodeInfo decInfo = {0};
+
+        decInfo.report = &report;
+        report_start(&report, "verify", argc >= 3 ? argv[2] : NULL);
+        if(argc >= 4 && read_and_validate_verify_args(argv, &decInfo) == e_success)
+        {
+            if(do_verification(&decInfo) == e_success)
+            {
+                printf("VERIFICATION COMPLETED SUCCESSFULLY!\n");
+                return finish_job(&report, e_success, json);
+            }
+            printf("Verification failed!\n");
+            return finish_job(&report, e_failure, json);
+        }
+        return usage_error(&report, json, "verification");
+    }
+    else if(ret == e_container)     // -c <src.bmp> <stego.bmp> <files...> [options]
+    {
+        report_start(&report, "container", argc >= 3 ? argv[2] : NULL);
+        if(argc >= 5 && read_and_validate_container_args(argv, &encInfo) == e_success)
+        {
+            if(do_encoding(&encInfo) == e_success)
+            {
+                printf("ENCODING COMPLETED SUCCESSFULLY!\n");
+                if(encInfo.analyze)
+                {
+                    char *images[] = { encInfo.src_image_fname, encInfo.stego_image_fname, NULL };
+                    do_analysis(images, NULL);
+                }
+                return finish_job(&report, e_success, json);
+            }
+            printf("Encoding failed!\n");
+            return finish_job(&report, e_failure, json);
+        }
+        return usage_error(&report, json, "container");
+    }
+    else if(ret == e_list)      // -l <stego.bmp>
+    {
+        DecodeInfo decInfo = {0};
+
+        decInfo.report = &report;
+        report_start(&report, "list", argc >= 3 ? argv[2] : NULL);
+        if(argc >= 3 && read_and_validate_list_args(argv, &decInfo) == e_success)
+        {
+            return finish_job(&report, do_listing(&decInfo), json);
+        }
+        return usage_error(&report, json, "listing");
+    }
+    else if(ret == e_extract)   // -x <stego.bmp> <name> [output]
+    {
+        DecodeInfo decInfo = {0};
+
+        decInfo.report = &report;
+        report_start(&report, "extract", argc >= 3 ? argv[2] : NULL);
+        if(argc >= 4 && read_and_validate_extract_args(argv, &decInfo) == e_success)
+        {
+            if(do_extraction(&decInfo) == e_success)
+            {
+                printf("EXTRACTION COMPLETED SUCCESSFULLY!\n");
+                return finish_job(&report, e_success, json);
+            }
+            printf("Extraction failed!\n");
+            return finish_job(&report, e_failure, json);
+        }
+        return usage_error(&report, json, "extraction");
+    }
+    else if(ret == e_seq_encode)    // -se <frames> <secret> <stego frames> [layout options]
+    {
+        SeqInfo seqInfo = {0};
+
+        seqInfo.report = &report;
+        report_start(&report, "seq-encode", argc >= 3 ? argv[2] : NULL);
+        if(argc >= 5 && read_and_validate_seq_encode_args(argv, &seqInfo) == e_success)
+        {
+            if(do_seq_encoding(&seqInfo) == e_success)
+            {
+                printf("ENCODING COMPLETED SUCCESSFULLY!\n");
+                return finish_job(&report, e_success, json);
+            }
+            printf("Encoding failed!\n");
+            return finish_job(&report, e_failure, json);
+        }
+        return usage_error(&report, json, "sequence encoding");
+    }
+    else if(ret == e_seq_decode)    // -sd <stego frames> [output] [--from N]
+    {
+        SeqInfo seqInfo = {0};
+
+        seqInfo.report = &report;
+        report_start(&report, "seq-decode", argc >= 3 ? argv[2] : NULL);
+        if(argc >= 3 && read_and_validate_seq_decode_args(argv, &seqInfo) == e_success)
+        {
+            if(do_seq_decoding(&seqInfo) == e_success)
+            {
+                printf("DECODING COMPLETED SUCCESSFULLY!\n");
+                return finish_job(&report, e_success, json);
+            }
+            printf("Decoding failed!\n");
+            return finish_job(&report, e_failure, json);
+        }
+        return usage_error(&report, json, "sequence decoding");
+    }
+    else if(ret == e_analyze)   // --analyze <image.bmp>...
+    {
+        report_start(&report, "analyze", argc >= 3 ? argv[2] : NULL);
+        if(argc >= 3)
+        {
+            report_stage(&report, "analyze");
+            return finish_job(&report, do_analysis(&argv[2], &report), json);
+        }
+        return usage_error(&report, json, "analysis");
+    }
+    else if(ret == e_daemon)    // --daemon <socket> [threads] [cache MB]
+    {
+        report_start(&report, "daemon", argc >= 3 ? argv[2] : NULL);
+        if(argc >= 3)
+        {
+            // Only comes back when the daemon could not serve
+            int code = run_daemon(argv[2], argc >= 4 ? atoi(argv[3]) : 0, argc >= 5 ? atoi(argv[4]) : 0);
+            report_error(&report, code);
+            return finish_job(&report, code == e_err_none ? e_success : e_failure, json);
+        }
+        return usage_error(&report, json, "daemon");
+    }
+    else if(ret == e_client)    // --client <socket> -e/-d/-p <files...> or -s
+    {
+        report_start(&report, "client", argc >= 5 ? argv[4] : NULL);
+        if(argc >= 4)
+        {
+            int code = run_client(argv[2], &argv[3]);
+            report_error(&report, code);
+            return finish_job(&report, code == e_err_none ? e_success : e_failure, json);
         }
+        return usage_error(&report, json, "client");
     }
     else           // If operation is unsupported
     {
         //Error messages
+        report_start(&report, NULL, NULL);
         printf("Error: Unsupported operation\n");
-        printf("Use -e for encoding or -d for decoding\n");
-        return 0;
+        print_usage();
+        report_error(&report, e_err_usage);
+        return finish_job(&report, e_failure, json);
     }
 
     return 0;
@@ -0,0 +1,627 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../encode.h"
+#include "../decode.h"
+#include "../context.h"
+#include "../types.h"
+
+/*
+ * Throughput gate for the codec.
+ * Generates carriers and secrets in a temporary directory, on
+ * tmpfs when there is one so disk writeback does not swamp the
+ * timings, then encodes and decodes each of a fixed set of
+ * scenarios through the same entry points as the command line.
+ * Every job runs once to warm up, then at least PERF_MIN_RUNS
+ * times and PERF_MIN_TIME seconds; the median run gives the
+ * carrier MB/s, and the codec contexts allocated by the timed
+ * runs give ctx_allocs per job, which must be 0 once the
+ * per-thread pool is warm: any job that allocates fails the
+ * check, whatever the baseline holds. Allocations outside the
+ * contexts are left to tests/alloc_check.
+ *
+ * Every job run is paired with a run of a fixed reference loop,
+ * and jobs are compared by their speed relative to it, so a
+ * slower machine, or a busy one, does not read as a regression.
+ * A scenario that still looks slower is measured up to
+ * PERF_ATTEMPTS times before the check fails, and --update keeps
+ * the median of PERF_ATTEMPTS passes.
+ *
+ * perf_check baseline.json           compare, fail on regression
+ * perf_check baseline.json --update  write the measured numbers
+ */
+
+#define PERF_MIN_RUNS 5         // Timed runs per job, the median one counts
+#define PERF_MIN_TIME 1.0       // Seconds of timed runs per job, at least
+#define PERF_TOLERANCE 0.10     // Allowed slowdown / allocation growth
+#define PERF_ATTEMPTS 3         // Measurements of a scenario before a regression counts
+#define PERF_MAX_JOBS 32
+#define PERF_MAX_RUNS 256
+#define PERF_REF_BYTES (8 * 1024 * 1024)   // Bytes per run of the reference loop
+#define PERF_PATH 512
+
+/* One carrier, secret and layout */
+typedef struct
+{
+    const char *name;
+    uint width;
+    uint height;
+    int noise;                  // Amplitude of the texture added to the gradient
+    long secret_size;
+    const char *options[6];     // Layout options, NULL terminated
+} PerfScenario;
+
+/* Measured or baseline numbers of one job */
+typedef struct
+{
+    char name[64];
+    double mbps;                // Carrier MB/s
+    double ref_mbps;            // MB/s of the reference loop next to it
+    double ctx_allocs;          // Codec contexts allocated per run
+} PerfResult;
+
+static const PerfScenario scenarios[] = {
+    { "lsb1",        2048, 2048,  0, 1 << 20,         { NULL } },
+    { "lsb2",        2048, 2048,  0, 2 << 20,         { "--bits", "2", NULL } },
+    { "lsb2-bg",     2048, 2048,  0, 1 << 20,         { "--bits", "2", "--channels", "bg", "--lsb-first", NULL } },
+    { "fec",         2048, 2048,  0, 1 << 20,         { "--fec", "32", NULL } },
+    { "adaptive",    2048, 2048, 40, 256 << 10,       { "--adaptive", NULL } },
+    // Plain layout with a 42 MB window, over STRIPE_MIN_WINDOW, so it runs through stripe.c
+    { "striped",     4096, 4096,  0, 5 << 20,         { NULL } },
+};
+
+/* Function Definitions */
+
+/* Seconds on the monotonic clock */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Next value of a 32 bit LCG, the data only needs to be repeatable */
+static uint32_t next_rand(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+/* Write a 24 bpp BMP of a smooth gradient, with optional texture */
+static Status write_carrier(const char *fname, uint width, uint height, int noise)
+{
+    uint stride = (width * 3 + 3) & ~3u;
+    uint image_size = stride * height;
+    unsigned char header[BMP_HEADER_SIZE] = { 'B', 'M' };
+    unsigned char *row = calloc(stride, 1);
+    uint32_t state = width ^ height;
+    FILE *fptr = fopen(fname, "wb");
+
+    if(fptr == NULL || row == NULL)
+    {
+        free(row);
+        if(fptr != NULL)
+        {
+            fclose(fptr);
+        }
+        return e_failure;
+    }
+
+    // Little endian header fields
+    uint fields[][2] = { { 2, BMP_HEADER_SIZE + image_size }, { 10, BMP_HEADER_SIZE }, { 14, 40 }, { 18, width },
+                         { 22, height }, { 26, 1 | (24 << 16) }, { 34, image_size } };
+    for(size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        for(int b = 0; b < 4; b++)
+        {
+            header[fields[i][0] + b] = fields[i][1] >> (8 * b);
+        }
+    }
+
+    Status ret = fwrite(header, 1, BMP_HEADER_SIZE, fptr) == BMP_HEADER_SIZE ? e_success : e_failure;
+    for(uint y = 0; y < height && ret == e_success; y++)
+    {
+        for(uint x = 0; x < width * 3; x++)
+        {
+            int v = (x / 3 * 255 / width + y * 255 / height + (x % 3) * 40) / 2;
+            if(noise > 0)
+            {
+                v += (int)(next_rand(&state) % (2 * noise + 1)) - noise;
+            }
+            row[x] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+        if(fwrite(row, 1, stride, fptr) != stride)
+        {
+            ret = e_failure;
+        }
+    }
+
+    free(row);
+    if(fclose(fptr) != 0)
+    {
+        ret = e_failure;
+    }
+    return ret;
+}
+
+/* Write size pseudo-random bytes */
+static Status write_secret(const char *fname, long size)
+{
+    uint32_t state = (uint32_t)size;
+    FILE *fptr = fopen(fname, "wb");
+    Status ret = e_success;
+
+    if(fptr == NULL)
+    {
+        return e_failure;
+    }
+    for(long i = 0; i < size && ret == e_success; i++)
+    {
+        if(putc(next_rand(&state) & 0xff, fptr) == EOF)
+        {
+            ret = e_failure;
+        }
+    }
+    if(fclose(fptr) != 0)
+    {
+        ret = e_failure;
+    }
+    return ret;
+}
+
+/* 1 when both files hold the same bytes */
+static int same_file(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int same = fa != NULL && fb != NULL;
+
+    while(same)
+    {
+        int ca = getc(fa);
+        int cb = getc(fb);
+        if(ca != cb)
+        {
+            same = 0;
+        }
+        else if(ca == EOF)
+        {
+            break;
+        }
+    }
+    if(fa != NULL)
+    {
+        fclose(fa);
+    }
+    if(fb != NULL)
+    {
+        fclose(fb);
+    }
+    return same;
+}
+
+/* Stage messages of the codec go to /dev/null while timing */
+static int quiet_stdout(void)
+{
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+
+    fflush(stdout);
+    if(null >= 0)
+    {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    return saved;
+}
+
+/* Undo quiet_stdout() */
+static void restore_stdout(int saved)
+{
+    fflush(stdout);
+    if(saved >= 0)
+    {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+}
+
+/* Encode src + secret into stego with the scenario's options */
+static Status run_encode(const PerfScenario *sc, char *src, char *secret, char *stego)
+{
+    char *argv[16] = { "perf_check", "-e", src, secret, stego };
+    EncodeInfo encInfo = {0};
+    int argc = 5;
+
+    for(int i = 0; sc -> options[i] != NULL; i++)
+    {
+        argv[argc++] = (char *)sc -> options[i];
+    }
+
+    if(read_and_validate_encode_args(argv, &encInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    return do_encoding(&encInfo);
+}
+
+/* Decode stego into output, the extension is added by the decoder */
+static Status run_decode(char *stego, char *output)
+{
+    char *argv[] = { "perf_check", "-d", stego, output, NULL };
+    DecodeInfo decInfo = {0};
+
+    if(read_and_validate_decode_args(argv, &decInfo) == e_failure)
+    {
+        return e_failure;
+    }
+    return do_decoding(&decInfo);
+}
+
+static volatile uint32_t perf_sink;    // Keeps the reference loop from being optimised out
+
+/* Reference loop: copy a buffer and fold the LSBs of every byte */
+static void run_reference(void)
+{
+    static unsigned char src[PERF_REF_BYTES], dst[PERF_REF_BYTES];
+    uint32_t acc = 0;
+
+    memcpy(dst, src, PERF_REF_BYTES);
+    for(size_t i = 0; i < PERF_REF_BYTES; i++)
+    {
+        acc = (acc << 1 | (dst[i] & 1)) ^ (acc >> 31);
+        src[i] = (unsigned char)acc;
+    }
+    perf_sink = acc;
+}
+
+/* Order run times for the median */
+static int cmp_time(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Time one job: a warm-up run, then the median of the timed runs */
+static Status measure(const PerfScenario *sc, int decode, char *src, char *secret, char *stego, char *output, long bytes, PerfResult *res)
+{
+    double times[PERF_MAX_RUNS], ref_times[PERF_MAX_RUNS];
+    double total = 0;
+    unsigned long allocs = 0;
+    int run;
+
+    for(run = 0; run < PERF_MAX_RUNS && (run <= PERF_MIN_RUNS || total < PERF_MIN_TIME); run++)
+    {
+        unsigned long before = codec_ctx_alloc_count();
+        int saved = quiet_stdout();
+        double start = now();
+        Status ret = decode ? run_decode(stego, output) : run_encode(sc, src, secret, stego);
+        double elapsed = now() - start;
+        restore_stdout(saved);
+
+        if(ret == e_failure)
+        {
+            return e_failure;
+        }
+        if(run > 0)
+        {
+            allocs += codec_ctx_alloc_count() - before;
+            total += elapsed;
+            times[run - 1] = elapsed;
+
+            start = now();
+            run_reference();
+            ref_times[run - 1] = now() - start;
+        }
+    }
+
+    snprintf(res -> name, sizeof(res -> name), "%s-%s", decode ? "decode" : "encode", sc -> name);
+    qsort(times, run - 1, sizeof(times[0]), cmp_time);
+    qsort(ref_times, run - 1, sizeof(ref_times[0]), cmp_time);
+    res -> mbps = bytes / times[(run - 1) / 2] / 1e6;
+    res -> ref_mbps = PERF_REF_BYTES / ref_times[(run - 1) / 2] / 1e6;
+    res -> ctx_allocs = (double)allocs / (run - 1);
+    return e_success;
+}
+
+/* Generate the files of a scenario and measure its encode and decode */
+static Status run_scenario(const char *dir, const PerfScenario *sc, PerfResult *res)
+{
+    char src[PERF_PATH], secret[PERF_PATH], stego[PERF_PATH], output[PERF_PATH], decoded[PERF_PATH + 8];
+    long bytes = BMP_HEADER_SIZE + (long)((sc -> width * 3 + 3) & ~3u) * sc -> height;
+
+    snprintf(src, sizeof(src), "%s/%s.bmp", dir, sc -> name);
+    snprintf(secret, sizeof(secret), "%s/%s.txt", dir, sc -> name);
+    snprintf(stego, sizeof(stego), "%s/%s-stego.bmp", dir, sc -> name);
+    snprintf(output, sizeof(output), "%s/%s-out", dir, sc -> name);
+    snprintf(decoded, sizeof(decoded), "%s.txt", output);
+
+    Status ret = e_failure;
+
+    if(write_carrier(src, sc -> width, sc -> height, sc -> noise) == e_failure || write_secret(secret, sc -> secret_size) == e_failure)
+    {
+        printf("Error: Unable to generate the files of %s in %s\n", sc -> name, dir);
+    }
+    else if(measure(sc, 0, src, secret, stego, output, bytes, &res[0]) == e_failure ||
+            measure(sc, 1, src, secret, stego, output, bytes, &res[1]) == e_failure)
+    {
+        printf("Error: Scenario %s failed to run\n", sc -> name);
+    }
+    else if(!same_file(secret, decoded))
+    {
+        printf("Error: Scenario %s decoded a different secret\n", sc -> name);
+    }
+    else
+    {
+        ret = e_success;
+    }
+
+    // Whatever happened, leave nothing behind in the directory
+    remove(src);
+    remove(secret);
+    remove(stego);
+    remove(decoded);
+    return ret;
+}
+
+/* Read the jobs of a baseline file written by write_baseline() */
+static int read_baseline(const char *fname, PerfResult *base)
+{
+    FILE *fptr = fopen(fname, "r");
+    char line[256];
+    int count = 0;
+
+    if(fptr == NULL)
+    {
+        return -1;
+    }
+    // One job per line: { "name": "...", "mbps": x, "ref_mbps": r, "ctx_allocs": y }
+    while(count < PERF_MAX_JOBS && fgets(line, sizeof(line), fptr) != NULL)
+    {
+        PerfResult *r = &base[count];
+        char *name = strstr(line, "\"name\"");
+        char *mbps = strstr(line, "\"mbps\"");
+        char *ref = strstr(line, "\"ref_mbps\"");
+        char *ctx_allocs = strstr(line, "\"ctx_allocs\"");
+
+        if(name != NULL && mbps != NULL && ref != NULL && ctx_allocs != NULL &&
+           sscanf(name, "\"name\" : \"%63[^\"]\"", r -> name) == 1 &&
+           sscanf(mbps, "\"mbps\" : %lf", &r -> mbps) == 1 &&
+           sscanf(ref, "\"ref_mbps\" : %lf", &r -> ref_mbps) == 1 && r -> ref_mbps > 0 &&
+           sscanf(ctx_allocs, "\"ctx_allocs\" : %lf", &r -> ctx_allocs) == 1)
+        {
+            count++;
+        }
+    }
+    fclose(fptr);
+    return count;
+}
+
+/* Write the measured jobs as the new baseline */
+static Status write_baseline(const char *fname, const PerfResult *res, int count)
+{
+    FILE *fptr = fopen(fname, "w");
+
+    if(fptr == NULL)
+    {
+        return e_failure;
+    }
+    fprintf(fptr, "{\n  \"jobs\": [\n");
+    for(int i = 0; i < count; i++)
+    {
+        fprintf(fptr, "    { \"name\": \"%s\", \"mbps\": %.1f, \"ref_mbps\": %.1f, \"ctx_allocs\": %.1f }%s\n",
+                res[i].name, res[i].mbps, res[i].ref_mbps, res[i].ctx_allocs, i + 1 < count ? "," : "");
+    }
+    fprintf(fptr, "  ]\n}\n");
+    return fclose(fptr) == 0 ? e_success : e_failure;
+}
+
+/* Baseline entry of a job, NULL when there is none */
+static const PerfResult *find_baseline(const char *name, const PerfResult *base, int base_count)
+{
+    for(int j = 0; j < base_count; j++)
+    {
+        if(strcmp(base[j].name, name) == 0)
+        {
+            return &base[j];
+        }
+    }
+    return NULL;
+}
+
+/* Baseline MB/s of a job scaled to this run
+ * Description: scaled by how fast the reference loop ran next
+ * to the job, here and when the baseline was taken
+ */
+static double expected_mbps(const PerfResult *r, const PerfResult *b)
+{
+    return b -> mbps * r -> ref_mbps / b -> ref_mbps;
+}
+
+/* 1 when a job allocates contexts once the pool is warm, whatever the baseline says */
+static int job_allocates(const PerfResult *r)
+{
+    return r -> ctx_allocs > 0;
+}
+
+/* 1 when a job allocates, or is slower or allocates more than its baseline */
+static int job_regressed(const PerfResult *r, const PerfResult *base, int base_count)
+{
+    const PerfResult *b = find_baseline(r -> name, base, base_count);
+
+    return job_allocates(r) ||
+           (b != NULL && (r -> mbps < expected_mbps(r, b) * (1 - PERF_TOLERANCE) || r -> ctx_allocs > b -> ctx_allocs * (1 + PERF_TOLERANCE)));
+}
+
+/* Print every job against the baseline, 1 when any regressed */
+static int compare(const PerfResult *res, int count, const PerfResult *base, int base_count)
+{
+    int regressed = 0;
+
+    printf("%-20s %10s %10s %8s %10s %8s\n", "job", "MB/s", "expected", "change", "ctx_allocs", "baseline");
+    for(int i = 0; i < count; i++)
+    {
+        const PerfResult *b = find_baseline(res[i].name, base, base_count);
+        int allocates = job_allocates(&res[i]);
+
+        if(b == NULL)
+        {
+            printf("%-20s %10.1f %10s %8s %10.1f %8s  not in baseline%s\n", res[i].name, res[i].mbps, "-", "-", res[i].ctx_allocs, "-",
+                   allocates ? "  ALLOCATES" : "");
+            regressed |= allocates;
+            continue;
+        }
+
+        double expected = expected_mbps(&res[i], b);
+        int slow = res[i].mbps < expected * (1 - PERF_TOLERANCE);
+        int allocs = res[i].ctx_allocs > b -> ctx_allocs * (1 + PERF_TOLERANCE);
+        printf("%-20s %10.1f %10.1f %+7.1f%% %10.1f %8.1f%s%s%s\n", res[i].name, res[i].mbps, expected, (res[i].mbps / expected - 1) * 100,
+               res[i].ctx_allocs, b -> ctx_allocs, slow ? "  SLOWER" : "", allocs ? "  MORE ALLOCATIONS" : "", allocates ? "  ALLOCATES" : "");
+        regressed |= slow || allocs || allocates;
+    }
+    return regressed;
+}
+
+/* Measure the scenarios of regressed jobs again, keeping each job's better run */
+static Status confirm_regressions(const char *dir, PerfResult *res, const PerfResult *base, int base_count)
+{
+    for(int attempt = 0; attempt < PERF_ATTEMPTS - 1; attempt++)
+    {
+        for(size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        {
+            PerfResult again[2];
+            PerfResult *r = &res[2 * i];
+
+            if(!job_regressed(&r[0], base, base_count) && !job_regressed(&r[1], base, base_count))
+            {
+                continue;
+            }
+            if(run_scenario(dir, &scenarios[i], again) == e_failure)
+            {
+                return e_failure;
+            }
+            for(int k = 0; k < 2; k++)
+            {
+                if(again[k].mbps / again[k].ref_mbps > r[k].mbps / r[k].ref_mbps)
+                {
+                    r[k].mbps = again[k].mbps;
+                    r[k].ref_mbps = again[k].ref_mbps;
+                }
+                if(again[k].ctx_allocs < r[k].ctx_allocs)
+                {
+                    r[k].ctx_allocs = again[k].ctx_allocs;
+                }
+            }
+        }
+    }
+    return e_success;
+}
+
+/* Order results by their speed relative to the reference loop */
+static int cmp_relative(const void *a, const void *b)
+{
+    const PerfResult *x = a, *y = b;
+    double rx = x -> mbps / x -> ref_mbps, ry = y -> mbps / y -> ref_mbps;
+    return rx < ry ? -1 : rx > ry;
+}
+
+/* Measure every scenario PERF_ATTEMPTS times, keeping each job's median run */
+static Status measure_baseline(const char *dir, PerfResult *res)
+{
+    PerfResult passes[PERF_ATTEMPTS][PERF_MAX_JOBS];
+    int count = 2 * sizeof(scenarios) / sizeof(scenarios[0]);
+
+    for(int attempt = 0; attempt < PERF_ATTEMPTS; attempt++)
+    {
+        for(size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        {
+            if(run_scenario(dir, &scenarios[i], &passes[attempt][2 * i]) == e_failure)
+            {
+                return e_failure;
+            }
+        }
+    }
+
+    for(int k = 0; k < count; k++)
+    {
+        PerfResult runs[PERF_ATTEMPTS];
+        for(int attempt = 0; attempt < PERF_ATTEMPTS; attempt++)
+        {
+            runs[attempt] = passes[attempt][k];
+        }
+        qsort(runs, PERF_ATTEMPTS, sizeof(runs[0]), cmp_relative);
+        res[k] = runs[PERF_ATTEMPTS / 2];
+    }
+    return e_success;
+}
+
+int main(int argc, char *argv[])
+{
+    PerfResult res[PERF_MAX_JOBS], base[PERF_MAX_JOBS];
+    int count;
+    int base_count = 0;
+    char dir[] = "/dev/shm/steg-perf-XXXXXX";
+
+    if(argc < 2 || (argc > 2 && strcmp(argv[2], "--update") != 0))
+    {
+        printf("Usage: %s baseline.json [--update]\n", argv[0]);
+        return 2;
+    }
+    if(argc == 2 && (base_count = read_baseline(argv[1], base)) < 0)
+    {
+        printf("Error: Unable to read %s, create it with --update\n", argv[1]);
+        return 2;
+    }
+    if(mkdtemp(dir) == NULL && mkdtemp(strcpy(dir, "/tmp/steg-perf-XXXXXX")) == NULL)
+    {
+        printf("Error: Unable to create a temporary directory\n");
+        return 2;
+    }
+
+    Status ret = e_success;
+    count = 2 * sizeof(scenarios) / sizeof(scenarios[0]);
+    if(argc > 2)
+    {
+        ret = measure_baseline(dir, res);
+    }
+    else
+    {
+        for(size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]) && ret == e_success; i++)
+        {
+            ret = run_scenario(dir, &scenarios[i], &res[2 * i]);
+        }
+        if(ret == e_success)
+        {
+            ret = confirm_regressions(dir, res, base, base_count);
+        }
+    }
+    rmdir(dir);
+    if(ret == e_failure)
+    {
+        return 1;
+    }
+
+    if(argc > 2)
+    {
+        if(write_baseline(argv[1], res, count) == e_failure)
+        {
+            printf("Error: Unable to write %s\n", argv[1]);
+            return 2;
+        }
+        printf("Baseline of %d jobs written to %s\n", count, argv[1]);
+        return 0;
+    }
+
+    if(compare(res, count, base, base_count))
+    {
+        printf("PERF CHECK FAILED: more than %.0f%% below the baseline\n", PERF_TOLERANCE * 100);
+        return 1;
+    }
+    printf("PERF CHECK PASSED\n");
+    return 0;
+}
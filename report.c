@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "report.h"
+#include "types.h"
+
+#define REPORT_LINE_SIZE 4096   // Longest JSON line written
+
+/* Line being built, len stays below REPORT_LINE_SIZE */
+typedef struct
+{
+    char buf[REPORT_LINE_SIZE];
+    size_t len;
+    int overflow;           // 1 once something did not fit
+} ReportLine;
+
+/* Function Definitions */
+
+/* Seconds on the monotonic clock */
+static double report_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Start timing a job */
+void report_start(JobReport *report, const char *op, const char *input)
+{
+    if(report == NULL)
+    {
+        return;
+    }
+    report -> op = op;
+    report -> input = input;
+    report -> stages = 0;
+    report -> job_start = report -> stage_start = report_now();
+}
+
+/* End the current stage and start the named one */
+void report_stage(JobReport *report, const char *name)
+{
+    if(report == NULL)
+    {
+        return;
+    }
+
+    double now = report_now();
+    if(report -> stages > 0)
+    {
+        report -> stage[report -> stages - 1].ms = (now - report -> stage_start) * 1e3;
+    }
+    if(report -> stages < REPORT_MAX_STAGES)
+    {
+        report -> stage[report -> stages].name = name;
+        report -> stage[report -> stages].ms = 0;
+        report -> stages++;
+    }
+    report -> stage_start = now;
+}
+
+/* Record why the job failed, the first error is kept */
+void report_error(JobReport *report, StegError error)
+{
+    if(report != NULL && report -> error == e_err_none)
+    {
+        report -> error = error;
+    }
+}
+
+/* End the last stage, returns the exit code for the job's status */
+int report_finish(JobReport *report, Status status)
+{
+    if(report == NULL)
+    {
+        return status == e_success ? e_err_none : e_err_failed;
+    }
+
+    double now = report_now();
+    if(report -> stages > 0)
+    {
+        report -> stage[report -> stages - 1].ms = (now - report -> stage_start) * 1e3;
+    }
+    report -> total_ms = (now - report -> job_start) * 1e3;
+
+    // A success clears errors of steps that were retried or optional
+    if(status == e_success)
+    {
+        report -> error = e_err_none;
+    }
+    else if(report -> error == e_err_none)
+    {
+        report -> error = e_err_failed;
+    }
+    return report -> error;
+}
+
+/* Name of an error class as it appears in the report */
+const char *report_error_name(StegError error)
+{
+    switch(error)
+    {
+        case e_err_none:
+            return "none";
+        case e_err_usage:
+            return "usage";
+        case e_err_open:
+            return "open";
+        case e_err_format:
+            return "format";
+        case e_err_capacity:
+            return "capacity";
+        case e_err_corrupt:
+            return "corrupt";
+        case e_err_io:
+            return "io";
+        case e_err_mismatch:
+            return "mismatch";
+        default:
+            return "failed";
+    }
+}
+
+/* Append printf style text */
+static void put_format(ReportLine *line, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(line -> buf + line -> len, REPORT_LINE_SIZE - line -> len, fmt, ap);
+    va_end(ap);
+
+    if(n < 0 || (size_t)n >= REPORT_LINE_SIZE - line -> len)
+    {
+        line -> overflow = 1;
+        return;
+    }
+    line -> len += n;
+}
+
+/* Append a JSON string, NULL as null */
+static void put_string(ReportLine *line, const char *str)
+{
+    if(str == NULL)
+    {
+        put_format(line, "null");
+        return;
+    }
+
+    put_format(line, "\"");
+    for(; *str && !line -> overflow; str++)
+    {
+        unsigned char c = *str;
+        if(c == '"' || c == '\\')
+        {
+            put_format(line, "\\%c", c);
+        }
+        else if(c < 0x20)
+        {
+            put_format(line, "\\u%04x", c);
+        }
+        else
+        {
+            put_format(line, "%c", c);
+        }
+    }
+    put_format(line, "\"");
+}
+
+/* Append the report as one JSON line to a file name or fd:N
+ * Description: the line goes out in a single write, so jobs
+ * sharing a pipe or an appended file do not interleave
+ */
+Status report_write(const JobReport *report, const char *target)
+{
+    ReportLine line = { .len = 0, .overflow = 0 };
+    int fd;
+
+    put_format(&line, "{\"op\":");
+    put_string(&line, report -> op);
+    put_format(&line, ",\"status\":\"%s\",\"error\":\"%s\",\"exit_code\":%d,\"input\":",
+               report -> error == e_err_none ? "success" : "failure", report_error_name(report -> error), report -> error);
+    put_string(&line, report -> input);
+    put_format(&line, ",\"output\":");
+    put_string(&line, report -> output);
+
+    put_format(&line, ",\"bytes\":%llu,\"offset\":%llu,\"payload_bytes\":%llu,\"capacity_bytes\":%llu,\"capacity_used\":%.4f",
+               (unsigned long long)report -> bytes, (unsigned long long)report -> offset, (unsigned long long)report -> payload_bytes, (unsigned long long)report -> capacity_bytes,
+               report -> capacity_bytes > 0 ? (double)report -> payload_bytes / report -> capacity_bytes : 0.0);
+    if(report -> has_crc)
+    {
+        put_format(&line, ",\"crc32\":\"%08x\"", report -> crc);
+    }
+    else
+    {
+        put_format(&line, ",\"crc32\":null");
+    }
+
+    put_format(&line, ",\"stages_ms\":{");
+    for(int i = 0; i < report -> stages; i++)
+    {
+        put_format(&line, "%s\"%s\":%.3f", i > 0 ? "," : "", report -> stage[i].name, report -> stage[i].ms);
+    }
+    put_format(&line, "},\"total_ms\":%.3f}\n", report -> total_ms);
+    if(line.overflow)
+    {
+        return e_failure;
+    }
+
+    // fd:N is already open (e.g. a pipe to the orchestrator), anything else is a file to append to
+    if(strncmp(target, "fd:", 3) == 0)
+    {
+        char *end;
+        long n = strtol(target + 3, &end, 10);
+        if(*end != '\0' || n < 0 || end == target + 3)
+        {
+            return e_failure;
+        }
+        return write(n, line.buf, line.len) == (ssize_t)line.len ? e_success : e_failure;
+    }
+
+    if((fd = open(target, O_WRONLY | O_CREAT | O_APPEND, 0666)) < 0)
+    {
+        perror("open");
+        return e_failure;
+    }
+    Status ret = write(fd, line.buf, line.len) == (ssize_t)line.len ? e_success : e_failure;
+    if(close(fd) != 0)
+    {
+        ret = e_failure;
+    }
+    return ret;
+}
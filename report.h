@@ -0,0 +1,84 @@
+#ifndef REPORT_H
+#define REPORT_H
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Machine readable job report.
+ * Jobs record the first error that ends them, the time spent
+ * in each stage, the payload size against what the carrier
+ * holds and the CRC-32 of the secret. main() turns the error
+ * into the exit code and, with --json, writes the report as
+ * one JSON object per line to a file (appended) or to an
+ * already open descriptor (fd:N).
+ *
+ * Every report_* call accepts a NULL report, so code shared
+ * with the daemon needs no checks of its own.
+ */
+
+#define REPORT_MAX_STAGES 8     // Stages timed per job
+
+/* Failure classes, also the exit codes of the process */
+typedef enum
+{
+    e_err_none = 0,         // Job succeeded
+    e_err_failed = 1,       // Failure not classified below
+    e_err_usage = 2,        // Invalid arguments
+    e_err_open = 3,         // Input or output file could not be opened
+    e_err_format = 4,       // Not a BMP / no stego header / unsupported layout
+    e_err_capacity = 5,     // Payload does not fit the carrier
+    e_err_corrupt = 6,      // Header out of range or damage beyond repair
+    e_err_io = 7,           // Read or write failed part way
+    e_err_mismatch = 8      // Verify: image does not carry the secret
+} StegError;
+
+/* Time spent in one stage */
+typedef struct _ReportStage
+{
+    const char *name;
+    double ms;
+} ReportStage;
+
+typedef struct _JobReport
+{
+    const char *op;             // "encode", "decode", ...
+    const char *input;          // Carrier or stego image
+    const char *output;         // Stego image or decoded file, once known
+    StegError error;            // First error recorded
+
+    /* Stage timings */
+    ReportStage stage[REPORT_MAX_STAGES];
+    int stages;
+    double job_start;           // Seconds, monotonic
+    double stage_start;
+    double total_ms;
+
+    /* Payload */
+    uint64_t bytes;             // Secret bytes embedded or decoded
+    uint64_t offset;            // Secret byte the output starts at, only -sd --from sets it
+    uint64_t payload_bytes;     // Bytes the payload takes in the carrier's layout, headers and FEC included
+    uint64_t capacity_bytes;    // Payload bytes the carrier can hold
+    int want_crc;               // 1 to checksum the secret, only done for --json
+    int has_crc;
+    uint32_t crc;               // CRC-32 of the secret bytes
+} JobReport;
+
+/* Start timing a job */
+void report_start(JobReport *report, const char *op, const char *input);
+
+/* End the current stage and start the named one */
+void report_stage(JobReport *report, const char *name);
+
+/* Record why the job failed, the first error is kept */
+void report_error(JobReport *report, StegError error);
+
+/* End the last stage, returns the exit code for the job's status */
+int report_finish(JobReport *report, Status status);
+
+/* Append the report as one JSON line to a file name or fd:N */
+Status report_write(const JobReport *report, const char *target);
+
+/* Name of an error class as it appears in the report */
+const char *report_error_name(StegError error);
+
+#endif
@@ -0,0 +1,1053 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "sequence.h"
+#include "encode.h"
+#include "decode.h"
+#include "context.h"
+#include "aio.h"
+#include "fec.h"
+#include "types.h"
+#include "common.h"
+
+#define SEQ_COPY_BLOCK (64 * 1024)  // Bytes per block when copying without the I/O service
+
+/* Buffers of one worker, grown to the largest frame it handles */
+typedef struct
+{
+    unsigned char *carrier;     // Image header and payload window of a frame
+    size_t carrier_size;
+    unsigned char *data;        // Frame record and chunk
+    size_t data_size;
+} SeqBuffers;
+
+/* State shared by the workers of one job */
+typedef struct _SeqPool
+{
+    SeqInfo *seq;
+    const char *pattern;        // Frames the workers read
+    uint begin;                 // First frame to handle
+    uint end;                   // One past the last
+    uint word;                  // Layout word every frame carries
+    const SeqRecord *probe;     // -sd: record of the first frame, the others must match it
+    int out_fd;                 // -sd: decoded output
+    Status (*handle)(struct _SeqPool *pool, uint i, SeqBuffers *buf);
+    atomic_uint next;           // Next frame to take
+    atomic_uint prefetched;     // Frames up to here were read ahead
+    atomic_int error;           // StegError of the first failed frame
+} SeqPool;
+
+/* Function Definitions */
+
+/* Read exactly len bytes at offset */
+static Status read_at(int fd, unsigned char *buf, size_t len, off_t offset)
+{
+    while(len > 0)
+    {
+        ssize_t got = pread(fd, buf, len, offset);
+        if(got <= 0)
+        {
+            return e_failure;
+        }
+        buf += got;
+        len -= got;
+        offset += got;
+    }
+    return e_success;
+}
+
+/* Write exactly len bytes at offset */
+static Status write_at(int fd, const unsigned char *buf, size_t len, off_t offset)
+{
+    while(len > 0)
+    {
+        ssize_t put = pwrite(fd, buf, len, offset);
+        if(put <= 0)
+        {
+            return e_failure;
+        }
+        buf += put;
+        len -= put;
+        offset += put;
+    }
+    return e_success;
+}
+
+/* Make sure a worker buffer holds len bytes */
+static Status grow(unsigned char **buf, size_t *size, size_t len)
+{
+    if(len > *size)
+    {
+        unsigned char *bigger = realloc(*buf, len);
+        if(bigger == NULL)
+        {
+            return e_failure;
+        }
+        *buf = bigger;
+        *size = len;
+    }
+    return e_success;
+}
+
+/* Copy len bytes at offset from src to dest, when the I/O service is not available */
+static Status copy_range(int src_fd, int dest_fd, off_t offset, size_t len)
+{
+    unsigned char block[SEQ_COPY_BLOCK];
+
+    while(len > 0)
+    {
+        size_t n = len < sizeof(block) ? len : sizeof(block);
+        if(read_at(src_fd, block, n, offset) == e_failure || write_at(dest_fd, block, n, offset) == e_failure)
+        {
+            return e_failure;
+        }
+        offset += n;
+        len -= n;
+    }
+    return e_success;
+}
+
+/* A frame pattern: a .bmp or .ppm name with exactly one %d conversion, e.g. "clip/f%04d.bmp" */
+static int valid_pattern(const char *pattern)
+{
+    const char *conv = strchr(pattern, '%');
+
+    if(pattern[0] == '.' || (strstr(pattern, ".bmp") == NULL && strstr(pattern, ".ppm") == NULL) || conv == NULL)
+    {
+        return 0;
+    }
+
+    // Optional zero padding and width, then d and no other conversion
+    conv++;
+    while(*conv >= '0' && *conv <= '9')
+    {
+        conv++;
+    }
+    return *conv == 'd' && strchr(conv, '%') == NULL;
+}
+
+/* File name of frame index i */
+static Status frame_name(const SeqInfo *seqInfo, const char *pattern, uint i, char *name)
+{
+    int len = snprintf(name, SEQ_MAX_PATH, pattern, (int)(seqInfo -> first + i));
+
+    return len > 0 && len < SEQ_MAX_PATH ? e_success : e_failure;
+}
+
+/* Find the frames of pattern: numbered from 0, or from 1 without a frame 0, up to the first gap */
+static Status count_frames(SeqInfo *seqInfo, const char *pattern)
+{
+    char name[SEQ_MAX_PATH];
+
+    seqInfo -> first = 0;
+    seqInfo -> count = 0;
+    if(frame_name(seqInfo, pattern, 0, name) == e_success && access(name, F_OK) != 0)
+    {
+        seqInfo -> first = 1;
+    }
+    while(seqInfo -> count < SEQ_MAX_FRAMES && frame_name(seqInfo, pattern, seqInfo -> count, name) == e_success && access(name, F_OK) == 0)
+    {
+        seqInfo -> count++;
+    }
+
+    if(seqInfo -> count == 0)
+    {
+        printf("ERROR: No frames found for %s\n", pattern);
+        return e_failure;
+    }
+    if((seqInfo -> frames = calloc(seqInfo -> count, sizeof(SeqFrame))) == NULL)
+    {
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Next number of a PPM header, after whitespace and comments; pos moves past it, -1 when there is none */
+static long ppm_number(const unsigned char *header, size_t len, size_t *pos)
+{
+    long value = 0;
+    size_t digits = 0;
+
+    while(*pos < len && (header[*pos] == '#' || header[*pos] == ' ' || (header[*pos] >= '\t' && header[*pos] <= '\r')))
+    {
+        if(header[*pos] == '#')     // Comment up to the end of the line
+        {
+            while(*pos < len && header[*pos] != '\n')
+            {
+                (*pos)++;
+            }
+        }
+        else
+        {
+            (*pos)++;
+        }
+    }
+    while(*pos < len && header[*pos] >= '0' && header[*pos] <= '9' && digits < 9)
+    {
+        value = value * 10 + (header[(*pos)++] - '0');
+        digits++;
+    }
+    return digits > 0 ? value : -1;
+}
+
+/* Length of a P6 header: magic, width, height and maxval, then one whitespace byte; 0 when it is not one */
+static size_t ppm_header_size(const unsigned char *header, size_t len)
+{
+    size_t pos = 2;
+
+    if(len < 2 || header[0] != 'P' || header[1] != '6')
+    {
+        return 0;
+    }
+    long width = ppm_number(header, len, &pos);
+    long height = ppm_number(header, len, &pos);
+    long maxval = ppm_number(header, len, &pos);
+
+    // One byte per sample only, and a single whitespace before the pixels
+    if(width <= 0 || height <= 0 || maxval <= 0 || maxval > 255 || pos >= len ||
+       !(header[pos] == ' ' || (header[pos] >= '\t' && header[pos] <= '\r')))
+    {
+        return 0;
+    }
+    return pos + 1;
+}
+
+/* Header length, pixel bytes, pixel size and row width of a frame, from its BMP or PPM header
+ * Description: width is 0 for PPM, whose rows have no padding
+ */
+static Status read_frame_header(int fd, SeqFrame *frame, uint *bytes_per_pixel, uint *width)
+{
+    unsigned char header[SEQ_MAX_PPM_HEADER];
+    CodecContext bmp = {0};     // Only its header cache is used
+    struct stat st;
+    size_t len;
+
+    if(fstat(fd, &st) != 0 || st.st_size < BMP_HEADER_SIZE + LSB_EXT_HEADER_BYTES)
+    {
+        return e_failure;
+    }
+    len = st.st_size < SEQ_MAX_PPM_HEADER ? (size_t)st.st_size : SEQ_MAX_PPM_HEADER;
+    if(read_at(fd, header, len, 0) == e_failure)
+    {
+        return e_failure;
+    }
+
+    if(header[0] == 'P')        // Binary PPM: 3 bytes per pixel after the text header
+    {
+        frame -> header = ppm_header_size(header, len);
+        frame -> rgb = 1;
+        *bytes_per_pixel = 3;
+        *width = 0;
+        if(frame -> header == 0 || (size_t)st.st_size < frame -> header + LSB_EXT_HEADER_BYTES)
+        {
+            return e_failure;
+        }
+    }
+    else
+    {
+        codec_ctx_parse_header(&bmp, header);
+        frame -> header = BMP_HEADER_SIZE;
+        frame -> rgb = 0;
+        *bytes_per_pixel = bmp.bits_per_pixel / 8;
+        *width = bmp.width;
+    }
+    frame -> data_size = st.st_size - frame -> header;
+    return e_success;
+}
+
+/* Layout of a frame: the job's layout at the frame's pixel size, channels mirrored for PPM's red, green, blue */
+static LsbLayout frame_layout(const SeqFrame *frame, LsbLayout layout, uint bytes_per_pixel)
+{
+    uint mask = layout.channel_mask;
+
+    layout.bytes_per_pixel = bytes_per_pixel;
+    if(frame -> rgb && (mask & LSB_CHANNEL_ALL) != LSB_CHANNEL_ALL)
+    {
+        layout.channel_mask = (mask & LSB_CHANNEL_GREEN) | ((mask & LSB_CHANNEL_BLUE) ? LSB_CHANNEL_RED : 0) | ((mask & LSB_CHANNEL_RED) ? LSB_CHANNEL_BLUE : 0);
+    }
+    return layout;
+}
+
+/* Secret bytes a frame holds after its magic string, layout word and record */
+static size_t frame_capacity(const SeqFrame *frame)
+{
+    const LsbCodec *codec = frame -> codec;
+    size_t stream = lsb_data_bytes(codec, lsb_phase(codec, LSB_EXT_HEADER_BYTES), frame -> data_size - LSB_EXT_HEADER_BYTES);
+
+    if(stream <= SEQ_RECORD_BYTES)
+    {
+        return 0;
+    }
+
+    // The record stores a 32 bit chunk length
+    stream -= SEQ_RECORD_BYTES;
+    return stream < UINT32_MAX ? stream : UINT32_MAX;
+}
+
+/* Carrier bytes from the start of pixel data to the end of a frame's chunk */
+static size_t frame_window(const SeqFrame *frame)
+{
+    const LsbCodec *codec = frame -> codec;
+
+    return LSB_EXT_HEADER_BYTES + lsb_carrier_bytes(codec, lsb_phase(codec, LSB_EXT_HEADER_BYTES), SEQ_RECORD_BYTES + frame -> chunk);
+}
+
+/* Pack a frame record into SEQ_RECORD_BYTES bytes */
+void seq_record_store(unsigned char *buf, const SeqRecord *record)
+{
+    size_t extn_len = strlen(record -> extn);
+
+    lsb_store_be32(buf, record -> id);
+    lsb_store_be32(buf + 4, record -> index);
+    lsb_store_be32(buf + 8, record -> total);
+    lsb_store_be32(buf + 12, record -> offset >> 32);
+    lsb_store_be32(buf + 16, record -> offset);
+    lsb_store_be32(buf + 20, record -> chunk);
+    lsb_store_be32(buf + 24, record -> size >> 32);
+    lsb_store_be32(buf + 28, record -> size);
+    lsb_store_be32(buf + 32, record -> crc);
+    buf[36] = extn_len;
+    memset(buf + 37, 0, MAX_SEQ_SUFFIX);
+    memcpy(buf + 37, record -> extn, extn_len);
+}
+
+/* Unpack a frame record, e_failure when its extension is not one the encoder writes */
+Status seq_record_load(SeqRecord *record, const unsigned char *buf)
+{
+    uint extn_len = buf[36];
+
+    record -> id = lsb_load_be32(buf);
+    record -> index = lsb_load_be32(buf + 4);
+    record -> total = lsb_load_be32(buf + 8);
+    record -> offset = (uint64_t)lsb_load_be32(buf + 12) << 32 | lsb_load_be32(buf + 16);
+    record -> chunk = lsb_load_be32(buf + 20);
+    record -> size = (uint64_t)lsb_load_be32(buf + 24) << 32 | lsb_load_be32(buf + 28);
+    record -> crc = lsb_load_be32(buf + 32);
+
+    // The extension becomes part of the output name
+    if(extn_len > MAX_SEQ_SUFFIX)
+    {
+        return e_failure;
+    }
+    memcpy(record -> extn, buf + 37, extn_len);
+    record -> extn[extn_len] = '\0';
+    return strlen(record -> extn) == extn_len && strchr(record -> extn, '/') == NULL ? e_success : e_failure;
+}
+
+/* Record the error class of a failed frame, the first one is kept */
+static void pool_fail(SeqPool *pool, StegError error)
+{
+    int none = e_err_none;
+
+    atomic_compare_exchange_strong(&pool -> error, &none, error);
+}
+
+/* Ask the kernel to read ahead the frames up to i + SEQ_PREFETCH_FRAMES, each frame once */
+static void prefetch_frames(SeqPool *pool, uint i)
+{
+    uint want = i + SEQ_PREFETCH_FRAMES < pool -> end ? i + SEQ_PREFETCH_FRAMES : pool -> end - 1;
+    uint have = atomic_load(&pool -> prefetched);
+    char name[SEQ_MAX_PATH];
+    int fd;
+
+    // Claim frames (have, want], frames past those are left to later workers
+    while(have < want && !atomic_compare_exchange_weak(&pool -> prefetched, &have, want))
+    {
+        // have was reloaded, try again
+    }
+    for(uint j = have + 1; j <= want; j++)
+    {
+        if(frame_name(pool -> seq, pool -> pattern, j, name) == e_success && (fd = open(name, O_RDONLY)) >= 0)
+        {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            close(fd);
+        }
+    }
+}
+
+/* Take frames until none are left */
+static void *seq_worker(void *arg)
+{
+    SeqPool *pool = arg;
+    SeqBuffers buf = { NULL, 0, NULL, 0 };
+
+    while(atomic_load(&pool -> error) == e_err_none)
+    {
+        uint i = atomic_fetch_add(&pool -> next, 1);
+        if(i >= pool -> end)
+        {
+            break;
+        }
+        prefetch_frames(pool, i);
+
+        // Handlers record a precise error class, this only catches the rest
+        if(pool -> handle(pool, i, &buf) == e_failure)
+        {
+            pool_fail(pool, e_err_io);
+        }
+    }
+
+    free(buf.carrier);
+    free(buf.data);
+    return NULL;
+}
+
+/* Handle frames begin to end on a pool of workers, returns the error class of the first failure */
+static StegError run_pool(SeqPool *pool)
+{
+    pthread_t tids[SEQ_MAX_THREADS];
+    size_t started = 0;
+
+    atomic_init(&pool -> next, pool -> begin);
+    atomic_init(&pool -> prefetched, pool -> begin);
+    atomic_init(&pool -> error, e_err_none);
+
+    // One worker per core, no more than there are frames
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = pool -> end - pool -> begin < SEQ_MAX_THREADS ? pool -> end - pool -> begin : SEQ_MAX_THREADS;
+    if(cpus > 0 && nthreads > (size_t)cpus)
+    {
+        nthreads = cpus;
+    }
+
+    // This thread is worker 0; frames of a thread that fails to start go to the others
+    for(size_t t = 1; t < nthreads; t++)
+    {
+        if(pthread_create(&tids[t], NULL, seq_worker, pool) == 0)
+        {
+            started |= 1UL << t;
+        }
+    }
+    seq_worker(pool);
+
+    for(size_t t = 1; t < nthreads; t++)
+    {
+        if(started & (1UL << t))
+        {
+            pthread_join(tids[t], NULL);
+        }
+    }
+    return atomic_load(&pool -> error);
+}
+
+/* Id shared by the frames of one encoding, so frames of another one are not mixed in */
+static uint new_sequence_id(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint)ts.tv_sec * 2654435761u) ^ (uint)ts.tv_nsec ^ ((uint)getpid() << 16);
+}
+
+/* Read and validate sequence encode args: -se <frames> <secret> <stego frames> [layout options] */
+Status read_and_validate_seq_encode_args(char *argv[], SeqInfo *seqInfo)
+{
+    EncodeInfo opts = {0};      // Layout options are read as for -e
+    const char *base;
+    const char *dot;
+
+    if(!valid_pattern(argv[2]) || argv[3][0] == '.' || !valid_pattern(argv[4]) || strcmp(argv[2], argv[4]) == 0)
+    {
+        return e_failure;
+    }
+    seqInfo -> src_pattern = argv[2];
+    seqInfo -> secret_fname = argv[3];
+    seqInfo -> stego_pattern = argv[4];
+
+    // Extension of the secret file name, stored in every frame record
+    base = strrchr(argv[3], '/') != NULL ? strrchr(argv[3], '/') + 1 : argv[3];
+    dot = strrchr(base, '.');
+    if(dot != NULL && strlen(dot) > MAX_SEQ_SUFFIX)
+    {
+        return e_failure;
+    }
+    strcpy(seqInfo -> extn, dot != NULL ? dot : "");
+
+    if(read_layout_options(argv + 5, &opts) == e_failure)
+    {
+        return e_failure;
+    }
+    if(opts.layout.adaptive || opts.layout.fec || opts.analyze)
+    {
+        printf("Error: --adaptive, --fec and --analyze do not apply to frame sequences\n");
+        return e_failure;
+    }
+
+    // Fields left zero keep their original meaning, pixel size comes from each frame
+    seqInfo -> layout = opts.layout;
+    if(seqInfo -> layout.bits == 0)
+    {
+        seqInfo -> layout.bits = 1;
+    }
+    if(seqInfo -> layout.channel_mask == 0)
+    {
+        seqInfo -> layout.channel_mask = LSB_CHANNEL_ALL;
+    }
+    return e_success;
+}
+
+/* Read and validate sequence decode args: -sd <stego frames> [output] [--from N] */
+Status read_and_validate_seq_decode_args(char *argv[], SeqInfo *seqInfo)
+{
+    int i = 3;
+
+    if(!valid_pattern(argv[2]))
+    {
+        return e_failure;
+    }
+    seqInfo -> stego_pattern = argv[2];
+    seqInfo -> output_fname = "output";     // Default output name
+    seqInfo -> from = -1;
+
+    if(argv[3] != NULL && strncmp(argv[3], "--", 2) != 0)
+    {
+        seqInfo -> output_fname = argv[3];
+        i = 4;
+    }
+
+    for(; argv[i] != NULL; i++)
+    {
+        // Frame number, as in the file names, to start decoding at
+        if(strcmp(argv[i], "--from") == 0 && argv[i + 1] != NULL && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9')
+        {
+            seqInfo -> from = atol(argv[++i]);
+        }
+        else
+        {
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+/* Read every frame's header and lay the secret over the frames in order */
+static Status plan_frames(SeqInfo *seqInfo)
+{
+    char name[SEQ_MAX_PATH];
+    uint64_t offset = 0;
+    uint64_t capacity = 0;
+    uint bytes_per_pixel, width;
+    int fd;
+
+    seqInfo -> used = 0;
+    for(uint i = 0; i < seqInfo -> count; i++)
+    {
+        SeqFrame *frame = &seqInfo -> frames[i];
+        LsbLayout layout;
+
+        if(frame_name(seqInfo, seqInfo -> src_pattern, i, name) == e_failure || (fd = open(name, O_RDONLY)) < 0)
+        {
+            printf("ERROR: Unable to open frame %s\n", name);
+            report_error(seqInfo -> report, e_err_open);
+            return e_failure;
+        }
+        Status ret = read_frame_header(fd, frame, &bytes_per_pixel, &width);
+        close(fd);
+
+        layout = frame_layout(frame, seqInfo -> layout, bytes_per_pixel);
+        if(ret == e_failure || (frame -> codec = lsb_codec_lookup(&layout)) == NULL)
+        {
+            printf("Error: Frame %s is not a BMP or PPM image the layout supports\n", name);
+            report_error(seqInfo -> report, e_err_format);
+            return e_failure;
+        }
+        if(!lsb_channels_fit_rows(&layout, width))
+        {
+            printf("Error: --channels needs rows without padding, frame %s is %u pixels of %u bytes wide\n", name, width, bytes_per_pixel);
+            report_error(seqInfo -> report, e_err_format);
+            return e_failure;
+        }
+
+        // Each frame takes what it holds until the secret runs out; an empty secret still needs frame 0 for its record
+        size_t room = frame_capacity(frame);
+        if(room == 0 && (offset < seqInfo -> size || i == 0))
+        {
+            printf("Error: Frame %s is too small to carry data\n", name);
+            report_error(seqInfo -> report, e_err_capacity);
+            return e_failure;
+        }
+        if(offset < seqInfo -> size || i == 0)
+        {
+            seqInfo -> used = i + 1;
+        }
+        frame -> offset = offset;
+        frame -> chunk = seqInfo -> size - offset < room ? seqInfo -> size - offset : room;
+        offset += frame -> chunk;
+        capacity += room;
+    }
+
+    // Records and chunks against what the frames hold
+    if(seqInfo -> report != NULL)
+    {
+        seqInfo -> report -> payload_bytes = seqInfo -> size + (uint64_t)seqInfo -> used * SEQ_RECORD_BYTES;
+        seqInfo -> report -> capacity_bytes = capacity + (uint64_t)seqInfo -> count * SEQ_RECORD_BYTES;
+    }
+
+    if(offset < seqInfo -> size)
+    {
+        printf("Error: The %u frames hold %llu bytes, the secret has %llu\n", seqInfo -> count, (unsigned long long)capacity, (unsigned long long)seqInfo -> size);
+        report_error(seqInfo -> report, e_err_capacity);
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Embed the magic string, layout word, record and chunk of frame i into its header and window */
+static Status embed_window(SeqPool *pool, uint i, SeqBuffers *buf, int src_fd, int stego_fd, size_t head)
+{
+    SeqInfo *seqInfo = pool -> seq;
+    SeqFrame *frame = &seqInfo -> frames[i];
+    const LsbCodec *codec = frame -> codec;
+    SeqRecord record;
+    unsigned char field[4];
+
+    if(grow(&buf -> carrier, &buf -> carrier_size, head) == e_failure || grow(&buf -> data, &buf -> data_size, SEQ_RECORD_BYTES + frame -> chunk) == e_failure)
+    {
+        return e_failure;
+    }
+    if(read_at(src_fd, buf -> carrier, head, 0) == e_failure || read_at(seqInfo -> secret_fd, buf -> data + SEQ_RECORD_BYTES, frame -> chunk, frame -> offset) == e_failure)
+    {
+        return e_failure;
+    }
+
+    record.id = seqInfo -> id;
+    record.index = i;
+    record.total = seqInfo -> used;
+    record.offset = frame -> offset;
+    record.chunk = frame -> chunk;
+    record.size = seqInfo -> size;
+    record.crc = fec_crc32(0, buf -> data + SEQ_RECORD_BYTES, frame -> chunk);
+    strcpy(record.extn, seqInfo -> extn);
+    seq_record_store(buf -> data, &record);
+
+    // Magic string and layout word at 1 bit per byte, record and chunk in the job's layout
+    unsigned char *pixels = buf -> carrier + frame -> header;
+    lsb_codec_default.embed(pixels, 0, (const unsigned char *)MAGIC_STRING_SEQ, strlen(MAGIC_STRING_SEQ));
+    lsb_store_be32(field, pool -> word);
+    lsb_codec_default.embed(pixels + strlen(MAGIC_STRING_SEQ) * 8, 0, field, 4);
+    codec -> embed(pixels + LSB_EXT_HEADER_BYTES, lsb_phase(codec, LSB_EXT_HEADER_BYTES), buf -> data, SEQ_RECORD_BYTES + frame -> chunk);
+
+    return write_at(stego_fd, buf -> carrier, head, 0);
+}
+
+/* Write stego frame i: its window embedded, the rest copied, frames past the payload copied whole */
+static Status embed_frame(SeqPool *pool, uint i, SeqBuffers *buf)
+{
+    SeqInfo *seqInfo = pool -> seq;
+    SeqFrame *frame = &seqInfo -> frames[i];
+    char name[SEQ_MAX_PATH];
+    int src_fd, stego_fd;
+    AioCopy tail;
+    int tail_async = 0;
+    Status ret = e_failure;
+
+    if(frame_name(seqInfo, seqInfo -> src_pattern, i, name) == e_failure || (src_fd = open(name, O_RDONLY)) < 0)
+    {
+        printf("ERROR: Unable to open frame %s\n", name);
+        pool_fail(pool, e_err_open);
+        return e_failure;
+    }
+    if(frame_name(seqInfo, seqInfo -> stego_pattern, i, name) == e_failure || (stego_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+    {
+        printf("ERROR: Unable to open frame %s\n", name);
+        close(src_fd);
+        pool_fail(pool, e_err_open);
+        return e_failure;
+    }
+
+    size_t head = i < seqInfo -> used ? frame -> header + frame_window(frame) : 0;
+    size_t total = frame -> header + frame -> data_size;
+
+    // The untouched rest of the frame is copied while the window is embedded
+    if(aio_copy_start(&tail, src_fd, head, stego_fd, head, total - head) == e_success)
+    {
+        tail_async = 1;
+    }
+
+    if(head == 0 || embed_window(pool, i, buf, src_fd, stego_fd, head) == e_success)
+    {
+        ret = tail_async ? aio_copy_wait(&tail) : copy_range(src_fd, stego_fd, head, total - head);
+        tail_async = 0;
+    }
+
+    // Never close files under a copy that is still in flight
+    if(tail_async)
+    {
+        aio_copy_wait(&tail);
+    }
+    if(close(stego_fd) != 0)
+    {
+        ret = e_failure;
+    }
+    close(src_fd);
+
+    if(ret == e_failure)
+    {
+        pool_fail(pool, e_err_io);
+    }
+    return ret;
+}
+
+/* Embed the secret over the frames, writing every frame of the sequence */
+Status do_seq_encoding(SeqInfo *seqInfo)
+{
+    SeqPool pool;
+    struct stat st;
+    Status ret = e_failure;
+
+    seqInfo -> frames = NULL;
+    seqInfo -> secret_fd = -1;
+    if(seqInfo -> report != NULL)
+    {
+        seqInfo -> report -> output = seqInfo -> stego_pattern;
+    }
+
+    /* Find the frames and open the secret file */
+    report_stage(seqInfo -> report, "open");
+    if(count_frames(seqInfo, seqInfo -> src_pattern) == e_success && (seqInfo -> secret_fd = open(seqInfo -> secret_fname, O_RDONLY)) >= 0 && fstat(seqInfo -> secret_fd, &st) == 0)
+    {
+        seqInfo -> size = st.st_size;
+        printf("Found %u frames, secret file size: %llu bytes\n", seqInfo -> count, (unsigned long long)seqInfo -> size);
+
+        /* Lay the secret over the frames */
+        report_stage(seqInfo -> report, "capacity");
+        if(plan_frames(seqInfo) == e_success)
+        {
+            printf("Secret spread over %u of %u frames\n", seqInfo -> used, seqInfo -> count);
+            if(seqInfo -> report != NULL)
+            {
+                seqInfo -> report -> bytes = seqInfo -> size;
+            }
+
+            /* Embed and write the frames on the worker pool */
+            memset(&pool, 0, sizeof(pool));
+            seqInfo -> id = new_sequence_id();
+            pool.seq = seqInfo;
+            pool.pattern = seqInfo -> src_pattern;
+            pool.begin = 0;
+            pool.end = seqInfo -> count;
+            pool.word = lsb_layout_to_word(&seqInfo -> layout);
+            pool.handle = embed_frame;
+
+            report_stage(seqInfo -> report, "embed");
+            StegError error = run_pool(&pool);
+            if(error == e_err_none)
+            {
+                printf("Encoded %u frames Successfully...\n", seqInfo -> count);
+                ret = e_success;
+            }
+            else
+            {
+                report_error(seqInfo -> report, error);
+            }
+        }
+    }
+    else
+    {
+        if(seqInfo -> frames != NULL)
+        {
+            perror("open");
+            fprintf(stderr, "ERROR: Unable to open file %s\n", seqInfo -> secret_fname);
+        }
+        report_error(seqInfo -> report, e_err_open);
+    }
+
+    if(seqInfo -> secret_fd >= 0)
+    {
+        close(seqInfo -> secret_fd);
+        seqInfo -> secret_fd = -1;
+    }
+    free(seqInfo -> frames);
+    seqInfo -> frames = NULL;
+    return ret;
+}
+
+/* Read and check the magic string, layout word and record of frame i
+ * Description: the first frame read (no probe yet) sets the
+ * layout word, every later one must carry the same word, id,
+ * frame total and secret size
+ */
+static Status read_frame_record(SeqPool *pool, uint i, int fd, SeqRecord *record, SeqBuffers *buf)
+{
+    SeqInfo *seqInfo = pool -> seq;
+    SeqFrame *frame = &seqInfo -> frames[i];
+    LsbLayout layout;
+    uint bytes_per_pixel, width;
+    unsigned char field[4];
+    char magic[sizeof(MAGIC_STRING_SEQ)] = "";
+
+    // Decoding reads the channels the frame was written with, padded or not
+    if(read_frame_header(fd, frame, &bytes_per_pixel, &width) == e_failure || grow(&buf -> carrier, &buf -> carrier_size, LSB_EXT_HEADER_BYTES) == e_failure ||
+       read_at(fd, buf -> carrier, LSB_EXT_HEADER_BYTES, frame -> header) == e_failure)
+    {
+        printf("Error: Frame %u is not a BMP or PPM image\n", seqInfo -> first + i);
+        pool_fail(pool, e_err_format);
+        return e_failure;
+    }
+
+    // Magic string and layout word, 1 bit per carrier byte
+    lsb_codec_default.extract(buf -> carrier, 0, (unsigned char *)magic, strlen(MAGIC_STRING_SEQ));
+    lsb_codec_default.extract(buf -> carrier + strlen(MAGIC_STRING_SEQ) * 8, 0, field, 4);
+    uint word = lsb_load_be32(field);
+    lsb_layout_from_word(&layout, word, bytes_per_pixel);
+    layout = frame_layout(frame, layout, bytes_per_pixel);
+    if(memcmp(magic, MAGIC_STRING_SEQ, strlen(MAGIC_STRING_SEQ)) != 0 || layout.adaptive || layout.fec || layout.container ||
+       (frame -> codec = lsb_codec_lookup(&layout)) == NULL)
+    {
+        printf("Error: Frame %u carries no sequence header\n", seqInfo -> first + i);
+        pool_fail(pool, e_err_format);
+        return e_failure;
+    }
+
+    // Record in the frame's layout
+    const LsbCodec *codec = frame -> codec;
+    size_t phase = lsb_phase(codec, LSB_EXT_HEADER_BYTES);
+    size_t span = lsb_carrier_bytes(codec, phase, SEQ_RECORD_BYTES);
+    if(grow(&buf -> carrier, &buf -> carrier_size, span) == e_failure || grow(&buf -> data, &buf -> data_size, SEQ_RECORD_BYTES) == e_failure ||
+       read_at(fd, buf -> carrier, span, frame -> header + LSB_EXT_HEADER_BYTES) == e_failure)
+    {
+        printf("Error: Frame %u is truncated\n", seqInfo -> first + i);
+        pool_fail(pool, e_err_corrupt);
+        return e_failure;
+    }
+    codec -> extract(buf -> carrier, phase, buf -> data, SEQ_RECORD_BYTES);
+
+    if(seq_record_load(record, buf -> data) == e_failure || record -> index != i || record -> index >= record -> total ||
+       record -> offset > record -> size || record -> chunk > record -> size - record -> offset || record -> chunk > frame_capacity(frame))
+    {
+        printf("Error: Frame %u has a damaged record\n", seqInfo -> first + i);
+        pool_fail(pool, e_err_corrupt);
+        return e_failure;
+    }
+
+    if(pool -> probe == NULL)
+    {
+        pool -> word = word;
+    }
+    else if(word != pool -> word || record -> id != pool -> probe -> id || record -> total != pool -> probe -> total || record -> size != pool -> probe -> size)
+    {
+        printf("Error: Frame %u belongs to another sequence\n", seqInfo -> first + i);
+        pool_fail(pool, e_err_format);
+        return e_failure;
+    }
+
+    frame -> offset = record -> offset;
+    frame -> chunk = record -> chunk;
+    return e_success;
+}
+
+/* Decode the chunk of frame i and write it at its offset in the output */
+static Status extract_frame(SeqPool *pool, uint i, SeqBuffers *buf)
+{
+    SeqInfo *seqInfo = pool -> seq;
+    SeqFrame *frame = &seqInfo -> frames[i];
+    char name[SEQ_MAX_PATH];
+    SeqRecord record;
+    Status ret = e_failure;
+    int fd;
+
+    if(frame_name(seqInfo, pool -> pattern, i, name) == e_failure || (fd = open(name, O_RDONLY)) < 0)
+    {
+        printf("ERROR: Unable to open frame %s\n", name);
+        pool_fail(pool, e_err_open);
+        return e_failure;
+    }
+
+    if(read_frame_record(pool, i, fd, &record, buf) == e_success)
+    {
+        // The chunk continues the stream right after the record
+        const LsbCodec *codec = frame -> codec;
+        size_t pos = LSB_EXT_HEADER_BYTES + lsb_carrier_bytes(codec, lsb_phase(codec, LSB_EXT_HEADER_BYTES), SEQ_RECORD_BYTES);
+        size_t phase = lsb_phase(codec, pos);
+        size_t span = lsb_carrier_bytes(codec, phase, record.chunk);
+
+        if(grow(&buf -> carrier, &buf -> carrier_size, span) == e_failure || grow(&buf -> data, &buf -> data_size, record.chunk) == e_failure)
+        {
+            pool_fail(pool, e_err_failed);
+        }
+        else if(read_at(fd, buf -> carrier, span, frame -> header + pos) == e_failure)
+        {
+            printf("Error: Frame %u is truncated\n", seqInfo -> first + i);
+            pool_fail(pool, e_err_corrupt);
+        }
+        else
+        {
+            codec -> extract(buf -> carrier, phase, buf -> data, record.chunk);
+            if(fec_crc32(0, buf -> data, record.chunk) != record.crc)
+            {
+                printf("Error: Frame %u is damaged, its CRC does not match\n", seqInfo -> first + i);
+                pool_fail(pool, e_err_corrupt);
+            }
+            else if(write_at(pool -> out_fd, buf -> data, record.chunk, record.offset - pool -> probe -> offset) == e_success)
+            {
+                ret = e_success;
+            }
+        }
+    }
+
+    close(fd);
+    return ret;
+}
+
+/* Whether the decoded frames cover the secret from the first frame's chunk to its end, without gaps */
+static int chunks_cover_secret(const SeqPool *pool)
+{
+    const SeqInfo *seqInfo = pool -> seq;
+    uint64_t offset = pool -> probe -> offset;
+
+    for(uint i = pool -> begin; i < pool -> end; i++)
+    {
+        if(seqInfo -> frames[i].offset != offset)
+        {
+            return 0;
+        }
+        offset += seqInfo -> frames[i].chunk;
+    }
+    return offset == pool -> probe -> size;
+}
+
+/* Output name: the given name up to its first dot, then the stored extension */
+static void name_output(SeqInfo *seqInfo, const char *extn)
+{
+    size_t len = strcspn(seqInfo -> output_fname, ".");
+
+    if(len > MAX_OUTPUT_NAME - MAX_SEQ_SUFFIX - 1)
+    {
+        len = MAX_OUTPUT_NAME - MAX_SEQ_SUFFIX - 1;
+    }
+    memcpy(seqInfo -> output_name, seqInfo -> output_fname, len);
+    strcpy(seqInfo -> output_name + len, extn);
+    seqInfo -> output_fname = seqInfo -> output_name;
+}
+
+/* Decode the secret from the frames, from the --from frame on
+ * Description: the record of the first frame read gives the
+ * sequence's frame total, secret size and extension; the pool
+ * then decodes that frame and every later one in parallel into
+ * a temporary output holding the secret from that frame's
+ * chunk on, so with --from the output starts at that chunk's
+ * offset rather than at secret byte 0
+ */
+Status do_seq_decoding(SeqInfo *seqInfo)
+{
+    SeqPool pool;
+    SeqBuffers buf = { NULL, 0, NULL, 0 };
+    SeqRecord probe;
+    DecodeInfo out = {0};       // Temporary output, as -d writes it
+    char name[SEQ_MAX_PATH];
+    char temp_name[MAX_TEMP_NAME];
+    Status ret = e_failure;
+    int fd;
+
+    memset(&pool, 0, sizeof(pool));
+    atomic_init(&pool.error, e_err_none);
+    out.report = seqInfo -> report;
+    seqInfo -> frames = NULL;
+
+    /* Find the frames */
+    report_stage(seqInfo -> report, "open");
+    if(count_frames(seqInfo, seqInfo -> stego_pattern) == e_failure)
+    {
+        report_error(seqInfo -> report, e_err_open);
+        return e_failure;
+    }
+    if(seqInfo -> from >= 0 && (seqInfo -> from < seqInfo -> first || seqInfo -> from - seqInfo -> first >= seqInfo -> count))
+    {
+        printf("Error: Frame %ld is not in the sequence\n", seqInfo -> from);
+        report_error(seqInfo -> report, e_err_usage);
+        free(seqInfo -> frames);
+        seqInfo -> frames = NULL;
+        return e_failure;
+    }
+
+    pool.seq = seqInfo;
+    pool.pattern = seqInfo -> stego_pattern;
+    pool.begin = seqInfo -> from >= 0 ? seqInfo -> from - seqInfo -> first : 0;
+    pool.out_fd = -1;
+    pool.handle = extract_frame;
+
+    /* Record of the first frame decoded */
+    report_stage(seqInfo -> report, "header");
+    if(frame_name(seqInfo, pool.pattern, pool.begin, name) == e_failure || (fd = open(name, O_RDONLY)) < 0)
+    {
+        printf("ERROR: Unable to open frame %s\n", name);
+        pool_fail(&pool, e_err_open);
+    }
+    else
+    {
+        if(read_frame_record(&pool, pool.begin, fd, &probe, &buf) == e_success)
+        {
+            printf("Sequence of %u frames, secret file size: %llu bytes\n", probe.total, (unsigned long long)probe.size);
+            if(probe.total > seqInfo -> count)
+            {
+                printf("Error: Only %u of the %u frames were found\n", seqInfo -> count, probe.total);
+                pool_fail(&pool, e_err_open);
+            }
+            else
+            {
+                pool.probe = &probe;
+                pool.end = probe.total;
+            }
+        }
+        close(fd);
+    }
+    free(buf.carrier);
+    free(buf.data);
+
+    if(pool.probe != NULL)
+    {
+        name_output(seqInfo, probe.extn);
+        printf("--%s\n", seqInfo -> output_fname);
+        if(probe.offset > 0)
+        {
+            printf("Output starts at secret byte %llu of %llu\n", (unsigned long long)probe.offset, (unsigned long long)probe.size);
+        }
+        if(seqInfo -> report != NULL)
+        {
+            seqInfo -> report -> output = seqInfo -> output_fname;
+            seqInfo -> report -> bytes = probe.size - probe.offset;
+            seqInfo -> report -> offset = probe.offset;
+            seqInfo -> report -> payload_bytes = probe.size - probe.offset + (uint64_t)(probe.total - pool.begin) * SEQ_RECORD_BYTES;
+        }
+
+        /* Decode the frames on the worker pool, each writing its chunk in place */
+        report_stage(seqInfo -> report, "data");
+        if(open_output_temp(&out, seqInfo -> output_fname, temp_name) == e_success)
+        {
+            pool.out_fd = fileno(out.fptr_output);
+            if(ftruncate(pool.out_fd, probe.size - probe.offset) != 0)
+            {
+                pool_fail(&pool, e_err_io);
+            }
+            else if(run_pool(&pool) == e_err_none)
+            {
+                if(chunks_cover_secret(&pool))
+                {
+                    printf("Decoded secret bytes %llu to %llu from %u frames\n", (unsigned long long)probe.offset, (unsigned long long)probe.size, pool.end - pool.begin);
+                    ret = e_success;
+                }
+                else
+                {
+                    printf("Error: The frames' chunks do not cover the secret\n");
+                    pool_fail(&pool, e_err_corrupt);
+                }
+            }
+            report_error(seqInfo -> report, atomic_load(&pool.error));
+            ret = finish_output_temp(&out, seqInfo -> output_fname, temp_name, ret);
+        }
+    }
+    else
+    {
+        report_error(seqInfo -> report, atomic_load(&pool.error));
+    }
+
+    free(seqInfo -> frames);
+    seqInfo -> frames = NULL;
+    return ret;
+}
@@ -0,0 +1,122 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+#include "lsb_codec.h" // Specialised embed / extract kernels
+#include "decode.h" // Temporary output files
+#include "report.h" // Machine readable job report
+
+/*
+ * Numbered frames as one carrier.
+ * A frame pattern such as "clip/f%04d.bmp" names the frames,
+ * numbered from 0 (or 1 when there is no frame 0) up to the
+ * first missing number. Frames are BMP images or binary PPM
+ * (P6, maxval up to 255) ones, told apart by their content;
+ * PPM stores red, green, blue where BMP stores blue, green,
+ * red, so the channel mask is mirrored on PPM frames and
+ * --channels names the same colours on both. The secret is
+ * laid over the frames in order, each frame taking as many
+ * bytes as it holds, so secret byte pos lives in the frame
+ * whose chunk covers it.
+ *
+ * Every frame that carries data starts with MAGIC_STRING_SEQ
+ * and the layout word, 1 bit per carrier byte, then a frame
+ * record in the job's layout:
+ *
+ *   sequence id (32), frame index (32), frames used (32),
+ *   chunk offset (64), chunk length (32), secret size (64),
+ *   CRC-32 of the chunk (32), extension length (8) and
+ *   MAX_SEQ_SUFFIX extension bytes
+ *
+ * and then the chunk itself. A frame therefore decodes on its
+ * own: decoding can start at any frame and workers handle
+ * frames independently, each writing its chunk at its offset.
+ *
+ * Frames are taken in turn by a pool of workers; a worker
+ * taking frame i asks the kernel to read ahead frames up to
+ * i + SEQ_PREFETCH_FRAMES, and the untouched part of each
+ * frame is copied by the asynchronous I/O service while the
+ * worker embeds.
+ */
+
+#define SEQ_MAX_FRAMES 100000   // Frames per sequence
+#define SEQ_MAX_PATH 512        // Longest frame file name
+#define SEQ_MAX_THREADS 8       // Upper bound on frame workers
+#define SEQ_PREFETCH_FRAMES 2   // Frames read ahead of the one being worked on
+#define MAX_SEQ_SUFFIX 4        // Secret file extension stored in the record
+#define SEQ_MAX_PPM_HEADER 256  // Longest PPM header read, comments included
+#define SEQ_RECORD_BYTES (4 + 4 + 4 + 8 + 4 + 8 + 4 + 1 + MAX_SEQ_SUFFIX)
+
+/* Frame record, as stored in every frame that carries data */
+typedef struct _SeqRecord
+{
+    uint id;                    // Same in every frame of one encoding
+    uint index;                 // Frame index from the first frame
+    uint total;                 // Frames that carry data
+    uint64_t offset;            // Secret byte the chunk starts at
+    uint chunk;                 // Secret bytes in this frame
+    uint64_t size;              // Secret bytes in the whole sequence
+    uint crc;                   // CRC-32 of the chunk
+    char extn[MAX_SEQ_SUFFIX + 1];  // Secret file extension
+} SeqRecord;
+
+/* One frame of the sequence */
+typedef struct _SeqFrame
+{
+    size_t header;              // Bytes before the pixel data: the BMP header or the PPM text header
+    int rgb;                    // 1 for PPM frames, whose pixels are red, green, blue
+    size_t data_size;           // Pixel bytes after the header
+    const LsbCodec *codec;      // Layout for the frame's pixel size
+    uint64_t offset;            // Secret byte the chunk starts at
+    size_t chunk;               // Secret bytes in this frame, 0 past the payload
+} SeqFrame;
+
+typedef struct _SeqInfo
+{
+    /* Frame file names */
+    char *src_pattern;          // -se: carrier frames
+    char *stego_pattern;        // Stego frames written (-se) or read (-sd)
+    uint first;                 // Number of frame 0 in the file names
+    uint count;                 // Frames found
+
+    /* Secret file (-se) or decoded output (-sd) */
+    char *secret_fname;
+    char *output_fname;
+    char output_name[MAX_OUTPUT_NAME];  // Storage for output_fname once the extension is known
+    int secret_fd;
+    uint64_t size;              // Secret bytes
+    char extn[MAX_SEQ_SUFFIX + 1];
+
+    /* Embedding layout */
+    LsbLayout layout;           // Bits per byte, channels and bit order, pixel size per frame
+
+    /* Secret offset to frame mapping, chunks in frame order */
+    SeqFrame *frames;           // count of them
+    uint used;                  // Frames that carry data
+    uint id;                    // Sequence id of this encoding
+    long from;                  // -sd --from: frame number decoding starts at, -1 for the first frame; the output then starts at that frame's chunk
+
+    /* Stage timings, sizes and the error class of the job, NULL when not wanted */
+    JobReport *report;
+} SeqInfo;
+
+/* Read and validate sequence encode args: -se <frames> <secret> <stego frames> [layout options] */
+Status read_and_validate_seq_encode_args(char *argv[], SeqInfo *seqInfo);
+
+/* Read and validate sequence decode args: -sd <stego frames> [output] [--from N] */
+Status read_and_validate_seq_decode_args(char *argv[], SeqInfo *seqInfo);
+
+/* Embed the secret over the frames, writing every frame of the sequence */
+Status do_seq_encoding(SeqInfo *seqInfo);
+
+/* Decode the secret from the frames, from the --from frame on */
+Status do_seq_decoding(SeqInfo *seqInfo);
+
+/* Pack a frame record into SEQ_RECORD_BYTES bytes */
+void seq_record_store(unsigned char *buf, const SeqRecord *record);
+
+/* Unpack a frame record, e_failure when its extension is not one the encoder writes */
+Status seq_record_load(SeqRecord *record, const unsigned char *buf);
+
+#endif
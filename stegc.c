@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "stegd.h"
+#include "report.h"
+#include "types.h"
+
+#define STEGC_INLINE_MAX 4096   // Secrets up to this size travel inline instead of as an fd
+
+/* Function Definitions */
+
+/* Microseconds since start */
+static long elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start -> tv_sec) * 1000000L + (now.tv_nsec - start -> tv_nsec) / 1000;
+}
+
+/* Connect to the daemon */
+static int connect_daemon(const char *socket_path)
+{
+    struct sockaddr_un addr;
+    int sock;
+
+    if(strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(sock >= 0 && connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Write decoded data as <base up to first dot><extension>, like the CLI does */
+static Status write_decoded(const char *base, const char *extn, const char *data, size_t len)
+{
+    char name[STEGD_MAX_PATH + 8];
+    size_t i = strcspn(base, ".");
+    FILE *fptr;
+
+    if(i >= STEGD_MAX_PATH)
+    {
+        i = STEGD_MAX_PATH - 1;
+    }
+    memcpy(name, base, i);
+    name[i] = '\0';
+    strcat(name, extn);
+    printf("--%s\n", name);
+
+    if((fptr = fopen(name, "w")) == NULL)
+    {
+        perror("fopen");
+        return e_failure;
+    }
+    Status ret = fwrite(data, 1, len, fptr) == len ? e_success : e_failure;
+    fclose(fptr);
+    return ret;
+}
+
+/* Send one request built from argv ("-e", "-d", "-p" or "-s" ...) to the daemon */
+int run_client(const char *socket_path, char *argv[])
+{
+    StegdRequest req;
+    StegdResponse resp;
+    char secret_buf[STEGC_INLINE_MAX];
+    int fds[3], nfds = 0;
+    int sock;
+    struct timespec start;
+
+    memset(&req, 0, sizeof(req));
+    if(argv[0] != NULL && strcmp(argv[0], "-s") == 0)
+    {
+        req.op = e_stegd_stats;
+    }
+    else if(argv[0] == NULL || argv[1] == NULL)
+    {
+        printf("Error: Insufficient arguments\n");
+        return e_err_usage;
+    }
+
+    // Carrier / stego image always travels as an fd
+    if(req.op != e_stegd_stats)
+    {
+        if((fds[nfds++] = open(argv[1], O_RDONLY)) < 0)
+        {
+            perror("open");
+            return e_err_open;
+        }
+        req.flags |= STEGD_FD_CARRIER;
+        strncpy(req.carrier, argv[1], STEGD_MAX_PATH - 1);
+    }
+
+    if(req.op == e_stegd_stats)
+    {
+        // Counters only, no files to pass
+    }
+    else if(strcmp(argv[0], "-e") == 0 && argv[2] != NULL)
+    {
+        struct stat st;
+        const char *stego = argv[3] != NULL ? argv[3] : "default.bmp";
+        int secret_fd = open(argv[2], O_RDONLY);
+
+        req.op = e_stegd_encode;
+        strncpy(req.secret, argv[2], STEGD_MAX_PATH - 1);
+        strncpy(req.output, stego, STEGD_MAX_PATH - 1);
+
+        if(secret_fd < 0 || fstat(secret_fd, &st) != 0)
+        {
+            perror("open");
+            return e_err_open;
+        }
+
+        // Small secrets go inline, larger ones as an fd
+        if(st.st_size <= STEGC_INLINE_MAX && read(secret_fd, secret_buf, st.st_size) == st.st_size)
+        {
+            req.flags |= STEGD_INLINE_SECRET;
+            req.inline_len = st.st_size;
+            close(secret_fd);
+        }
+        else
+        {
+            req.flags |= STEGD_FD_SECRET;
+            fds[nfds++] = secret_fd;
+        }
+
+        if((fds[nfds++] = open(stego, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        {
+            perror("open");
+            return e_err_open;
+        }
+        req.flags |= STEGD_FD_OUTPUT;
+    }
+    else if(strcmp(argv[0], "-d") == 0)
+    {
+        req.op = e_stegd_decode;
+    }
+    else if(strcmp(argv[0], "-p") == 0)
+    {
+        req.op = e_stegd_probe;
+    }
+    else
+    {
+        printf("Error: Unsupported operation\n");
+        printf("Use -e, -d, -p or -s with --client\n");
+        return e_err_usage;
+    }
+
+    if((sock = connect_daemon(socket_path)) < 0)
+    {
+        perror("connect");
+        return e_err_open;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Status ret = stegd_send(sock, &req, sizeof(req), fds, nfds);
+    if(ret == e_success && req.inline_len > 0)
+    {
+        ret = stegd_send(sock, secret_buf, req.inline_len, NULL, 0);
+    }
+    if(ret == e_success)
+    {
+        ret = stegd_recv(sock, &resp, sizeof(resp), NULL, NULL);
+    }
+
+    // Daemon holds its own copies of the fds now
+    for(int i = 0; i < nfds; i++)
+    {
+        close(fds[i]);
+    }
+
+    char *data = NULL;
+    if(ret == e_success && resp.data_len > 0)
+    {
+        if((data = malloc(resp.data_len)) == NULL)
+        {
+            ret = e_failure;
+        }
+        else
+        {
+            ret = stegd_recv(sock, data, resp.data_len, NULL, NULL);
+        }
+    }
+    long us = elapsed_us(&start);
+    close(sock);
+
+    if(ret == e_failure)
+    {
+        printf("Error: Lost connection to stegd\n");
+        free(data);
+        return e_err_io;
+    }
+
+    if(resp.status == e_success && req.op == e_stegd_decode)
+    {
+        resp.extn[sizeof(resp.extn) - 1] = '\0';
+        resp.status = write_decoded(argv[2] != NULL ? argv[2] : "output", resp.extn, data, resp.data_len);
+        resp.error = resp.status == e_success ? e_err_none : e_err_io;
+    }
+    else if(resp.status == e_success && req.op == e_stegd_probe)
+    {
+        printf("width = %u\n", resp.width);
+        printf("height = %u\n", resp.height);
+        printf("bits per pixel = %u\n", resp.bits_per_pixel);
+        printf("capacity = %u bytes\n", resp.capacity);
+        printf("stegged = %s\n", resp.stegged ? "yes" : "no");
+    }
+    else if(resp.status == e_success && req.op == e_stegd_stats)
+    {
+        printf("carrier cache hits = %lu\n", resp.cache_hits);
+        printf("carrier cache misses = %lu\n", resp.cache_misses);
+        printf("carrier cache evictions = %lu\n", resp.cache_evictions);
+        printf("carrier cache bytes = %lu\n", resp.cache_bytes);
+    }
+    free(data);
+
+    if(resp.status == e_success)
+    {
+        printf("Request served in %ld us\n", us);
+    }
+    else
+    {
+        printf("Request failed (%s) in %ld us\n", report_error_name(resp.error), us);
+    }
+    if(resp.status == e_success)
+    {
+        return e_err_none;
+    }
+    return resp.error != e_err_none ? (int)resp.error : e_err_failed;
+}
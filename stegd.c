@@ -0,0 +1,489 @@
+#define _GNU_SOURCE     // accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "stegd.h"
+#include "encode.h"
+#include "decode.h"
+#include "context.h"
+#include "carrier_cache.h"
+#include "report.h"
+#include "types.h"
+#include "common.h"
+
+/* Accepted connections waiting for a worker */
+static int *conn_queue;
+static int conn_head, conn_count, conn_size;
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t conn_cond = PTHREAD_COND_INITIALIZER;
+
+/* Function Definitions */
+
+/* Send len bytes with nfds fds attached */
+Status stegd_send(int sock, const void *buf, size_t len, const int *fds, int nfds)
+{
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = { (void *)buf, len };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    // Attach fds to the first chunk only
+    if(nfds > 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg -> cmsg_level = SOL_SOCKET;
+        cmsg -> cmsg_type = SCM_RIGHTS;
+        cmsg -> cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+
+    while(iov.iov_len > 0)
+    {
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return e_failure;
+        }
+        iov.iov_base = (char *)iov.iov_base + n;
+        iov.iov_len -= n;
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+    }
+    return e_success;
+}
+
+/* Close the nfds fds received with a request that is not served */
+static void close_fds(const int *fds, int nfds)
+{
+    for(int i = 0; i < nfds; i++)
+    {
+        close(fds[i]);
+    }
+}
+
+/* Receive exactly len bytes, collecting up to 3 attached fds; on failure the fds received are closed */
+Status stegd_recv(int sock, void *buf, size_t len, int *fds, int *nfds)
+{
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = { buf, len };
+    struct msghdr msg;
+
+    if(nfds != NULL)
+    {
+        *nfds = 0;
+    }
+
+    while(iov.iov_len > 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n <= 0)          // Error or peer closed
+        {
+            if(nfds != NULL)
+            {
+                close_fds(fds, *nfds);
+                *nfds = 0;
+            }
+            return e_failure;
+        }
+
+        // Collect any fds that came with this chunk
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if(cmsg -> cmsg_level == SOL_SOCKET && cmsg -> cmsg_type == SCM_RIGHTS)
+            {
+                int count = (cmsg -> cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                int *received = (int *)CMSG_DATA(cmsg);
+
+                for(int i = 0; i < count; i++)
+                {
+                    if(nfds != NULL && *nfds < 3)
+                    {
+                        fds[(*nfds)++] = received[i];
+                    }
+                    else
+                    {
+                        close(received[i]);
+                    }
+                }
+            }
+        }
+
+        iov.iov_base = (char *)iov.iov_base + n;
+        iov.iov_len -= n;
+    }
+    return e_success;
+}
+
+/* Secret bytes that fit after the embedding overhead, from the pixel bytes the carrier holds */
+static uint carrier_capacity(size_t data_size)
+{
+    size_t overhead = strlen(MAGIC_STRING) + 4 + MAX_FILE_SUFFIX + 4;
+    size_t bytes = data_size / 8;
+
+    bytes = bytes > overhead ? bytes - overhead : 0;
+    return bytes > UINT32_MAX ? UINT32_MAX : bytes;
+}
+
+/* Probe a carrier: header fields and magic check, straight from the carrier cache */
+static Status handle_probe(FILE *fptr, StegdResponse *resp)
+{
+    CarrierEntry *entry = carrier_cache_get(fileno(fptr));
+    CodecContext *ctx = codec_ctx_acquire();
+    Status ret = e_failure;
+
+    if(entry != NULL && ctx != NULL)
+    {
+        size_t magic_len = strlen(MAGIC_STRING);
+
+        codec_ctx_parse_header(ctx, entry -> map);
+        resp -> width = ctx -> width;
+        resp -> height = ctx -> height;
+        resp -> bits_per_pixel = ctx -> bits_per_pixel;
+        resp -> capacity = carrier_capacity(entry -> map_len > BMP_HEADER_SIZE ? entry -> map_len - BMP_HEADER_SIZE : 0);
+
+        // Magic string (original or extended) sits in the LSBs right after the header
+        int original = entry -> map_len >= BMP_HEADER_SIZE + magic_len * 8;
+        int extended = original;
+        for(size_t i = 0; i < magic_len && (original || extended); i++)
+        {
+            char ch;
+            decode_byte_from_lsb(&ch, (char *)entry -> map + BMP_HEADER_SIZE + i * 8);
+            original = original && ch == MAGIC_STRING[i];
+            extended = extended && ch == MAGIC_STRING_EXT[i];
+        }
+        resp -> stegged = original || extended;
+        ret = e_success;
+    }
+
+    codec_ctx_release(ctx);
+    carrier_cache_put(entry);
+    return ret;
+}
+
+/* Serve one request; the response and any inline data are sent back on sock */
+static Status handle_request(int sock, StegdRequest *req, int *fds, int nfds, unsigned char *inline_buf)
+{
+    StegdResponse resp;
+    JobReport report;
+    char *data = NULL;
+    size_t data_len = 0;
+    int next_fd = 0;
+
+    memset(&resp, 0, sizeof(resp));
+    resp.status = e_failure;
+    resp.error = e_err_failed;
+
+    // Paths arrive fixed-size, make sure they are terminated
+    req -> carrier[STEGD_MAX_PATH - 1] = '\0';
+    req -> secret[STEGD_MAX_PATH - 1] = '\0';
+    req -> output[STEGD_MAX_PATH - 1] = '\0';
+
+    // Take ownership of received fds in protocol order
+    FILE *carrier = NULL, *secret = NULL, *output = NULL;
+    if((req -> flags & STEGD_FD_CARRIER) && next_fd < nfds)
+    {
+        carrier = fdopen(fds[next_fd++], "r");
+    }
+    if((req -> flags & STEGD_FD_SECRET) && next_fd < nfds)
+    {
+        secret = fdopen(fds[next_fd++], "r");
+    }
+    if((req -> flags & STEGD_FD_OUTPUT) && next_fd < nfds)
+    {
+        output = fdopen(fds[next_fd++], "w");
+    }
+    while(next_fd < nfds)       // Extra fds are not ours to keep
+    {
+        close(fds[next_fd++]);
+    }
+
+    // Every file comes as an fd (or inline); named paths are never opened
+    int have_secret = secret != NULL || (req -> flags & STEGD_INLINE_SECRET);
+    if(((req -> op == e_stegd_encode || req -> op == e_stegd_decode || req -> op == e_stegd_probe) && carrier == NULL) ||
+       (req -> op == e_stegd_encode && (have_secret == 0 || output == NULL)))
+    {
+        resp.error = e_err_usage;
+    }
+    else if(req -> op == e_stegd_encode && get_secret_extn(req -> secret) == NULL)
+    {
+        resp.error = e_err_usage;   // Extension would not fit the payload header
+    }
+    else if(req -> op == e_stegd_encode)
+    {
+        EncodeInfo encInfo = {0};
+
+        encInfo.src_image_fname = req -> carrier;
+        encInfo.secret_fname = req -> secret;
+        encInfo.stego_image_fname = req -> output;
+        encInfo.fptr_src_image = carrier;
+        encInfo.fptr_secret = secret;
+        encInfo.fptr_stego_image = output;
+        encInfo.cache_carrier = 1;
+        encInfo.report = &report;
+        report_start(&report, "encode", req -> carrier);
+        if(req -> flags & STEGD_INLINE_SECRET)
+        {
+            // Inline bytes win over a secret fd
+            if(secret != NULL)
+            {
+                fclose(secret);
+            }
+            encInfo.fptr_secret = fmemopen(inline_buf, req -> inline_len, "r");
+        }
+        carrier = secret = output = NULL;   // do_encoding() closes them
+
+        resp.status = do_encoding(&encInfo);
+        close_files(&encInfo);
+        resp.error = report_finish(&report, resp.status);
+    }
+    else if(req -> op == e_stegd_decode)
+    {
+        DecodeInfo decInfo = {0};
+
+        decInfo.dest_image_fname = req -> carrier;
+        decInfo.output_fname = "stegd";
+        decInfo.fptr_dest_image = carrier;
+        decInfo.fptr_output = open_memstream(&data, &data_len);
+        decInfo.report = &report;
+        report_start(&report, "decode", req -> carrier);
+        carrier = NULL;     // do_decoding() closes it
+
+        if(decInfo.fptr_output != NULL)
+        {
+            resp.status = do_decoding(&decInfo);
+            fclose(decInfo.fptr_output);
+            strncpy(resp.extn, decInfo.extn_output_file, sizeof(resp.extn) - 1);
+        }
+        resp.error = report_finish(&report, resp.status);
+        if(resp.status == e_success)
+        {
+            resp.data_len = data_len;
+        }
+    }
+    else if(req -> op == e_stegd_probe)
+    {
+        resp.status = handle_probe(carrier, &resp);
+        resp.error = resp.status == e_success ? e_err_none : e_err_failed;
+    }
+    else if(req -> op == e_stegd_stats)
+    {
+        CarrierCacheStats stats;
+
+        carrier_cache_stats(&stats);
+        resp.cache_hits = stats.hits;
+        resp.cache_misses = stats.misses;
+        resp.cache_evictions = stats.evictions;
+        resp.cache_bytes = stats.bytes;
+        resp.status = e_success;
+        resp.error = e_err_none;
+    }
+
+    // Close anything the job did not consume
+    if(carrier != NULL)
+    {
+        fclose(carrier);
+    }
+    if(secret != NULL)
+    {
+        fclose(secret);
+    }
+    if(output != NULL)
+    {
+        fclose(output);
+    }
+
+    Status ret = stegd_send(sock, &resp, sizeof(resp), NULL, 0);
+    if(ret == e_success && resp.data_len > 0)
+    {
+        ret = stegd_send(sock, data, resp.data_len, NULL, 0);
+    }
+    free(data);
+    return ret;
+}
+
+/* Serve requests on one connection until the client hangs up */
+static void serve_connection(int sock)
+{
+    static _Thread_local unsigned char *inline_buf;     // Grows to the largest inline secret seen
+    static _Thread_local size_t inline_size;
+    StegdRequest req;
+    int fds[3], nfds;
+
+    while(stegd_recv(sock, &req, sizeof(req), fds, &nfds) == e_success)
+    {
+        if(!(req.flags & STEGD_INLINE_SECRET))
+        {
+            req.inline_len = 0;
+        }
+        if(req.inline_len > STEGD_MAX_INLINE)
+        {
+            close_fds(fds, nfds);
+            break;
+        }
+
+        // Inline secret follows the request
+        if(req.inline_len >= inline_size)
+        {
+            unsigned char *buf = realloc(inline_buf, req.inline_len + 1);
+            if(buf == NULL)
+            {
+                close_fds(fds, nfds);
+                break;
+            }
+            inline_buf = buf;
+            inline_size = req.inline_len + 1;
+        }
+        if(req.inline_len > 0 && stegd_recv(sock, inline_buf, req.inline_len, NULL, NULL) == e_failure)
+        {
+            close_fds(fds, nfds);
+            break;
+        }
+
+        if(handle_request(sock, &req, fds, nfds, inline_buf) == e_failure)
+        {
+            break;
+        }
+    }
+    close(sock);
+}
+
+/* Worker: take connections off the queue */
+static void *worker(void *arg)
+{
+    (void)arg;
+    for(;;)
+    {
+        pthread_mutex_lock(&conn_lock);
+        while(conn_count == 0)
+        {
+            pthread_cond_wait(&conn_cond, &conn_lock);
+        }
+        int sock = conn_queue[conn_head];
+        conn_head = (conn_head + 1) % conn_size;
+        conn_count--;
+        pthread_mutex_unlock(&conn_lock);
+
+        serve_connection(sock);
+    }
+    return NULL;
+}
+
+/* Serve requests on socket_path with nthreads workers and a carrier cache of cache_mb, never returns on success */
+int run_daemon(const char *socket_path, int nthreads, int cache_mb)
+{
+    struct sockaddr_un addr;
+    int listen_fd;
+
+    if(nthreads <= 0)
+    {
+        nthreads = STEGD_DEFAULT_THREADS;
+    }
+    if(strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "ERROR: Socket path too long\n");
+        return e_err_usage;
+    }
+    if(cache_mb > 0)
+    {
+        carrier_cache_set_budget((size_t)cache_mb * 1024 * 1024);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    // Only the daemon's user may connect: the socket is created 0600
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socket_path);
+    mode_t old_mask = umask(0177);
+    int bound = listen_fd >= 0 && bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    umask(old_mask);
+    if(bound == 0 || chmod(socket_path, 0600) != 0 || listen(listen_fd, 128) != 0)
+    {
+        perror("stegd");
+        return e_err_open;
+    }
+
+    // Stage messages of encode / decode are for the CLI, not the daemon log
+    int null_fd = open("/dev/null", O_WRONLY);
+    if(null_fd >= 0)
+    {
+        fflush(stdout);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    conn_size = nthreads * 16;
+    if((conn_queue = malloc(conn_size * sizeof(int))) == NULL)
+    {
+        return e_err_failed;
+    }
+    for(int i = 0; i < nthreads; i++)
+    {
+        pthread_t tid;
+        if(pthread_create(&tid, NULL, worker, NULL) != 0)
+        {
+            perror("pthread_create");
+            return e_err_failed;
+        }
+        pthread_detach(tid);
+    }
+    fprintf(stderr, "stegd: listening on %s with %d workers\n", socket_path, nthreads);
+
+    for(;;)
+    {
+        int sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if(sock < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            perror("accept");
+            return e_err_io;
+        }
+
+        pthread_mutex_lock(&conn_lock);
+        if(conn_count == conn_size)     // Backlog full, refuse
+        {
+            pthread_mutex_unlock(&conn_lock);
+            close(sock);
+            continue;
+        }
+        conn_queue[(conn_head + conn_count) % conn_size] = sock;
+        conn_count++;
+        pthread_cond_signal(&conn_cond);
+        pthread_mutex_unlock(&conn_lock);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef STEGD_H
+#define STEGD_H
+#include "types.h" // Contains user defined types
+
+/*
+ * stegd: long running encode / decode service on a Unix
+ * domain socket. A connection carries any number of
+ * request / response pairs. Files are passed as fds with
+ * SCM_RIGHTS (in the order carrier, secret, output); a small
+ * secret may also be sent inline after the request. The
+ * daemon never opens a path named in a request, the names
+ * only label the job and give the secret's extension, so a
+ * client can only reach files it could open itself. Decoded
+ * data always comes back inline after the response.
+ * Carriers are served from the carrier cache, so reused
+ * cover images are mapped only once. The socket is created
+ * mode 0600.
+ */
+
+#define STEGD_MAX_PATH 256          // Paths and names in a request
+#define STEGD_MAX_INLINE (64 * 1024 * 1024)  // Largest inline secret accepted
+#define STEGD_DEFAULT_THREADS 4     // Worker threads when none given
+
+/* Request operations */
+typedef enum
+{
+    e_stegd_encode,
+    e_stegd_decode,
+    e_stegd_probe,
+    e_stegd_stats
+} StegdOp;
+
+/* Request flags */
+#define STEGD_FD_CARRIER    0x01    // Carrier / stego image passed as fd
+#define STEGD_FD_SECRET     0x02    // Secret file passed as fd
+#define STEGD_FD_OUTPUT     0x04    // Stego output passed as fd
+#define STEGD_INLINE_SECRET 0x08    // inline_len secret bytes follow the request
+
+typedef struct _StegdRequest
+{
+    uint op;                        // StegdOp
+    uint flags;                     // STEGD_* flags
+    char carrier[STEGD_MAX_PATH];   // Carrier name
+    char secret[STEGD_MAX_PATH];    // Secret name, its extension is stored with the data
+    char output[STEGD_MAX_PATH];    // Stego output name
+    uint inline_len;                // Bytes of inline secret
+} StegdRequest;
+
+typedef struct _StegdResponse
+{
+    int status;                     // Status of the job
+    uint error;                     // StegError class of a failed job, e_err_none on success
+    uint width;                     // Carrier width
+    uint height;                    // Carrier height
+    uint bits_per_pixel;            // Carrier colour depth
+    uint capacity;                  // Secret bytes the carrier can hold
+    uint stegged;                   // 1 when the magic string is present
+    char extn[8];                   // Extension of decoded data
+    unsigned long cache_hits;       // Carrier cache counters (stats)
+    unsigned long cache_misses;
+    unsigned long cache_evictions;
+    unsigned long cache_bytes;
+    uint data_len;                  // Bytes of decoded data following the response
+} StegdResponse;
+
+/* Send len bytes with nfds fds attached */
+Status stegd_send(int sock, const void *buf, size_t len, const int *fds, int nfds);
+
+/* Receive exactly len bytes, collecting up to 3 attached fds; on failure the fds received are closed */
+Status stegd_recv(int sock, void *buf, size_t len, int *fds, int *nfds);
+
+/* Serve requests on socket_path with nthreads workers and a carrier cache of cache_mb, never returns on success
+ * Description: returns the StegError class of whatever kept it from serving
+ */
+int run_daemon(const char *socket_path, int nthreads, int cache_mb);
+
+/* Send one request built from argv ("-e", "-d", "-p" or "-s" ...) to the daemon, returns its StegError class */
+int run_client(const char *socket_path, char *argv[]);
+
+#endif
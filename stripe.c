@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "stripe.h"
+#include "context.h"
+#include "types.h"
+
+/* State shared by the workers of one job */
+typedef struct
+{
+    StripeJob *job;
+    size_t stripe_data;         // Stream bytes per stripe
+    size_t stripes;             // Stripes in the window
+    size_t phase;               // Phase of stream byte 0
+    atomic_size_t next;         // Next stripe to take
+    atomic_int error;           // Set on the first failed stripe
+} StripePool;
+
+/* One worker and the context holding its buffers */
+typedef struct
+{
+    StripePool *pool;
+    CodecContext *ctx;          // Window holds the stripe, scratch its payload bytes
+} StripeWorker;
+
+/* Function Definitions */
+
+/* Read exactly len bytes at offset */
+static Status read_at(int fd, unsigned char *buf, size_t len, off_t offset)
+{
+    while(len > 0)
+    {
+        ssize_t got = pread(fd, buf, len, offset);
+        if(got <= 0)
+        {
+            return e_failure;
+        }
+        buf += got;
+        len -= got;
+        offset += got;
+    }
+    return e_success;
+}
+
+/* Write exactly len bytes at offset */
+static Status write_at(int fd, const unsigned char *buf, size_t len, off_t offset)
+{
+    while(len > 0)
+    {
+        ssize_t put = pwrite(fd, buf, len, offset);
+        if(put <= 0)
+        {
+            return e_failure;
+        }
+        buf += put;
+        len -= put;
+        offset += put;
+    }
+    return e_success;
+}
+
+/* Carrier offset of stream byte pos, from the start of pixel data */
+static size_t stream_offset(StripePool *pool, size_t pos)
+{
+    return pool -> job -> header + lsb_carrier_bytes(pool -> job -> codec, pool -> phase, pos);
+}
+
+/* Gather stream bytes [begin, end) from the prefix and the secret file */
+static Status read_stream(StripeJob *job, unsigned char *data, size_t begin, size_t end)
+{
+    if(begin < job -> prefix_len)
+    {
+        size_t n = (end < job -> prefix_len ? end : job -> prefix_len) - begin;
+        memcpy(data, job -> prefix + begin, n);
+        data += n;
+        begin += n;
+    }
+    if(begin < end)
+    {
+        return read_at(job -> secret_fd, data, end - begin, begin - job -> prefix_len);
+    }
+    return e_success;
+}
+
+/* Read, embed and write one stripe; stripe 0 also carries the header */
+static Status embed_stripe(StripePool *pool, size_t i, unsigned char *carrier, unsigned char *data)
+{
+    StripeJob *job = pool -> job;
+    const LsbCodec *codec = job -> codec;
+    size_t begin = i * pool -> stripe_data;
+    size_t end = begin + pool -> stripe_data < job -> stream_len ? begin + pool -> stripe_data : job -> stream_len;
+
+    // Carrier span from this stripe's first payload byte to the next one's
+    size_t first = stream_offset(pool, begin);
+    size_t c0 = i == 0 ? 0 : first;
+    size_t c1 = i + 1 == pool -> stripes ? job -> window : stream_offset(pool, end);
+
+    if(read_at(job -> src_fd, carrier, c1 - c0, BMP_HEADER_SIZE + c0) == e_failure ||
+       read_stream(job, data, begin, end) == e_failure)
+    {
+        return e_failure;
+    }
+
+    if(i == 0)
+    {
+        unsigned char field[4];
+
+        lsb_codec_default.embed(carrier, 0, (const unsigned char *)job -> magic, strlen(job -> magic));
+        if(job -> has_word)
+        {
+            lsb_store_be32(field, job -> word);
+            lsb_codec_default.embed(carrier + strlen(job -> magic) * 8, 0, field, 4);
+        }
+    }
+
+    codec -> embed(carrier + first - c0, lsb_phase(codec, first), data, end - begin);
+    return write_at(job -> stego_fd, carrier, c1 - c0, BMP_HEADER_SIZE + c0);
+}
+
+/* Take stripes until none are left */
+static void *stripe_worker(void *arg)
+{
+    StripeWorker *worker = arg;
+    StripePool *pool = worker -> pool;
+    StripeJob *job = pool -> job;
+    CodecContext *ctx = worker -> ctx;
+
+    // Room for the header and any start phase
+    if(codec_ctx_reserve_window(ctx, job -> header + lsb_carrier_bytes(job -> codec, 0, pool -> stripe_data) + 8) == e_failure ||
+       codec_ctx_reserve_scratch(ctx, pool -> stripe_data) == e_failure)
+    {
+        atomic_store(&pool -> error, 1);
+    }
+
+    while(atomic_load(&pool -> error) == 0)
+    {
+        size_t i = atomic_fetch_add(&pool -> next, 1);
+        if(i >= pool -> stripes)
+        {
+            break;
+        }
+        if(embed_stripe(pool, i, ctx -> window, ctx -> scratch) == e_failure)
+        {
+            atomic_store(&pool -> error, 1);
+        }
+    }
+    return NULL;
+}
+
+/* Embed the whole payload window stripe by stripe on a pool of workers */
+Status stripe_embed(StripeJob *job)
+{
+    StripePool pool;
+    StripeWorker workers[STRIPE_MAX_THREADS];
+    pthread_t tids[STRIPE_MAX_THREADS];
+    size_t started = 0;
+
+    pool.job = job;
+    pool.phase = lsb_phase(job -> codec, job -> header);
+    pool.stripe_data = lsb_data_bytes(job -> codec, 0, STRIPE_CARRIER_BYTES);
+    pool.stripes = job -> stream_len > 0 ? (job -> stream_len + pool.stripe_data - 1) / pool.stripe_data : 1;
+    atomic_init(&pool.next, 0);
+    atomic_init(&pool.error, 0);
+
+    // One worker per core, no more than there are stripes
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = pool.stripes < STRIPE_MAX_THREADS ? pool.stripes : STRIPE_MAX_THREADS;
+    if(cpus > 0 && nthreads > (size_t)cpus)
+    {
+        nthreads = cpus;
+    }
+
+    // Buffers come from this thread's pool, so repeated jobs reuse them whichever thread runs a worker
+    for(size_t t = 0; t < nthreads; t++)
+    {
+        workers[t].pool = &pool;
+        if((workers[t].ctx = codec_ctx_acquire()) == NULL)
+        {
+            nthreads = t;
+        }
+    }
+    if(nthreads == 0)
+    {
+        return e_failure;
+    }
+
+    // This thread is worker 0; stripes of a thread that fails to start go to the others
+    for(size_t t = 1; t < nthreads; t++)
+    {
+        if(pthread_create(&tids[t], NULL, stripe_worker, &workers[t]) == 0)
+        {
+            started |= 1UL << t;
+        }
+    }
+    stripe_worker(&workers[0]);
+
+    for(size_t t = 1; t < nthreads; t++)
+    {
+        if(started & (1UL << t))
+        {
+            pthread_join(tids[t], NULL);
+        }
+    }
+    for(size_t t = 0; t < nthreads; t++)
+    {
+        codec_ctx_release(workers[t].ctx);
+    }
+    return atomic_load(&pool.error) ? e_failure : e_success;
+}
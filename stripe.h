@@ -0,0 +1,53 @@
+#ifndef STRIPE_H
+#define STRIPE_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "lsb_codec.h" // Specialised embed / extract kernels
+
+/*
+ * Striped embedding for carriers too large to hold in memory.
+ * The payload window is cut into stripes of about
+ * STRIPE_CARRIER_BYTES carrier bytes. Workers take stripes in
+ * turn and read, embed and write each one on their own, with
+ * pread / pwrite at the stripe's offset, so reading one stripe
+ * overlaps embedding others and no ordering is needed.
+ *
+ * A stripe starts where the serial path would put its first
+ * payload byte and embeds with the same kernels, so the
+ * output is byte for byte the same. Each worker holds one
+ * stripe and its payload bytes, bounding memory to roughly
+ * STRIPE_MAX_THREADS * 5MB whatever the image size. Those
+ * buffers are codec contexts of the calling thread's pool.
+ */
+
+#define STRIPE_CARRIER_BYTES (4 * 1024 * 1024)  // Carrier bytes per stripe
+#define STRIPE_MAX_THREADS 8                    // Upper bound on stripe workers
+#ifndef STRIPE_MIN_WINDOW
+#define STRIPE_MIN_WINDOW (32 * 1024 * 1024)    // Smaller windows are embedded in memory
+#endif
+
+typedef struct _StripeJob
+{
+    /* Files, all accessed by offset */
+    int src_fd;                 // Source image
+    int stego_fd;               // Stego image
+    int secret_fd;              // Secret data, after the prefix
+
+    /* Header in front of the payload stream, 1 bit per carrier byte */
+    const char *magic;          // Magic string
+    int has_word;               // 1 when the layout word follows it
+    uint word;                  // Layout word
+    size_t header;              // Carrier bytes of magic string and layout word
+
+    /* Payload stream in the job's layout */
+    const LsbCodec *codec;
+    const unsigned char *prefix;    // Stream bytes before the secret data
+    size_t prefix_len;
+    size_t stream_len;              // Prefix and secret data
+    size_t window;                  // Carrier bytes of header and stream
+} StripeJob;
+
+/* Embed the whole payload window stripe by stripe on a pool of workers */
+Status stripe_embed(StripeJob *job);
+
+#endif
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "test_util.h"
+
+/*
+ * Steady state allocations of encode, decode and verify.
+ * The binary is linked with --wrap for malloc, calloc, realloc
+ * and posix_memalign, so every heap allocation made by the
+ * steg sources is counted (the C library's own, such as the
+ * FILE of an fopen, are not). Each job runs twice on the same
+ * files and the second run must not allocate at all: the
+ * codec context pool already holds every buffer it needs.
+ */
+
+#define ALLOC_CHECK_WIDTH 512
+#define ALLOC_CHECK_HEIGHT 512
+#define ALLOC_CHECK_SECRET 20000
+
+/* Options of one layout, NULL terminated */
+typedef struct
+{
+    const char *name;
+    const char *options[4];
+} AllocCase;
+
+static const AllocCase cases[] = {
+    { "lsb1", { NULL } },
+    { "lsb2", { "--bits", "2", NULL } },
+    { "fec", { "--fec", "32", NULL } },
+    { "adaptive", { "--adaptive", NULL } },
+};
+
+/* Allocations by the steg sources, from any thread */
+static atomic_ulong allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **ptr, size_t align, size_t size);
+
+/* Function Definitions */
+
+/* Count, then allocate */
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add(&allocs, 1);
+    return __real_malloc(size);
+}
+
+/* Count, then allocate */
+void *__wrap_calloc(size_t n, size_t size)
+{
+    atomic_fetch_add(&allocs, 1);
+    return __real_calloc(n, size);
+}
+
+/* Count, then allocate */
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add(&allocs, 1);
+    return __real_realloc(ptr, size);
+}
+
+/* Count, then allocate */
+int __wrap_posix_memalign(void **ptr, size_t align, size_t size)
+{
+    atomic_fetch_add(&allocs, 1);
+    return __real_posix_memalign(ptr, align, size);
+}
+
+/* Run encode, decode and verify twice, 0 when the second round does not allocate */
+static int run_case(const char *dir, const AllocCase *ac)
+{
+    char src[TEST_PATH], secret[TEST_PATH], stego[TEST_PATH], output[TEST_PATH], decoded[TEST_PATH + 8];
+    unsigned long used[3] = { 0 };
+    const char *jobs[3] = { "encode", "decode", "verify" };
+    int failed = 0;
+
+    snprintf(src, sizeof(src), "%s/carrier.bmp", dir);
+    snprintf(secret, sizeof(secret), "%s/secret.txt", dir);
+    snprintf(stego, sizeof(stego), "%s/stego.bmp", dir);
+    snprintf(output, sizeof(output), "%s/out", dir);
+    snprintf(decoded, sizeof(decoded), "%s.txt", output);
+
+    if(test_write_carrier(src, ALLOC_CHECK_WIDTH, ALLOC_CHECK_HEIGHT, 8) == e_failure || test_write_secret(secret, ALLOC_CHECK_SECRET) == e_failure)
+    {
+        printf("Error: Unable to generate the files in %s\n", dir);
+        failed = 1;
+    }
+
+    for(int round = 0; round < 2 && !failed; round++)
+    {
+        for(int job = 0; job < 3 && !failed; job++)
+        {
+            unsigned long before = atomic_load(&allocs);
+            Status ret = job == 0 ? test_encode(src, secret, stego, ac -> options) :
+                         job == 1 ? test_decode(stego, output) : test_verify(stego, secret);
+
+            used[job] = atomic_load(&allocs) - before;
+            if(ret == e_failure)
+            {
+                printf("FAIL: %s: %s failed\n", ac -> name, jobs[job]);
+                failed = 1;
+            }
+        }
+    }
+
+    for(int job = 0; job < 3 && !failed; job++)
+    {
+        if(used[job] != 0)
+        {
+            printf("FAIL: %s: a repeated %s made %lu allocations\n", ac -> name, jobs[job], used[job]);
+            failed = 1;
+        }
+    }
+    if(!failed)
+    {
+        printf("PASS: %s: repeated encode, decode and verify make no allocations\n", ac -> name);
+    }
+
+    remove(src);
+    remove(secret);
+    remove(stego);
+    remove(decoded);
+    return failed;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/steg-test-XXXXXX";
+    int failed = 0;
+
+    if(mkdtemp(dir) == NULL)
+    {
+        printf("Error: Unable to create a temporary directory\n");
+        return 2;
+    }
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        failed |= run_case(dir, &cases[i]);
+    }
+    rmdir(dir);
+    return failed;
+}
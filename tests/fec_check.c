@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "test_util.h"
+#include "../context.h"
+#include "../lsb_codec.h"
+#include "../fec.h"
+
+/*
+ * Erasure repair of truncated FEC images.
+ * A secret of a given number of codewords is encoded with --fec,
+ * the stego image is cut some carrier bytes into its coded stream,
+ * and the decode must still give back the secret byte for byte:
+ * the missing carrier bytes are erasures the parity repairs.
+ */
+
+#define FEC_CHECK_WIDTH 256
+#define FEC_CHECK_HEIGHT 256
+#define FEC_CHECK_ROOTS 32
+#define FEC_CHECK_ROOTS_ARG "32"    // Same, for the command line
+
+/* Coded stream length and carrier bytes cut off its end */
+typedef struct
+{
+    const char *name;
+    size_t codewords;       // 0: as many as the carrier holds
+    size_t cut;
+} FecCase;
+
+static const FecCase cases[] = {
+    // Carrier filled to the end, a truncated copy of it
+    { "full carrier", 0, 160 },
+    // One codeword past a full group: the last two groups share 17, so the cut spreads over 8
+    { "short last group", FEC_INTERLEAVE + 1, 320 },
+};
+
+/* Function Definitions */
+
+/* Encode, cut and decode one case, 0 when the secret comes back */
+static int run_case(const char *dir, const RsCode *rs, const FecCase *fc)
+{
+    char src[TEST_PATH], secret[TEST_PATH], stego[TEST_PATH], output[TEST_PATH], decoded[TEST_PATH + 8];
+    const char *options[] = { "--fec", FEC_CHECK_ROOTS_ARG, NULL };
+    int failed = 1;
+
+    snprintf(src, sizeof(src), "%s/carrier.bmp", dir);
+    snprintf(secret, sizeof(secret), "%s/secret.txt", dir);
+    snprintf(stego, sizeof(stego), "%s/stego.bmp", dir);
+    snprintf(output, sizeof(output), "%s/out", dir);
+    snprintf(decoded, sizeof(decoded), "%s.txt", output);
+
+    // Whole codewords in what follows the magic string and layout word, 1 bit per carrier byte
+    size_t pixels = (size_t)((FEC_CHECK_WIDTH * 3 + 3) & ~3) * FEC_CHECK_HEIGHT;
+    size_t codewords = fc -> codewords > 0 ? fc -> codewords : ((pixels - LSB_EXT_HEADER_BYTES) / 8 - FEC_LENGTH_BYTES) / FEC_BLOCK_LEN;
+    size_t payload = codewords * rs -> k - FEC_CRC_BYTES;
+    long secret_size = payload - 8 - strlen(".txt");
+    size_t window = LSB_EXT_HEADER_BYTES + 8 * fec_stream_size(rs, payload);
+
+    if(test_write_carrier(src, FEC_CHECK_WIDTH, FEC_CHECK_HEIGHT, 0) == e_failure || test_write_secret(secret, secret_size) == e_failure)
+    {
+        printf("Error: Unable to generate the files in %s\n", dir);
+    }
+    else if(test_encode(src, secret, stego, options) == e_failure)
+    {
+        printf("FAIL: %s: --fec encode of a %ld byte secret\n", fc -> name, secret_size);
+    }
+    else if(truncate(stego, BMP_HEADER_SIZE + window - fc -> cut) != 0)
+    {
+        perror("truncate");
+    }
+    else if(test_decode(stego, output) == e_failure)
+    {
+        printf("FAIL: %s: decode of a FEC image missing its last %zu carrier bytes\n", fc -> name, fc -> cut);
+    }
+    else if(!test_same_file(secret, decoded))
+    {
+        printf("FAIL: %s: truncated FEC image decoded a different secret\n", fc -> name);
+    }
+    else
+    {
+        printf("PASS: %s: %zu codewords, %zu carrier bytes short, decodes byte-exact\n", fc -> name, codewords, fc -> cut);
+        failed = 0;
+    }
+
+    remove(src);
+    remove(secret);
+    remove(stego);
+    remove(decoded);
+    return failed;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/steg-test-XXXXXX";
+    const RsCode *rs = rs_code_get(FEC_CHECK_ROOTS);
+    int failed = 0;
+
+    if(rs == NULL || mkdtemp(dir) == NULL)
+    {
+        printf("Error: Unable to create a temporary directory\n");
+        return 2;
+    }
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        failed |= run_case(dir, rs, &cases[i]);
+    }
+    rmdir(dir);
+    return failed;
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "test_util.h"
+#include "../encode.h"
+#include "../decode.h"
+#include "../context.h"
+
+/* Function Definitions */
+
+/* Next value of a 32 bit LCG, the data only needs to be repeatable */
+static uint32_t next_rand(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+/* Write a 24 bpp BMP of a smooth gradient, with optional texture */
+Status test_write_carrier(const char *fname, uint width, uint height, int noise)
+{
+    uint stride = (width * 3 + 3) & ~3u;
+    uint image_size = stride * height;
+    unsigned char header[BMP_HEADER_SIZE] = { 'B', 'M' };
+    unsigned char *row = calloc(stride, 1);
+    uint32_t state = width ^ height;
+    FILE *fptr = fopen(fname, "wb");
+
+    if(fptr == NULL || row == NULL)
+    {
+        free(row);
+        if(fptr != NULL)
+        {
+            fclose(fptr);
+        }
+        return e_failure;
+    }
+
+    // Little endian header fields
+    uint fields[][2] = { { 2, BMP_HEADER_SIZE + image_size }, { 10, BMP_HEADER_SIZE }, { 14, 40 }, { 18, width },
+                         { 22, height }, { 26, 1 | (24 << 16) }, { 34, image_size } };
+    for(size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        for(int b = 0; b < 4; b++)
+        {
+            header[fields[i][0] + b] = fields[i][1] >> (8 * b);
+        }
+    }
+
+    Status ret = fwrite(header, 1, BMP_HEADER_SIZE, fptr) == BMP_HEADER_SIZE ? e_success : e_failure;
+    for(uint y = 0; y < height && ret == e_success; y++)
+    {
+        for(uint x = 0; x < width * 3; x++)
+        {
+            int v = (x / 3 * 255 / width + y * 255 / height + (x % 3) * 40) / 2;
+            if(noise > 0)
+            {
+                v += (int)(next_rand(&state) % (2 * noise + 1)) - noise;
+            }
+            row[x] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+        if(fwrite(row, 1, stride, fptr) != stride)
+        {
+            ret = e_failure;
+        }
+    }
+
+    free(row);
+    if(fclose(fptr) != 0)
+    {
+        ret = e_failure;
+    }
+    return ret;
+}
+
+/* Write size pseudo-random bytes */
+Status test_write_secret(const char *fname, long size)
+{
+    uint32_t state = (uint32_t)size;
+    FILE *fptr = fopen(fname, "wb");
+    Status ret = e_success;
+
+    if(fptr == NULL)
+    {
+        return e_failure;
+    }
+    for(long i = 0; i < size && ret == e_success; i++)
+    {
+        if(putc(next_rand(&state) & 0xff, fptr) == EOF)
+        {
+            ret = e_failure;
+        }
+    }
+    if(fclose(fptr) != 0)
+    {
+        ret = e_failure;
+    }
+    return ret;
+}
+
+/* 1 when both files hold the same bytes */
+int test_same_file(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int same = fa != NULL && fb != NULL;
+
+    while(same)
+    {
+        int ca = getc(fa);
+        int cb = getc(fb);
+        if(ca != cb)
+        {
+            same = 0;
+        }
+        else if(ca == EOF)
+        {
+            break;
+        }
+    }
+    if(fa != NULL)
+    {
+        fclose(fa);
+    }
+    if(fb != NULL)
+    {
+        fclose(fb);
+    }
+    return same;
+}
+
+/* Send stdout to /dev/null, returns what test_restore_stdout() needs */
+int test_quiet_stdout(void)
+{
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+
+    fflush(stdout);
+    if(null >= 0)
+    {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    return saved;
+}
+
+/* Undo test_quiet_stdout() */
+void test_restore_stdout(int saved)
+{
+    fflush(stdout);
+    if(saved >= 0)
+    {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+}
+
+/* Encode src + secret into stego, options is NULL terminated */
+Status test_encode(char *src, char *secret, char *stego, const char *const *options)
+{
+    char *argv[16] = { "test", "-e", src, secret, stego };
+    EncodeInfo encInfo = {0};
+    int argc = 5;
+
+    for(int i = 0; options != NULL && options[i] != NULL && argc < 15; i++)
+    {
+        argv[argc++] = (char *)options[i];
+    }
+
+    int saved = test_quiet_stdout();
+    Status ret = read_and_validate_encode_args(argv, &encInfo) == e_success ? do_encoding(&encInfo) : e_failure;
+    test_restore_stdout(saved);
+    return ret;
+}
+
+/* Decode stego into output, the extension is added by the decoder */
+Status test_decode(char *stego, char *output)
+{
+    char *argv[] = { "test", "-d", stego, output, NULL };
+    DecodeInfo decInfo = {0};
+
+    int saved = test_quiet_stdout();
+    Status ret = read_and_validate_decode_args(argv, &decInfo) == e_success ? do_decoding(&decInfo) : e_failure;
+    test_restore_stdout(saved);
+    return ret;
+}
+
+/* Verify stego against the secret it should carry */
+Status test_verify(char *stego, char *secret)
+{
+    char *argv[] = { "test", "-v", stego, secret, NULL };
+    DecodeInfo decInfo = {0};
+
+    int saved = test_quiet_stdout();
+    Status ret = read_and_validate_verify_args(argv, &decInfo) == e_success ? do_verification(&decInfo) : e_failure;
+    test_restore_stdout(saved);
+    return ret;
+}
@@ -0,0 +1,38 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+#include "../types.h" // Contains user defined types
+
+/*
+ * Helpers shared by the checks under tests/.
+ * Carriers and secrets are generated, so no test depends on
+ * the sample files, and jobs run through the same entry points
+ * as the command line with its stage messages silenced.
+ */
+
+#define TEST_PATH 512
+
+/* Write a 24 bpp BMP of a smooth gradient, with optional texture */
+Status test_write_carrier(const char *fname, uint width, uint height, int noise);
+
+/* Write size pseudo-random bytes */
+Status test_write_secret(const char *fname, long size);
+
+/* 1 when both files hold the same bytes */
+int test_same_file(const char *a, const char *b);
+
+/* Send stdout to /dev/null, returns what test_restore_stdout() needs */
+int test_quiet_stdout(void);
+
+/* Undo test_quiet_stdout() */
+void test_restore_stdout(int saved);
+
+/* Encode src + secret into stego, options is NULL terminated */
+Status test_encode(char *src, char *secret, char *stego, const char *const *options);
+
+/* Decode stego into output, the extension is added by the decoder */
+Status test_decode(char *stego, char *output);
+
+/* Verify stego against the secret it should carry */
+Status test_verify(char *stego, char *secret);
+
+#endif
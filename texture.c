@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "texture.h"
+#include "types.h"
+
+/* Blocks one map worker classifies */
+typedef struct
+{
+    const unsigned char *pixels;    // Carrier bytes of block 0
+    unsigned char *flags;           // Map being built
+    size_t begin;                   // First block of the range
+    size_t end;                     // One past the last block
+    size_t block_bytes;             // Carrier bytes per block
+    uint shift;                     // Bits the layout replaces
+    uint level;                     // Variance threshold is 2^level
+    size_t textured;                // Textured blocks found in the range
+} TextureRange;
+
+/* Function Definitions */
+
+/* Variance of the top bits of one block against 2^level, n is a constant at every call site
+ * Description: n * sum(v^2) - sum(v)^2 is n^2 times the variance,
+ * so the test stays in integers and the loop vectorizes
+ */
+static inline __attribute__((always_inline)) int block_textured(const unsigned char *p, const size_t n, uint shift, uint level)
+{
+    uint sum = 0;
+    uint sq = 0;
+
+    for(size_t i = 0; i < n; i++)
+    {
+        uint v = p[i] >> shift;
+        sum += v;
+        sq += v * v;
+    }
+    return (uint64_t)n * sq - (uint64_t)sum * sum >= ((uint64_t)n * n) << level;
+}
+
+/* Classify one range of blocks */
+static void *texture_range(void *arg)
+{
+    TextureRange *range = arg;
+    const unsigned char *p = range -> pixels + range -> begin * range -> block_bytes;
+    size_t textured = 0;
+
+    // One loop per pixel size so the block length is a constant
+    if(range -> block_bytes == TEXTURE_BLOCK_PIXELS * 3)
+    {
+        for(size_t b = range -> begin; b < range -> end; b++, p += TEXTURE_BLOCK_PIXELS * 3)
+        {
+            range -> flags[b] = block_textured(p, TEXTURE_BLOCK_PIXELS * 3, range -> shift, range -> level);
+            textured += range -> flags[b];
+        }
+    }
+    else
+    {
+        for(size_t b = range -> begin; b < range -> end; b++, p += TEXTURE_BLOCK_PIXELS * 4)
+        {
+            range -> flags[b] = block_textured(p, TEXTURE_BLOCK_PIXELS * 4, range -> shift, range -> level);
+            textured += range -> flags[b];
+        }
+    }
+
+    range -> textured = textured;
+    return NULL;
+}
+
+/* Build the map of len carrier bytes at pixels, and its capacity, in one parallel pass */
+Status texture_map_build(TextureMap *map, CodecContext *ctx, unsigned char *pixels, size_t len, const LsbLayout *layout)
+{
+    TextureRange ranges[TEXTURE_MAX_THREADS];
+    pthread_t tids[TEXTURE_MAX_THREADS];
+    size_t started = 0;
+    uint bpp = layout -> bytes_per_pixel;
+
+    if(bpp != 3 && bpp != 4)
+    {
+        printf("Error: Adaptive embedding needs a 24 or 32 bits per pixel image\n");
+        return e_failure;
+    }
+
+    // Every used channel of every pixel gives bits per channel
+    uint channels = __builtin_popcount(layout -> channel_mask & ((1u << bpp) - 1));
+    map -> pixels = pixels;
+    map -> block_bytes = TEXTURE_BLOCK_PIXELS * bpp;
+    map -> block_capacity = TEXTURE_BLOCK_PIXELS * channels * layout -> bits / 8;
+    map -> blocks = len / map -> block_bytes;
+    map -> block = 0;
+    map -> used = 0;
+
+    if(codec_ctx_reserve_map(ctx, map -> blocks) == e_failure)
+    {
+        return e_failure;
+    }
+    map -> flags = ctx -> map;
+
+    // Enough blocks per worker to be worth a thread
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads = map -> blocks / 16384 > 1 ? map -> blocks / 16384 : 1;
+    if(nthreads > TEXTURE_MAX_THREADS)
+    {
+        nthreads = TEXTURE_MAX_THREADS;
+    }
+    if(cpus > 0 && nthreads > (size_t)cpus)
+    {
+        nthreads = cpus;
+    }
+
+    size_t per_thread = (map -> blocks + nthreads - 1) / nthreads;
+    for(size_t t = 0; t < nthreads; t++)
+    {
+        TextureRange *range = &ranges[t];
+
+        range -> pixels = pixels;
+        range -> flags = ctx -> map;
+        range -> begin = t * per_thread < map -> blocks ? t * per_thread : map -> blocks;
+        range -> end = range -> begin + per_thread < map -> blocks ? range -> begin + per_thread : map -> blocks;
+        range -> block_bytes = map -> block_bytes;
+        range -> shift = layout -> bits;
+        range -> level = layout -> adaptive;
+
+        // The first range runs on this thread
+        if(t > 0 && pthread_create(&tids[t], NULL, texture_range, range) == 0)
+        {
+            started |= 1UL << t;
+        }
+    }
+    texture_range(&ranges[0]);
+
+    size_t textured = ranges[0].textured;
+    for(size_t t = 1; t < nthreads; t++)
+    {
+        if(started & (1UL << t))
+        {
+            pthread_join(tids[t], NULL);
+        }
+        else
+        {
+            texture_range(&ranges[t]);  // Thread could not start, do it here
+        }
+        textured += ranges[t].textured;
+    }
+
+    map -> capacity = textured * map -> block_capacity;
+    return e_success;
+}
+
+/* Carrier span for up to want payload bytes at the cursor, NULL when the map is used up */
+static unsigned char *texture_map_next(TextureMap *map, const LsbCodec *codec, size_t want, size_t *n, size_t *phase)
+{
+    // Smooth blocks carry nothing
+    while(map -> block < map -> blocks && !map -> flags[map -> block])
+    {
+        map -> block++;
+    }
+    if(map -> block >= map -> blocks)
+    {
+        return NULL;
+    }
+
+    size_t off = lsb_carrier_bytes(codec, 0, map -> used);  // Blocks start on a pixel
+    unsigned char *span = map -> pixels + map -> block * map -> block_bytes + off;
+
+    *n = map -> block_capacity - map -> used < want ? map -> block_capacity - map -> used : want;
+    *phase = lsb_phase(codec, off);
+
+    map -> used += *n;
+    if(map -> used == map -> block_capacity)
+    {
+        map -> block++;
+        map -> used = 0;
+    }
+    return span;
+}
+
+/* Embed len payload bytes at the cursor, returns the bytes that fit */
+size_t texture_map_embed(TextureMap *map, const LsbCodec *codec, const unsigned char *data, size_t len)
+{
+    size_t done = 0;
+    size_t n, phase;
+    unsigned char *span;
+
+    while(done < len && (span = texture_map_next(map, codec, len - done, &n, &phase)) != NULL)
+    {
+        codec -> embed(span, phase, data + done, n);
+        done += n;
+    }
+    return done;
+}
+
+/* Extract len payload bytes at the cursor, returns the bytes found */
+size_t texture_map_extract(TextureMap *map, const LsbCodec *codec, unsigned char *data, size_t len)
+{
+    size_t done = 0;
+    size_t n, phase;
+    const unsigned char *span;
+
+    while(done < len && (span = texture_map_next(map, codec, len - done, &n, &phase)) != NULL)
+    {
+        codec -> extract(span, phase, data + done, n);
+        done += n;
+    }
+    return done;
+}
+
+/* Move the cursor past len payload bytes, returns the bytes passed */
+size_t texture_map_skip(TextureMap *map, const LsbCodec *codec, size_t len)
+{
+    size_t done = 0;
+    size_t n, phase;
+
+    while(done < len && texture_map_next(map, codec, len - done, &n, &phase) != NULL)
+    {
+        done += n;
+    }
+    return done;
+}
@@ -0,0 +1,52 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "context.h" // Reusable codec context
+#include "lsb_codec.h" // Specialised embed / extract kernels
+
+/*
+ * Adaptive embedding map.
+ * The carrier after the layout word is cut into blocks of
+ * TEXTURE_BLOCK_PIXELS pixels. A block is textured when the
+ * variance of its bytes, ignoring the bits the layout
+ * replaces, reaches 2^level; only textured blocks carry
+ * payload. Embedding never touches those upper bits, so the
+ * decoder rebuilds the same map from the stego image.
+ *
+ * A block holds a whole number of payload bytes for every
+ * layout, so the payload is simply run through the textured
+ * blocks in order.
+ */
+
+#define TEXTURE_BLOCK_PIXELS 16     // Pixels per block
+#define TEXTURE_DEFAULT_LEVEL 4     // Variance of at least 16 by default
+#define TEXTURE_MAX_THREADS 8       // Upper bound on map workers
+
+typedef struct _TextureMap
+{
+    unsigned char *pixels;      // First carrier byte of block 0
+    const unsigned char *flags; // One per block, 1 when textured (held by the codec context)
+    size_t blocks;              // Whole blocks in the carrier
+    size_t block_bytes;         // Carrier bytes per block
+    size_t block_capacity;      // Payload bytes per textured block
+    size_t capacity;            // Payload bytes all textured blocks hold
+
+    /* Cursor */
+    size_t block;               // Block of the next payload byte
+    size_t used;                // Payload bytes of that block already used
+} TextureMap;
+
+/* Build the map of len carrier bytes at pixels, and its capacity, in one parallel pass */
+Status texture_map_build(TextureMap *map, CodecContext *ctx, unsigned char *pixels, size_t len, const LsbLayout *layout);
+
+/* Embed len payload bytes at the cursor, returns the bytes that fit */
+size_t texture_map_embed(TextureMap *map, const LsbCodec *codec, const unsigned char *data, size_t len);
+
+/* Extract len payload bytes at the cursor, returns the bytes found */
+size_t texture_map_extract(TextureMap *map, const LsbCodec *codec, unsigned char *data, size_t len);
+
+/* Move the cursor past len payload bytes, returns the bytes passed */
+size_t texture_map_skip(TextureMap *map, const LsbCodec *codec, size_t len);
+
+#endif
@@ -15,6 +15,15 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_verify,
+    e_daemon,
+    e_client,
+    e_container,
+    e_list,
+    e_extract,
+    e_analyze,
+    e_seq_encode,
+    e_seq_decode,
     e_unsupported
 } OperationType;
 
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "decode.h"
+#include "context.h"
+#include "types.h"
+
+#define VERIFY_BLOCK_SIZE (64 * 1024)   // Secret bytes compared per block
+#define VERIFY_MAX_THREADS 8            // Upper bound on compare workers
+
+/* Range of secret bytes compared by one worker */
+typedef struct
+{
+    int stego_fd;                   // Stego image
+    int secret_fd;                  // Original secret
+    off_t data_off;                 // Carrier offset of secret byte 0
+    size_t data_pos;                // Same offset, counted from the start of pixel data
+    const LsbCodec *codec;          // Layout of the stego image
+    size_t begin;                   // First secret byte of the range
+    size_t end;                     // One past the last secret byte
+    atomic_long *first_mismatch;    // Lowest mismatch found by any worker
+    atomic_int *io_error;           // Set when the secret cannot be read
+    CodecContext *ctx;              // Window holds carrier bytes, scratch decoded and secret blocks
+} VerifyChunk;
+
+/* Function Definitions */
+
+/* Record a mismatch, keeping the lowest offset seen */
+static void note_mismatch(atomic_long *first_mismatch, long offset)
+{
+    long cur = atomic_load(first_mismatch);
+
+    while(offset < cur && !atomic_compare_exchange_weak(first_mismatch, &cur, offset))
+    {
+        // cur was reloaded, try again
+    }
+}
+
+/* Decode and compare one range of the secret, block by block */
+static void *verify_chunk(void *arg)
+{
+    VerifyChunk *chunk = arg;
+    const LsbCodec *codec = chunk -> codec;
+    CodecContext *ctx = chunk -> ctx;
+    size_t data_phase = lsb_phase(codec, chunk -> data_pos);
+
+    // Room for any start phase
+    if(codec_ctx_reserve_window(ctx, lsb_carrier_bytes(codec, 0, VERIFY_BLOCK_SIZE) + 4) == e_failure ||
+       codec_ctx_reserve_scratch(ctx, 2 * VERIFY_BLOCK_SIZE) == e_failure)
+    {
+        atomic_store(chunk -> io_error, 1);
+        return NULL;
+    }
+
+    unsigned char *carrier = ctx -> window;
+    unsigned char *decoded = ctx -> scratch;
+    unsigned char *secret = ctx -> scratch + VERIFY_BLOCK_SIZE;
+
+    for(size_t pos = chunk -> begin; pos < chunk -> end && atomic_load(chunk -> io_error) == 0; pos += VERIFY_BLOCK_SIZE)
+    {
+        // An earlier mismatch already decides the answer
+        if((long)pos >= atomic_load(chunk -> first_mismatch))
+        {
+            break;
+        }
+
+        size_t len = chunk -> end - pos < VERIFY_BLOCK_SIZE ? chunk -> end - pos : VERIFY_BLOCK_SIZE;
+
+        // Carrier bytes of this block, wherever the layout puts them
+        size_t skip = lsb_carrier_bytes(codec, data_phase, pos);
+        size_t phase = lsb_phase(codec, chunk -> data_pos + skip);
+        size_t need = lsb_carrier_bytes(codec, phase, len);
+        ssize_t got = pread(chunk -> stego_fd, carrier, need, chunk -> data_off + skip);
+
+        if(pread(chunk -> secret_fd, secret, len, pos) != (ssize_t)len)
+        {
+            atomic_store(chunk -> io_error, 1);
+            break;
+        }
+
+        // A truncated carrier mismatches at its first missing byte
+        size_t avail = len;
+        if(got < (ssize_t)need)
+        {
+            avail = lsb_data_bytes(codec, phase, got > 0 ? got : 0);
+        }
+
+        codec -> extract(carrier, phase, decoded, avail);
+        if(memcmp(decoded, secret, avail) != 0)
+        {
+            size_t i = 0;
+            while(decoded[i] == secret[i])
+            {
+                i++;
+            }
+            note_mismatch(chunk -> first_mismatch, pos + i);
+            break;
+        }
+        if(avail < len)
+        {
+            note_mismatch(chunk -> first_mismatch, pos + avail);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Compare the first common secret bytes in parallel ranges read straight from the image */
+static void verify_ranges(DecodeInfo *decInfo, int secret_fd, size_t common, atomic_long *first_mismatch, atomic_int *io_error)
+{
+    VerifyChunk chunks[VERIFY_MAX_THREADS];
+    pthread_t tids[VERIFY_MAX_THREADS];
+
+    // Enough blocks per worker to be worth a thread
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t blocks = (common + VERIFY_BLOCK_SIZE - 1) / VERIFY_BLOCK_SIZE;
+    size_t nthreads = blocks / 4 > 1 ? blocks / 4 : 1;
+    if(nthreads > VERIFY_MAX_THREADS)
+    {
+        nthreads = VERIFY_MAX_THREADS;
+    }
+    if(cpus > 0 && nthreads > (size_t)cpus)
+    {
+        nthreads = cpus;
+    }
+
+    // Buffers come from this thread's pool, so repeated checks reuse them
+    for(size_t t = 0; t < nthreads; t++)
+    {
+        if((chunks[t].ctx = codec_ctx_acquire()) == NULL)
+        {
+            nthreads = t;
+        }
+    }
+    if(nthreads == 0)
+    {
+        atomic_store(io_error, 1);
+        return;
+    }
+
+    // Split into block aligned ranges
+    size_t per_thread = (blocks + nthreads - 1) / nthreads * VERIFY_BLOCK_SIZE;
+    size_t started = 0;
+    for(size_t t = 0; t < nthreads; t++)
+    {
+        VerifyChunk *chunk = &chunks[t];
+
+        chunk -> stego_fd = fileno(decInfo -> fptr_dest_image);
+        chunk -> secret_fd = secret_fd;
+        chunk -> data_off = BMP_HEADER_SIZE + decInfo -> ctx -> window_start + decInfo -> ctx -> window_len;
+        chunk -> data_pos = decInfo -> ctx -> window_start + decInfo -> ctx -> window_len;
+        chunk -> codec = decInfo -> codec;
+        chunk -> begin = t * per_thread < common ? t * per_thread : common;
+        chunk -> end = chunk -> begin + per_thread < common ? chunk -> begin + per_thread : common;
+        chunk -> first_mismatch = first_mismatch;
+        chunk -> io_error = io_error;
+
+        // The first range runs on this thread
+        if(t > 0 && pthread_create(&tids[t], NULL, verify_chunk, chunk) == 0)
+        {
+            started |= 1UL << t;
+        }
+    }
+    verify_chunk(&chunks[0]);
+    for(size_t t = 1; t < nthreads; t++)
+    {
+        if(started & (1UL << t))
+        {
+            pthread_join(tids[t], NULL);
+        }
+        else
+        {
+            verify_chunk(&chunks[t]);   // Thread could not start, do it here
+        }
+        codec_ctx_release(chunks[t].ctx);
+    }
+    codec_ctx_release(chunks[0].ctx);
+}
+
+/* Compare the first common secret bytes in payload order, for layouts that cannot be read at random */
+static void verify_serial(DecodeInfo *decInfo, int secret_fd, size_t common, atomic_long *first_mismatch, atomic_int *io_error)
+{
+    // The decode context is busy with the payload, its blocks go to a second one
+    CodecContext *ctx = codec_ctx_acquire();
+
+    if(ctx == NULL || codec_ctx_reserve_scratch(ctx, 2 * VERIFY_BLOCK_SIZE) == e_failure)
+    {
+        atomic_store(io_error, 1);
+        codec_ctx_release(ctx);
+        return;
+    }
+
+    unsigned char *decoded = ctx -> scratch;
+    unsigned char *secret = ctx -> scratch + VERIFY_BLOCK_SIZE;
+
+    for(size_t pos = 0; pos < common && atomic_load(io_error) == 0; pos += VERIFY_BLOCK_SIZE)
+    {
+        size_t len = common - pos < VERIFY_BLOCK_SIZE ? common - pos : VERIFY_BLOCK_SIZE;
+        size_t avail = decode_payload_stream(decInfo, decoded, len);
+
+        if(pread(secret_fd, secret, len, pos) != (ssize_t)len)
+        {
+            atomic_store(io_error, 1);
+            break;
+        }
+
+        // Running out of carrier (or of FEC) mismatches at the first missing byte
+        if(memcmp(decoded, secret, avail) != 0)
+        {
+            size_t i = 0;
+            while(decoded[i] == secret[i])
+            {
+                i++;
+            }
+            note_mismatch(first_mismatch, pos + i);
+            break;
+        }
+        if(avail < len)
+        {
+            note_mismatch(first_mismatch, pos + avail);
+            break;
+        }
+    }
+    codec_ctx_release(ctx);
+}
+
+/* Compare the decoded secret data against the secret file */
+static Status verify_secret_file_data(DecodeInfo *decInfo, int secret_fd, size_t secret_size)
+{
+    atomic_long first_mismatch = LONG_MAX;      // No mismatch yet
+    atomic_int io_error = 0;
+    size_t size = decInfo -> size_output_file;
+
+    // Compare the common prefix, a length difference is a mismatch right after it
+    size_t common = size < secret_size ? size : secret_size;
+    if(size != secret_size)
+    {
+        first_mismatch = common;
+    }
+
+    // Adaptive and FEC layouts are decoded in order, others are split across threads
+    if(decInfo -> layout.adaptive || decInfo -> layout.fec)
+    {
+        verify_serial(decInfo, secret_fd, common, &first_mismatch, &io_error);
+    }
+    else
+    {
+        verify_ranges(decInfo, secret_fd, common, &first_mismatch, &io_error);
+    }
+
+    if(atomic_load(&io_error))
+    {
+        printf("Error: Unable to read secret file\n");
+        report_error(decInfo -> report, e_err_io);
+        return e_failure;
+    }
+
+    long mismatch = atomic_load(&first_mismatch);
+    if(mismatch != LONG_MAX)
+    {
+        decInfo -> mismatch_offset = mismatch;
+        printf("Secret data mismatch at offset %ld\n", mismatch);
+        report_error(decInfo -> report, e_err_mismatch);
+        return e_failure;
+    }
+
+    printf("Secret data verified: %zu bytes match\n", common);
+    return e_success;
+}
+
+/* Read and validate Verify args from argv */
+Status read_and_validate_verify_args(char *argv[], DecodeInfo *decInfo)
+{
+    // Stego image is checked like for decoding
+    if(argv[3] == NULL || read_and_validate_decode_args(argv, decInfo) == e_failure)
+    {
+        return e_failure;
+    }
+
+    decInfo -> secret_fname = argv[3];
+    decInfo -> output_fname = argv[3];      // Only used to print the name
+    return e_success;
+}
+
+/* Check that the stego image carries the secret file, without writing output */
+Status do_verification(DecodeInfo *decInfo)
+{
+    Status ret = e_failure;
+    FILE *fptr_secret = NULL;
+    struct stat st;
+
+    decInfo -> mismatch_offset = -1;
+
+    // Take codec buffers from this thread's pool
+    if((decInfo -> ctx = codec_ctx_acquire()) == NULL)
+    {
+        return e_failure;
+    }
+
+    report_stage(decInfo -> report, "open");
+    if((open_files_for_decoding(decInfo)) == e_success)
+    {
+        printf("Stego image file opened successfully\n");
+
+        /* Decode magic string, extension and size */
+        if((decode_stego_header(decInfo)) == e_success)
+        {
+            report_stage(decInfo -> report, "compare");
+            const char *extn = strstr(decInfo -> secret_fname, ".");   // Same rule as the encoder
+
+            if((fptr_secret = fopen(decInfo -> secret_fname, "r")) == NULL || fstat(fileno(fptr_secret), &st) != 0)
+            {
+                perror("fopen");
+                fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo -> secret_fname);
+                report_error(decInfo -> report, e_err_open);
+            }
+            else if(extn == NULL || strcmp(extn, decInfo -> extn_output_file) != 0)
+            {
+                printf("Secret file extension mismatch: %s\n", decInfo -> extn_output_file);
+                report_error(decInfo -> report, e_err_mismatch);
+            }
+            else
+            {
+                ret = verify_secret_file_data(decInfo, fileno(fptr_secret), st.st_size);
+            }
+        }
+    }
+
+    if(fptr_secret != NULL)
+    {
+        fclose(fptr_secret);
+    }
+    if(decInfo -> fptr_dest_image != NULL)
+    {
+        fclose(decInfo -> fptr_dest_image);
+        decInfo -> fptr_dest_image = NULL;
+    }
+    codec_ctx_release(decInfo -> ctx);
+    decInfo -> ctx = NULL;
+
+    return ret;
+}